@@ -0,0 +1,1553 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "pico/multicore.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "hardware/structs/iobank0.h"
+
+#include "link_engine.h"
+#include "link_event.h"
+#include "link_hub.h"
+#include "link_pacer.h"
+#include "link_printer.h"
+#include "link_script.h"
+#include "link_telemetry.h"
+#include "link_trace.h"
+#include "link_wire.h"
+
+spsc_ring_t link_tx_ring;
+spsc_ring_t link_rx_ring;
+
+static uint8_t tx_ring_buf[LINK_RING_SIZE];
+static uint8_t rx_ring_buf[LINK_RING_SIZE];
+
+static pio_spi_inst_t *link_spi;
+static pio_spi_inst_t *link_slave;
+static pio_gba_inst_t *link_gba;
+
+// The DMA ring wraps on an address boundary, so the buffer is aligned to its size
+#define LINK_CAPTURE_SIZE (1u << LINK_CAPTURE_BITS)
+static uint8_t capture_buf[LINK_CAPTURE_SIZE] __aligned(LINK_CAPTURE_SIZE);
+
+// Live settings. Only core 1 writes them, core 0 reads them back once its
+// own requests for them have been taken.
+static volatile uint8_t bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+static volatile uint32_t us_between_transfer = US_DEFAULT_PER_TRANSFER;
+static volatile uint8_t link_mode = LINK_MODE_RAW;
+
+// Adaptive pacing settings, core 1 starts over whenever adapt_generation moves
+static bool adaptive = false;
+static uint8_t adapt_idle = 0xFF;
+static uint32_t adapt_min_us = LINK_ADAPT_MIN_US;
+static uint32_t adapt_max_us = LINK_ADAPT_MAX_US;
+static uint32_t adapt_generation = 0;
+
+// Ready line
+static uint ready_pin;
+static volatile bool ready_enabled = false;
+static bool ready_active_high = true;
+
+// Frame format of raw and slave mode, see link_engine_set_format()
+static uint8_t format_bits = 8;
+static bool format_lsb_first = false;
+
+// Clock change requested by core 0, kept until the master SM runs
+static uint32_t clock_request_hz;
+static bool clock_pending = false;
+
+static volatile bool suspended = false;
+
+// Only written by core 0
+static uint32_t bytes_submitted = 0;
+// Only written by core 1, counts link_tx_ring bytes whose output is in link_rx_ring
+static volatile uint32_t bytes_done = 0;
+
+// Settings changes from core 0, a ring of fixed size records that core 1
+// applies in order between bursts. Records are consumed once applied.
+typedef enum
+{
+  REQUEST_CONFIGURE, // arg[0] bytes per transfer, value gap
+  REQUEST_MODE,      // arg[0] link_mode_t
+  REQUEST_READY,     // arg[0] enable, arg[1] active high
+  REQUEST_CLOCK,     // value SCK rate
+  REQUEST_FORMAT,    // arg[0] bits, arg[1] LSB-first
+  REQUEST_COUNT
+} request_op_t;
+
+typedef struct
+{
+  uint8_t op;
+  uint8_t arg[3];
+  uint32_t value;
+} link_request_t;
+
+// A whole number of records, so none is ever split at the wrap. Ready
+// before link_engine_start(), core 0 configures the link before launching
+// core 1.
+static uint8_t request_ring_buf[32 * sizeof(link_request_t)];
+static spsc_ring_t request_ring = { .buf = request_ring_buf, .mask = sizeof(request_ring_buf) - 1 };
+
+// Core 0 only: the last request of each kind, and the request_ring count
+// at which it has been applied
+static link_request_t requested[REQUEST_COUNT];
+static uint32_t requested_at[REQUEST_COUNT];
+
+//--------------------------------------------------------------------+
+// Core 0 side
+//--------------------------------------------------------------------+
+
+static bool request_post(request_op_t op, uint8_t arg0, uint8_t arg1, uint32_t value)
+{
+  link_request_t request = { .op = op, .arg = { arg0, arg1 }, .value = value };
+
+  // Core 1 may be stuck in a burst until core 0 drains link_rx_ring, so
+  // waiting for room here could wait forever
+  if ( spsc_ring_free(&request_ring) < sizeof(request) ) return false;
+
+  spsc_ring_push(&request_ring, (uint8_t const *) &request, sizeof(request));
+  requested[op] = request;
+  requested_at[op] = atomic_load_explicit(&request_ring.tail, memory_order_relaxed);
+  __sev();
+  return true;
+}
+
+// Whether the last request of this kind is still waiting for core 1
+static bool request_pending(request_op_t op)
+{
+  uint32_t head = atomic_load_explicit(&request_ring.head, memory_order_acquire);
+  return (int32_t) (head - requested_at[op]) < 0;
+}
+
+bool link_engine_configure(uint8_t chunk, uint32_t gap_us)
+{
+  if ( chunk > LINK_MAX_CHUNK ) chunk = LINK_MAX_CHUNK;
+  if ( chunk == 0 ) chunk = 1;
+
+  return request_post(REQUEST_CONFIGURE, chunk, 0, gap_us);
+}
+
+bool link_engine_set_mode(link_mode_t mode)
+{
+  return request_post(REQUEST_MODE, mode, 0, 0);
+}
+
+void link_engine_set_ready_pin(uint pin)
+{
+  ready_pin = pin;
+  gpio_init(pin);
+  gpio_set_dir(pin, GPIO_IN);
+}
+
+bool link_engine_set_ready(bool enable, bool active_high)
+{
+  return request_post(REQUEST_READY, enable, active_high, 0);
+}
+
+bool link_engine_set_clock(uint32_t sck_hz)
+{
+  return request_post(REQUEST_CLOCK, 0, 0, sck_hz);
+}
+
+bool link_engine_set_format(uint8_t n_bits, bool lsb_first)
+{
+  return request_post(REQUEST_FORMAT, n_bits, lsb_first, 0);
+}
+
+void link_engine_set_suspended(bool suspend)
+{
+  suspended = suspend;
+  __sev();
+}
+
+uint8_t link_engine_bytes_per_transfer(void)
+{
+  return request_pending(REQUEST_CONFIGURE) ? requested[REQUEST_CONFIGURE].arg[0] : bytes_per_transfer;
+}
+
+uint32_t link_engine_us_between_transfer(void)
+{
+  return request_pending(REQUEST_CONFIGURE) ? requested[REQUEST_CONFIGURE].value : us_between_transfer;
+}
+
+bool link_engine_ready(void)
+{
+  return request_pending(REQUEST_READY) ? requested[REQUEST_READY].arg[0] : ready_enabled;
+}
+
+link_mode_t link_engine_mode(void)
+{
+  return request_pending(REQUEST_MODE) ? requested[REQUEST_MODE].arg[0] : link_mode;
+}
+
+uint32_t link_engine_submit(uint8_t const *src, uint32_t len)
+{
+  len = spsc_ring_push(&link_tx_ring, src, len);
+  bytes_submitted += len;
+  return len;
+}
+
+void link_engine_commit(uint32_t len)
+{
+  spsc_ring_commit(&link_tx_ring, len);
+  bytes_submitted += len;
+}
+
+bool link_engine_idle(void)
+{
+  return bytes_done == bytes_submitted;
+}
+
+//--------------------------------------------------------------------+
+// Core 1 side
+//--------------------------------------------------------------------+
+
+typedef enum
+{
+  FRAME_HEADER,   // waiting for the next frame header
+  FRAME_DISPATCH, // header in, waiting for its turn to reply
+  FRAME_RECORD,   // waiting for the next exchange record header
+  FRAME_EXCHANGE, // exchange record on the wire
+  FRAME_PAYLOAD,  // waiting for a short fixed size payload
+  FRAME_RULES,    // loading SCRIPT_LOAD rules
+  FRAME_SCRIPT,   // script running, replies once it stops
+  FRAME_BENCH,    // benchmark running, replies once it is over
+  FRAME_PORT,     // passing PORT_EXCHANGE data on to a hub port
+  FRAME_COPY,     // echoing payload bytes back
+  FRAME_SKIP      // dropping payload bytes
+} frame_state_t;
+
+static link_pacer_t pacer;
+static link_stats_t stats;
+
+// Current burst: bytes clocked out back to back, followed by gap_us of idle
+static uint32_t burst_left = 0; // bytes not started yet
+static uint32_t on_wire = 0;    // bytes the DMA is exchanging right now
+static uint8_t const *wire_src; // and where they are
+static uint8_t *wire_dst;
+static bool wire_staged;        // in wire_tx and wire_rx rather than the rings
+
+// Ring data can sit at any byte offset, so frames wider than a byte are
+// staged in word aligned buffers for the 16 and 32 bit DMA. So are frames
+// that need moving within their bytes, see link_wire.h.
+static uint8_t wire_tx[LINK_MAX_CHUNK] __aligned(4);
+static uint8_t wire_rx[LINK_MAX_CHUNK] __aligned(4);
+static uint32_t burst_gap_us = 0;
+static bool backlog = false;      // the next chunk was queued when the last one finished
+static bool burst_adaptive;       // the gap after this burst depends on its reply
+static bool burst_ok;             // the reply so far had more than the idle byte in it
+static bool link_stalled = false;
+
+// Slave mode
+static uint32_t responding = 0;    // response bytes the DMA is queueing right now
+static uint32_t capture_read = 0;  // captured bytes streamed to link_rx_ring so far
+static uint32_t capture_moved = 0; // captured frames put in ring order so far
+
+// GBA mode. Ring data can sit at any byte offset, so packets are staged in
+// halfword aligned buffers for the 16 bit DMA.
+#define GBA_MAX_PACKETS (LINK_MAX_CHUNK / LINK_GBA_SEND_LEN)
+static uint16_t gba_send[GBA_MAX_PACKETS];
+static uint16_t gba_slots[GBA_MAX_PACKETS * PIO_GBA_SLOTS];
+
+// Printer mode, captured bytes go through printer instead of link_rx_ring
+static link_printer_t printer;
+static uint8_t printer_seq;
+// The replies to the two bytes after the last one taken, queued afresh when
+// printer_resync is set, see printer_task()
+static uint8_t printer_replies[2];
+static bool printer_resync;
+
+// Response script
+static link_script_t script;
+static uint8_t script_tx, script_rx; // the byte on the wire
+static uint32_t script_limit;
+static bool script_running = false;
+static link_result_t script_result;
+static uint8_t script_forward[LINK_SCRIPT_MAX_FORWARD];
+static uint32_t script_forwarded;
+
+static link_bench_t bench;
+static link_report_t bench_report;
+static uint8_t bench_tx[LINK_MAX_CHUNK];
+static uint8_t bench_rx[LINK_MAX_CHUNK];
+static uint32_t bench_clkdiv;   // SM divider to go back to, 16.8 fixed point, 0 if unchanged
+static uint32_t bench_chunks;
+static uint64_t bench_start_us; // of the first chunk
+static uint64_t bench_chunk_us; // of the chunk on the wire
+static uint64_t bench_end_us;   // of the last chunk done
+static uint64_t bench_late_us;  // pacing error, summed
+
+static link_adapt_t adapt;
+static uint32_t adapt_seen; // adapt_generation adapt was set up for
+
+static frame_state_t frame_state = FRAME_HEADER;
+static link_frame_t frame;
+static uint32_t frame_left = 0; // payload bytes of the current frame not handled yet
+static link_exchange_t record;
+static uint8_t frame_port;
+
+static inline void tx_done(uint32_t len)
+{
+  bytes_done += len;
+}
+
+static uint32_t apply_clock(uint32_t sck_hz)
+{
+  if ( sck_hz )
+    return pio_spi_set_rate(link_spi, sck_hz);
+
+  pio_spi_set_clkdiv(link_spi, LINK_DEFAULT_CLKDIV);
+  return pio_spi_get_rate(link_spi);
+}
+
+static void configure_apply(uint8_t chunk, uint32_t gap_us)
+{
+  if ( chunk > LINK_MAX_CHUNK ) chunk = LINK_MAX_CHUNK;
+  if ( chunk == 0 ) chunk = 1;
+
+  bytes_per_transfer = chunk;
+  us_between_transfer = gap_us;
+  adaptive = gap_us == LINK_PROTO_ADAPTIVE_GAP;
+  adapt_generation++;
+}
+
+static void ready_apply(bool enable, bool active_high)
+{
+  bool fresh = enable && (!ready_enabled || ready_active_high != active_high);
+  ready_active_high = active_high;
+  ready_enabled = enable;
+
+  // Hold the line inactive while nothing drives it
+  if ( active_high )
+    gpio_pull_down(ready_pin);
+  else
+    gpio_pull_up(ready_pin);
+
+  // Edges latch while the line is off too, and the pull change may add
+  // one; left there, the first chunk would go on a stale ready
+  if ( fresh ) gpio_acknowledge_irq(ready_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+}
+
+static void format_set(uint8_t n_bits, bool lsb_first)
+{
+  if ( n_bits == 0 || n_bits > 32 ) n_bits = 8;
+
+  format_bits = n_bits;
+  format_lsb_first = lsb_first;
+}
+
+// The master runs the configured frame format in raw mode and the slave
+// in slave mode; everything else on them exchanges plain bytes
+static void format_apply_sm(pio_spi_inst_t *spi, bool use)
+{
+  uint n_bits = use ? format_bits : 8;
+  bool lsb_first = use && format_lsb_first;
+
+  if ( pio_spi_frame_bits(spi) != n_bits || spi->lsb_first != lsb_first )
+    pio_spi_set_frame(spi, n_bits, lsb_first);
+}
+
+// With no DMA transfer in flight, and the slave not capturing
+static void format_apply(link_mode_t mode)
+{
+  format_apply_sm(link_spi, mode == LINK_MODE_RAW);
+  format_apply_sm(link_slave, mode == LINK_MODE_SLAVE);
+}
+
+static bool format_applied(link_mode_t mode)
+{
+  pio_spi_inst_t const *spi = mode == LINK_MODE_SLAVE ? link_slave : link_spi;
+  if ( mode != LINK_MODE_RAW && mode != LINK_MODE_SLAVE ) return true;
+  return pio_spi_frame_bits(spi) == format_bits && spi->lsb_first == format_lsb_first;
+}
+
+// Up to max bytes of link_tx_ring for the DMA, a whole number of spi's
+// frames, pointed at by wire_src. Bytes go straight out of the ring, other
+// frames are copied out into wire_tx and moved into FIFO position.
+static uint32_t wire_take(pio_spi_inst_t const *spi, uint32_t max)
+{
+  size_t size = pio_spi_frame_size(spi);
+  uint32_t len;
+
+  if ( pio_spi_frame_bits(spi) == 8 )
+  {
+    len = spsc_ring_peek(&link_tx_ring, &wire_src);
+    wire_staged = false;
+    return len < max ? len : max;
+  }
+
+  len = spsc_ring_available(&link_tx_ring);
+  if ( len > max ) len = max;
+  if ( len > sizeof(wire_tx) ) len = sizeof(wire_tx);
+  len -= len % size;
+  spsc_ring_pop(&link_tx_ring, wire_tx, len);
+  link_wire_to_fifo(wire_tx, len, pio_spi_frame_bits(spi), spi->lsb_first);
+  wire_src = wire_tx;
+  wire_staged = true;
+  return len;
+}
+
+// Done with len bytes from wire_take()
+static void wire_release(uint32_t len)
+{
+  if ( !wire_staged ) spsc_ring_consume(&link_tx_ring, len);
+}
+
+// Apply core 0's requests in the order they were made, between bursts only
+static void requests_take(void)
+{
+  uint8_t const *src;
+  link_request_t request;
+
+  while ( spsc_ring_peek(&request_ring, &src) >= sizeof(request) )
+  {
+    memcpy(&request, src, sizeof(request));
+    switch ( request.op )
+    {
+      case REQUEST_CONFIGURE:
+        configure_apply(request.arg[0], request.value);
+        break;
+
+      case REQUEST_MODE:
+        if ( request.arg[0] < LINK_MODE_COUNT ) link_mode = request.arg[0];
+        break;
+
+      case REQUEST_READY:
+        ready_apply(request.arg[0], request.arg[1]);
+        break;
+
+      case REQUEST_CLOCK:
+        clock_request_hz = request.value;
+        clock_pending = true;
+        break;
+
+      case REQUEST_FORMAT:
+        format_set(request.arg[0], request.arg[1]);
+        break;
+    }
+    // Core 0 reads the live settings back from here on
+    spsc_ring_consume(&request_ring, sizeof(request));
+  }
+}
+
+static inline uint32_t ready_edge(void)
+{
+  return ready_active_high ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+}
+
+// The raw interrupt status latches edges whether or not the interrupt is
+// enabled, so a short ready pulse is not missed between two polls
+static inline bool ready_seen(void)
+{
+  uint32_t events = io_bank0_hw->intr[ready_pin / 8] >> (4 * (ready_pin % 8));
+  return events & ready_edge();
+}
+
+static inline void ready_rearm(void)
+{
+  gpio_acknowledge_irq(ready_pin, ready_edge());
+}
+
+static inline bool burst_active(void)
+{
+  return burst_left || on_wire;
+}
+
+static void burst_begin(uint32_t len, uint32_t gap_us)
+{
+  burst_adaptive = false;
+  burst_ok = false;
+
+  if ( backlog && time_us_64() > pacer.release_us + LINK_TELEMETRY_SLACK_US )
+    link_telemetry.pacing_overruns++;
+
+  burst_left = len;
+  burst_gap_us = gap_us;
+  if ( !len )
+    link_pacer_done(&pacer, time_us_64(), gap_us);
+}
+
+// Drive the current burst, returns true once it has finished
+static bool __time_critical_func(burst_step)(void)
+{
+  if ( on_wire )
+  {
+    if ( !pio_spi_dma_poll(link_spi) ) return false;
+
+    if ( wire_staged )
+    {
+      // Both ways back to ring order, for the trace and link_rx_ring
+      uint32_t n_bits = pio_spi_frame_bits(link_spi);
+      link_wire_sent(wire_tx, on_wire, n_bits, link_spi->lsb_first);
+      link_wire_from_fifo(wire_rx, on_wire, n_bits, link_spi->lsb_first);
+    }
+    link_trace_bytes(time_us_32(), wire_src, wire_dst, on_wire, 0);
+    for ( uint32_t i = 0; burst_adaptive && !burst_ok && i < on_wire; i++ )
+      burst_ok = wire_dst[i] != adapt_idle;
+    wire_release(on_wire);
+    if ( wire_staged )
+      spsc_ring_push(&link_rx_ring, wire_rx, on_wire); // room was checked before it went out
+    else
+      spsc_ring_commit(&link_rx_ring, on_wire);
+    tx_done(on_wire);
+    stats.bytes_exchanged += on_wire;
+    link_telemetry.link_tx_bytes += on_wire;
+    link_telemetry.link_rx_bytes += on_wire;
+    on_wire = 0;
+
+    if ( !burst_left )
+    {
+      backlog = !spsc_ring_empty(&link_tx_ring);
+      if ( ready_enabled ) ready_rearm();
+      if ( burst_adaptive )
+      {
+        if ( !burst_ok ) link_telemetry.adapt_backoffs++;
+        burst_gap_us = link_telemetry.adapt_gap_us = link_adapt_update(&adapt, burst_ok);
+      }
+      link_pacer_done(&pacer, time_us_64(), burst_gap_us);
+      return true;
+    }
+  }
+
+  if ( !burst_left ) return true;
+
+  // Exchange straight out of one ring and into the other. A burst that
+  // wraps around the end of either ring goes out as two back to back
+  // segments, with no pacing gap in between. Staged frames are pushed
+  // rather than committed, so they only need room, not contiguous room.
+  size_t size = pio_spi_frame_size(link_spi);
+  uint8_t *dst;
+  uint32_t space = spsc_ring_reserve(&link_rx_ring, &dst);
+  if ( pio_spi_frame_bits(link_spi) != 8 ) space = spsc_ring_free(&link_rx_ring);
+  link_telemetry_stall(&link_telemetry.link_stalls, &link_stalled, space < size);
+  uint32_t len = wire_take(link_spi, space < burst_left ? space : burst_left);
+  if ( !len ) return false; // wait for data, or for core 0 to drain link_rx_ring
+
+  burst_left -= len;
+  on_wire = len;
+  wire_dst = wire_staged ? wire_rx : dst;
+  pio_spi_dma_start(link_spi, wire_src, wire_dst, len / size);
+  return false;
+}
+
+static void __time_critical_func(raw_task)(void)
+{
+  if ( burst_active() )
+  {
+    burst_step();
+    return;
+  }
+
+  bool ready = false;
+  if ( !link_pacer_due(&pacer, time_us_64()) )
+  {
+    ready = ready_enabled && ready_seen();
+    if ( !ready ) return;
+  }
+
+  // Chunks are whole frames, a trailing partial frame waits for the rest
+  size_t size = pio_spi_frame_size(link_spi);
+  uint32_t chunk = bytes_per_transfer < size ? size : bytes_per_transfer - bytes_per_transfer % size;
+  uint32_t len = spsc_ring_available(&link_tx_ring);
+  if ( len > chunk ) len = chunk;
+  len -= len % size;
+  if ( !len ) return;
+
+  if ( ready ) link_telemetry.ready_releases++;
+
+  // New settings, or a new session: start from the safe side again
+  if ( adapt_seen != adapt_generation )
+  {
+    adapt_seen = adapt_generation;
+    link_adapt_init(&adapt, adapt_min_us, adapt_max_us, US_DEFAULT_PER_TRANSFER);
+    link_telemetry.adapt_gap_us = adapt.gap_us;
+  }
+
+  // The gap after an adaptive burst is only known once its reply is in
+  burst_begin(len, us_between_transfer);
+  burst_adaptive = adaptive;
+  burst_step();
+}
+
+// Stream what has been clocked in since last time to link_rx_ring
+static void slave_capture(void)
+{
+  size_t size = pio_spi_frame_size(link_slave);
+  uint32_t count = pio_spi_capture_count(link_slave);
+
+  // Each frame is moved once, the ones the DMA has lapped are lost anyway
+  uint32_t n_bits = pio_spi_frame_bits(link_slave);
+  if ( link_slave->lsb_first && !link_wire_direct(n_bits) )
+  {
+    if ( count - capture_moved > LINK_CAPTURE_SIZE / size )
+      capture_moved = count - LINK_CAPTURE_SIZE / size;
+    for ( ; capture_moved != count; capture_moved++ )
+    {
+      uint32_t offset = capture_moved * size & (LINK_CAPTURE_SIZE - 1);
+      link_wire_from_fifo(capture_buf + offset, size, n_bits, true);
+    }
+  }
+
+  uint32_t len = count * size - capture_read;
+  if ( len > LINK_CAPTURE_SIZE )
+  {
+    // Lapped by the DMA, the oldest bytes are gone
+    capture_read += len - LINK_CAPTURE_SIZE;
+    len = LINK_CAPTURE_SIZE;
+    stats.errors++;
+  }
+
+  uint32_t offset = capture_read & (LINK_CAPTURE_SIZE - 1);
+  if ( len > LINK_CAPTURE_SIZE - offset ) len = LINK_CAPTURE_SIZE - offset;
+
+  uint32_t pushed = spsc_ring_push(&link_rx_ring, capture_buf + offset, len);
+  link_trace_bytes(time_us_32(), NULL, capture_buf + offset, pushed, LINK_TRACE_SLAVE);
+  link_telemetry_stall(&link_telemetry.link_stalls, &link_stalled, pushed < len);
+  capture_read += pushed;
+  stats.bytes_exchanged += pushed;
+  link_telemetry.link_rx_bytes += pushed;
+}
+
+static void __time_critical_func(slave_task)(void)
+{
+  // Keep the TX FIFO topped up with responses, so each one is in place
+  // before the Game Boy starts clocking its byte
+  if ( responding && pio_spi_dma_write_poll(link_slave) )
+  {
+    if ( wire_staged )
+      link_wire_sent(wire_tx, responding, pio_spi_frame_bits(link_slave), link_slave->lsb_first);
+    link_trace_bytes(time_us_32(), wire_src, NULL, responding, LINK_TRACE_SLAVE);
+    wire_release(responding);
+    tx_done(responding);
+    link_telemetry.link_tx_bytes += responding;
+    responding = 0;
+  }
+
+  if ( !responding )
+  {
+    responding = wire_take(link_slave, UINT32_MAX);
+    if ( responding )
+      pio_spi_dma_write_start(link_slave, wire_src, responding / pio_spi_frame_size(link_slave));
+  }
+
+  slave_capture();
+}
+
+static void slave_enter(void)
+{
+  // Capture is armed first, so the very first byte clocked in is kept
+  capture_read = 0;
+  capture_moved = 0;
+  pio_spi_capture_start(link_slave, capture_buf, LINK_CAPTURE_BITS);
+  pio_spi_slave_start(link_slave, link_spi);
+}
+
+static void slave_leave(void)
+{
+  pio_spi_slave_stop(link_slave, link_spi);
+  slave_capture();
+  pio_spi_capture_stop(link_slave);
+
+  if ( responding )
+  {
+    wire_release(responding);
+    tx_done(responding);
+    responding = 0;
+  }
+}
+
+// Packets go out a chunk at a time, like raw mode, with on_wire counting
+// the packets in flight
+static void __time_critical_func(gba_task)(void)
+{
+  if ( on_wire )
+  {
+    if ( !pio_gba_dma_poll(link_gba) ) return;
+
+    uint32_t sent = on_wire * LINK_GBA_SEND_LEN;
+    uint32_t got = on_wire * LINK_GBA_REPLY_LEN;
+    uint32_t now = time_us_32();
+    link_trace_bytes(now, (uint8_t const *) gba_send, NULL, sent, LINK_TRACE_GBA);
+    link_trace_bytes(now, NULL, (uint8_t const *) gba_slots, got, LINK_TRACE_GBA);
+
+    // Room for it was checked before the packets went out
+    spsc_ring_push(&link_rx_ring, (uint8_t const *) gba_slots, got);
+    tx_done(sent);
+    stats.bytes_exchanged += sent;
+    link_telemetry.link_tx_bytes += sent;
+    link_telemetry.link_rx_bytes += got;
+    on_wire = 0;
+
+    link_pacer_done(&pacer, time_us_64(), us_between_transfer);
+    return;
+  }
+
+  if ( !link_pacer_due(&pacer, time_us_64()) ) return;
+
+  // A trailing odd byte waits for the rest of its packet
+  uint32_t packets = spsc_ring_available(&link_tx_ring) / LINK_GBA_SEND_LEN;
+  if ( !packets ) return;
+
+  uint32_t chunk = bytes_per_transfer / LINK_GBA_SEND_LEN;
+  if ( !chunk ) chunk = 1;
+  if ( packets > chunk ) packets = chunk;
+
+  uint32_t room = spsc_ring_free(&link_rx_ring) / LINK_GBA_REPLY_LEN;
+  link_telemetry_stall(&link_telemetry.link_stalls, &link_stalled, !room);
+  if ( packets > room ) packets = room;
+  if ( !packets ) return;
+
+  spsc_ring_pop(&link_tx_ring, (uint8_t *) gba_send, packets * LINK_GBA_SEND_LEN);
+  on_wire = packets;
+  pio_gba_dma_start(link_gba, gba_send, gba_slots, packets);
+}
+
+// Hand a finished band or print to the host as an unsolicited reply frame
+static void printer_emit(link_printer_event_t event)
+{
+  bool band = event == LINK_PRINTER_BAND_READY;
+  uint8_t const *payload = band ? printer.band : printer.print;
+  uint16_t len = band ? printer.band_len : LINK_PRINTER_PRINT_LEN;
+  uint8_t header[LINK_PROTO_HEADER_LEN];
+
+  // The Game Boy cannot be held up, what the host has no room for is lost
+  bool stalled = spsc_ring_free(&link_rx_ring) < sizeof(header) + len;
+  link_telemetry_stall(&link_telemetry.link_stalls, &link_stalled, stalled);
+  if ( stalled )
+  {
+    stats.errors++;
+    return;
+  }
+
+  link_proto_put_header(header, (band ? LINK_OP_PRINTER_BAND : LINK_OP_PRINTER_PRINT) | LINK_OP_REPLY,
+                        printer_seq++, len);
+  spsc_ring_push(&link_rx_ring, header, sizeof(header));
+  spsc_ring_push(&link_rx_ring, payload, len);
+}
+
+static void __time_critical_func(printer_task)(void)
+{
+  // Nothing the host sends has a place on the wire
+  uint32_t ignored = spsc_ring_available(&link_tx_ring);
+  if ( ignored )
+  {
+    spsc_ring_consume(&link_tx_ring, ignored);
+    tx_done(ignored);
+  }
+
+  uint32_t count = pio_spi_capture_count(link_slave);
+  if ( count - capture_read > LINK_CAPTURE_SIZE )
+  {
+    capture_read = count - LINK_CAPTURE_SIZE;
+    stats.errors++;
+  }
+
+  while ( capture_read != count )
+  {
+    uint8_t in = capture_buf[capture_read++ & (LINK_CAPTURE_SIZE - 1)];
+    link_printer_event_t event;
+
+    // The reply goes out first, its byte may already be on its way. A packet
+    // start puts the lag back to two bytes, whatever a late reply did to it.
+    uint8_t reply = link_printer_byte(&printer, in, &event);
+    pio_spi_slave_put(link_slave, reply);
+    printer_replies[0] = printer_replies[1];
+    printer_replies[1] = reply;
+    if ( event == LINK_PRINTER_SYNC ) printer_resync = true;
+    link_trace_bytes(time_us_32(), NULL, &in, 1, LINK_TRACE_SLAVE);
+    stats.bytes_exchanged++;
+    link_telemetry.link_rx_bytes++;
+
+    if ( event == LINK_PRINTER_BAND_READY || event == LINK_PRINTER_PRINT_READY ) printer_emit(event);
+  }
+
+  // Only with every byte in taken and none under way: a flush mid byte
+  // would throw the replies off the Game Boy's bytes for good. On time that
+  // is right after the sync; when core 1 is behind it is the first gap
+  // between bytes it sees once it has caught up.
+  if ( printer_resync && capture_read == pio_spi_capture_count(link_slave) &&
+       pio_spi_slave_flush(link_slave) )
+  {
+    pio_spi_slave_put(link_slave, printer_replies[0]);
+    pio_spi_slave_put(link_slave, printer_replies[1]);
+
+    // A byte that ended between the count and the flush was not taken,
+    // the replies just queued are one early then
+    printer_resync = capture_read != pio_spi_capture_count(link_slave);
+  }
+}
+
+static void printer_enter(void)
+{
+  link_printer_init(&printer);
+  pio_spi_slave_set_idle(link_slave, 0x00);
+  printer_replies[0] = printer_replies[1] = 0x00;
+  printer_resync = false;
+
+  capture_read = 0;
+  pio_spi_capture_start(link_slave, capture_buf, LINK_CAPTURE_BITS);
+  pio_spi_slave_start(link_slave, link_spi);
+
+  // The replies to the first two bytes, see link_printer.h
+  pio_spi_slave_put(link_slave, 0x00);
+  pio_spi_slave_put(link_slave, 0x00);
+}
+
+static void printer_leave(void)
+{
+  pio_spi_slave_stop(link_slave, link_spi);
+  pio_spi_capture_stop(link_slave);
+  pio_spi_slave_set_idle(link_slave, LINK_SLAVE_IDLE);
+}
+
+static void reply_header(uint8_t opcode, uint16_t len)
+{
+  uint8_t header[LINK_PROTO_HEADER_LEN];
+  link_proto_put_header(header, opcode | LINK_OP_REPLY, frame.seq, len);
+  spsc_ring_push(&link_rx_ring, header, sizeof(header));
+}
+
+static void reply_error(link_status_t status)
+{
+  uint8_t payload[2] = { frame.opcode, status };
+  reply_header(LINK_OP_ERROR, sizeof(payload));
+  spsc_ring_push(&link_rx_ring, payload, sizeof(payload));
+  stats.errors++;
+}
+
+// Move up to frame_left bytes from link_tx_ring, either echoed into
+// link_rx_ring or dropped. Returns true once the frame is used up.
+static bool frame_drain(bool echo)
+{
+  uint8_t const *src;
+  uint32_t len = spsc_ring_peek(&link_tx_ring, &src);
+  if ( len > frame_left ) len = frame_left;
+
+  if ( echo )
+  {
+    uint8_t *dst;
+    uint32_t space = spsc_ring_reserve(&link_rx_ring, &dst);
+    if ( len > space ) len = space;
+    memcpy(dst, src, len);
+    spsc_ring_commit(&link_rx_ring, len);
+  }
+
+  spsc_ring_consume(&link_tx_ring, len);
+  tx_done(len);
+  frame_left -= len;
+  return frame_left == 0;
+}
+
+static void frame_begin(void)
+{
+  uint8_t header[LINK_PROTO_HEADER_LEN];
+
+  if ( spsc_ring_available(&link_tx_ring) < LINK_PROTO_HEADER_LEN ) return;
+
+  // Resynchronise on garbage by dropping bytes up to the next sync byte
+  uint8_t const *sync;
+  spsc_ring_peek(&link_tx_ring, &sync);
+  if ( *sync != LINK_PROTO_SYNC )
+  {
+    spsc_ring_consume(&link_tx_ring, 1);
+    tx_done(1);
+    stats.errors++;
+    return;
+  }
+
+  spsc_ring_pop(&link_tx_ring, header, sizeof(header));
+  link_proto_get_header(header, &frame);
+  frame_left = frame.len;
+  stats.frames++;
+  tx_done(sizeof(header));
+  frame_state = FRAME_DISPATCH;
+}
+
+static void frame_dispatch(void)
+{
+  // Port data is taken in while earlier port replies are still owed
+  if ( frame.version == LINK_PROTO_VERSION && frame.opcode == LINK_OP_PORT_EXCHANGE && frame.len )
+  {
+    uint8_t const *port;
+    if ( !spsc_ring_peek(&link_tx_ring, &port) ) return;
+    if ( link_hub_enabled(*port) )
+    {
+      if ( !link_hub_expect(*port, frame.seq, frame.len - 1) ) return;
+
+      frame_port = *port;
+      spsc_ring_consume(&link_tx_ring, 1);
+      tx_done(1);
+      frame_left--;
+      frame_state = FRAME_PORT;
+      return;
+    }
+  }
+
+  // Every other reply goes out after the port replies owed before it
+  if ( link_hub_pending() ) return;
+
+  // Room for the header and any of the short replies
+  if ( spsc_ring_free(&link_rx_ring) < LINK_PROTO_HEADER_LEN + LINK_PROTO_STATS_LEN ) return;
+
+  if ( frame.version != LINK_PROTO_VERSION )
+  {
+    reply_error(LINK_STATUS_BAD_VERSION);
+    frame_state = FRAME_SKIP;
+  }
+  else switch ( frame.opcode )
+  {
+    case LINK_OP_PING:
+      reply_header(frame.opcode, frame.len);
+      frame_state = FRAME_COPY;
+      break;
+
+    case LINK_OP_EXCHANGE:
+      // The reply mirrors the request, so its length is known up front
+      reply_header(frame.opcode, frame.len);
+      frame_state = FRAME_RECORD;
+      break;
+
+    case LINK_OP_CONFIGURE:
+    case LINK_OP_SET_CLOCK:
+      if ( frame.len == (frame.opcode == LINK_OP_CONFIGURE ? LINK_PROTO_CONFIG_LEN : LINK_PROTO_CLOCK_LEN) )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_SCRIPT_LOAD:
+      if ( frame.len % LINK_PROTO_RULE_LEN == 0 && frame.len / LINK_PROTO_RULE_LEN <= LINK_SCRIPT_MAX_RULES )
+      {
+        link_script_clear(&script);
+        frame_state = FRAME_RULES;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_READY:
+    case LINK_OP_FORMAT:
+      if ( frame.len == (frame.opcode == LINK_OP_READY ? LINK_PROTO_READY_LEN : LINK_PROTO_FORMAT_LEN) )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_PORT_CONFIGURE:
+      if ( frame.len == LINK_PROTO_PORT_CONFIG_LEN )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_PORT_EXCHANGE:
+      // Only gets here without a port, or with one that does not exist or is off
+      reply_error(frame.len ? LINK_STATUS_BAD_PORT : LINK_STATUS_BAD_LENGTH);
+      frame_state = FRAME_SKIP;
+      break;
+
+    case LINK_OP_ADAPT:
+      if ( frame.len == LINK_PROTO_ADAPT_LEN )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_SCRIPT_RUN:
+      if ( frame.len == LINK_PROTO_RUN_LEN )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_BENCH:
+      if ( frame.len == LINK_PROTO_BENCH_LEN )
+      {
+        frame_state = FRAME_PAYLOAD;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    case LINK_OP_STATS:
+      if ( frame.len == 0 )
+      {
+        uint8_t payload[LINK_PROTO_STATS_LEN];
+        reply_header(frame.opcode, link_proto_put_stats(payload, &stats));
+        spsc_ring_push(&link_rx_ring, payload, sizeof(payload));
+        frame_state = FRAME_HEADER;
+      }
+      else
+      {
+        reply_error(LINK_STATUS_BAD_LENGTH);
+        frame_state = FRAME_SKIP;
+      }
+      break;
+
+    default:
+      reply_error(LINK_STATUS_BAD_OPCODE);
+      frame_state = FRAME_SKIP;
+      break;
+  }
+}
+
+static void frame_record(void)
+{
+  uint8_t header[LINK_PROTO_RECORD_LEN];
+
+  if ( frame_left < LINK_PROTO_RECORD_LEN )
+  {
+    // Trailing bytes too short to be a record, echo them to keep the
+    // reply the same length as the request
+    frame_state = frame_left ? FRAME_COPY : FRAME_HEADER;
+    return;
+  }
+
+  if ( spsc_ring_available(&link_tx_ring) < LINK_PROTO_RECORD_LEN ) return;
+  if ( spsc_ring_free(&link_rx_ring) < LINK_PROTO_RECORD_LEN ) return;
+
+  spsc_ring_pop(&link_tx_ring, header, sizeof(header));
+  link_proto_get_exchange_header(header, &record);
+  frame_left -= LINK_PROTO_RECORD_LEN;
+
+  // A record running past the end of the frame is cut short
+  if ( record.len > frame_left )
+  {
+    record.len = frame_left;
+    stats.errors++;
+  }
+  frame_left -= record.len;
+
+  link_proto_put_exchange(header, record.len, record.gap_us, NULL);
+  spsc_ring_push(&link_rx_ring, header, sizeof(header));
+  tx_done(sizeof(header));
+  frame_state = FRAME_EXCHANGE;
+}
+
+static void frame_payload(void)
+{
+  uint8_t payload[LINK_PROTO_BENCH_LEN]; // the largest of the fixed size payloads
+  link_run_t run;
+  link_adapt_config_t adapt_config;
+  uint8_t next_mode = LINK_MODE_FRAMED;
+
+  if ( spsc_ring_available(&link_tx_ring) < frame.len ) return;
+  if ( spsc_ring_free(&link_rx_ring) < LINK_PROTO_HEADER_LEN + frame.len ) return;
+
+  spsc_ring_pop(&link_tx_ring, payload, frame.len);
+
+  switch ( frame.opcode )
+  {
+    case LINK_OP_CONFIGURE:
+    {
+      link_config_t config;
+      bool ready;
+      if ( !link_proto_parse_config(payload, &config, &ready) )
+      {
+        reply_error(LINK_STATUS_BAD_MODE);
+        tx_done(frame.len);
+        frame_left = 0;
+        frame_state = FRAME_HEADER;
+        return;
+      }
+      configure_apply(config.bytes_per_transfer, config.us_between_transfer);
+      ready_apply(ready, true);
+      next_mode = config.mode;
+
+      // Reply with the settings actually in effect
+      config.bytes_per_transfer = bytes_per_transfer | (ready_enabled ? LINK_PROTO_READY_LINE : 0);
+      link_proto_put_config(payload, &config);
+      break;
+    }
+
+    case LINK_OP_SET_CLOCK:
+      link_proto_put_u32(payload, apply_clock(link_proto_get_u32(payload)));
+      break;
+
+    case LINK_OP_ADAPT:
+      link_proto_get_adapt(payload, &adapt_config);
+      if ( adapt_config.min_us > adapt_config.max_us ) adapt_config.max_us = adapt_config.min_us;
+      adapt_idle = adapt_config.idle;
+      adapt_min_us = adapt_config.min_us;
+      adapt_max_us = adapt_config.max_us;
+      adaptive = adapt_config.enable;
+      adapt_generation++;
+      link_proto_put_adapt(payload, &adapt_config);
+      break;
+
+    case LINK_OP_READY:
+      ready_apply(payload[0], payload[1]);
+      break;
+
+    case LINK_OP_FORMAT:
+      // Applied once raw or slave mode runs
+      format_set(payload[0], payload[1]);
+      payload[0] = format_bits;
+      payload[1] = format_lsb_first;
+      break;
+
+    case LINK_OP_PORT_CONFIGURE:
+    {
+      link_port_config_t config;
+      link_proto_get_port_config(payload, &config);
+      if ( !link_hub_configure(&config) )
+      {
+        reply_error(LINK_STATUS_BAD_PORT);
+        tx_done(frame.len);
+        frame_left = 0;
+        frame_state = FRAME_HEADER;
+        return;
+      }
+      link_proto_put_port_config(payload, &config);
+      break;
+    }
+
+    case LINK_OP_SCRIPT_RUN:
+      // Replied to by frame_script() once the script stops
+      link_proto_get_run(payload, &run);
+      script.state = run.state;
+      script_tx = run.first;
+      script_limit = run.limit;
+      script_result = (link_result_t) { 0 };
+      script_forwarded = 0;
+      script_running = true;
+      tx_done(frame.len);
+      frame_left = 0;
+      frame_state = FRAME_SCRIPT;
+      return;
+
+    case LINK_OP_BENCH:
+      // Replied to by frame_bench() once the last chunk is in
+      link_proto_get_bench(payload, &bench);
+      if ( bench.bytes_per_transfer > LINK_MAX_CHUNK ) bench.bytes_per_transfer = LINK_MAX_CHUNK;
+      if ( bench.bytes_per_transfer == 0 ) bench.bytes_per_transfer = 1;
+      bench_report = (link_report_t) { 0 };
+      bench_chunks = 0;
+      bench_late_us = 0;
+      bench_clkdiv = 0;
+      if ( bench.sck_hz )
+      {
+        bench_clkdiv = link_spi->pio->sm[link_spi->sm].clkdiv >> PIO_SM0_CLKDIV_FRAC_LSB;
+        apply_clock(bench.sck_hz);
+      }
+      bench_report.sck_hz = pio_spi_get_rate(link_spi);
+      pio_spi_set_loopback(link_spi, bench.flags & LINK_BENCH_LOOPBACK);
+      tx_done(frame.len);
+      frame_left = 0;
+      frame_state = FRAME_BENCH;
+      return;
+  }
+
+  reply_header(frame.opcode, frame.len);
+  spsc_ring_push(&link_rx_ring, payload, frame.len);
+  tx_done(frame.len);
+
+  // Anything after this frame is raw link data, slave responses or GBA
+  // packets
+  if ( next_mode != LINK_MODE_FRAMED )
+    link_mode = next_mode;
+
+  frame_left = 0;
+  frame_state = FRAME_HEADER;
+}
+
+// The reply is written by the hub as the port exchanges the data
+static void frame_port_data(void)
+{
+  uint8_t const *src;
+  uint32_t len = spsc_ring_peek(&link_tx_ring, &src);
+  if ( len > frame_left ) len = frame_left;
+
+  len = link_hub_submit(frame_port, src, len);
+  spsc_ring_consume(&link_tx_ring, len);
+  tx_done(len);
+  frame_left -= len;
+  if ( !frame_left )
+    frame_state = FRAME_HEADER;
+}
+
+static void frame_rules(void)
+{
+  uint8_t buf[LINK_PROTO_RULE_LEN];
+  link_rule_t rule;
+
+  if ( frame_left )
+  {
+    if ( spsc_ring_available(&link_tx_ring) < LINK_PROTO_RULE_LEN ) return;
+
+    spsc_ring_pop(&link_tx_ring, buf, sizeof(buf));
+    link_proto_get_rule(buf, &rule);
+    link_script_add(&script, &rule);
+    tx_done(sizeof(buf));
+    frame_left -= LINK_PROTO_RULE_LEN;
+    return;
+  }
+
+  // frame_dispatch() made sure there is room for this before the rules came in
+  reply_header(frame.opcode, 1);
+  spsc_ring_push(&link_rx_ring, &script.count, 1);
+  frame_state = FRAME_HEADER;
+}
+
+// One byte at a time: send it, look up what came back, pace the reply
+static void __time_critical_func(frame_script)(void)
+{
+  if ( on_wire )
+  {
+    if ( !pio_spi_dma_poll(link_spi) ) return;
+    on_wire = 0;
+    link_trace_bytes(time_us_32(), &script_tx, &script_rx, 1, LINK_TRACE_SCRIPT);
+    stats.bytes_exchanged++;
+    link_telemetry.link_tx_bytes++;
+    link_telemetry.link_rx_bytes++;
+    script_result.exchanged++;
+    script_result.last = script_rx;
+
+    link_rule_t const *rule = link_script_match(&script, script_rx);
+    if ( !rule )
+    {
+      script_result.reason = LINK_SCRIPT_NO_MATCH;
+      script_running = false;
+      return;
+    }
+
+    if ( rule->flags & LINK_SCRIPT_FORWARD )
+    {
+      if ( script_forwarded == LINK_SCRIPT_MAX_FORWARD )
+      {
+        script_result.reason = LINK_SCRIPT_FORWARD_FULL;
+        script_running = false;
+        return;
+      }
+      script_forward[script_forwarded++] = script_rx;
+    }
+
+    if ( rule->flags & LINK_SCRIPT_STOP )
+    {
+      script_result.reason = LINK_SCRIPT_DONE;
+      script_running = false;
+    }
+    else if ( script_limit && script_result.exchanged == script_limit )
+    {
+      script_result.reason = LINK_SCRIPT_LIMIT;
+      script_running = false;
+    }
+
+    script_tx = rule->reply;
+    link_pacer_done(&pacer, time_us_64(), rule->wait_us);
+    return;
+  }
+
+  if ( script_running )
+  {
+    if ( !link_pacer_due(&pacer, time_us_64()) ) return;
+
+    on_wire = 1;
+    pio_spi_dma_start(link_spi, &script_tx, &script_rx, 1);
+    return;
+  }
+
+  uint8_t payload[LINK_PROTO_RESULT_LEN];
+  if ( spsc_ring_free(&link_rx_ring) < LINK_PROTO_HEADER_LEN + LINK_PROTO_RESULT_LEN + script_forwarded ) return;
+
+  reply_header(frame.opcode, link_proto_put_result(payload, &script_result) + script_forwarded);
+  spsc_ring_push(&link_rx_ring, payload, sizeof(payload));
+  spsc_ring_push(&link_rx_ring, script_forward, script_forwarded);
+  frame_state = FRAME_HEADER;
+}
+
+// Put the link back the way BENCH found it
+static void bench_restore(void)
+{
+  pio_spi_set_loopback(link_spi, false);
+  if ( bench_clkdiv )
+    pio_spi_set_clkdiv(link_spi, bench_clkdiv / 256.0f);
+  bench_clkdiv = 0;
+}
+
+// Raw mode style chunks of a counting pattern, each one timed against the
+// time its bits need
+static void __time_critical_func(frame_bench)(void)
+{
+  if ( on_wire )
+  {
+    if ( !pio_spi_dma_poll(link_spi) ) return;
+    bench_end_us = time_us_64();
+
+    uint64_t cycles = (bench_end_us - bench_chunk_us) * bench_report.sck_hz * PIO_SPI_CYCLES_PER_BIT / 1000000;
+    uint64_t needed = (uint64_t) on_wire * 8 * PIO_SPI_CYCLES_PER_BIT;
+    if ( cycles > needed ) bench_report.stall_cycles += cycles - needed;
+
+    for ( uint32_t i = 0; i < on_wire; i++ )
+      bench_report.mismatches += bench_rx[i] != bench_tx[i];
+    bench_report.exchanged += on_wire;
+    stats.bytes_exchanged += on_wire;
+    link_telemetry.link_tx_bytes += on_wire;
+    link_telemetry.link_rx_bytes += on_wire;
+    on_wire = 0;
+
+    link_pacer_done(&pacer, bench_end_us, bench.us_between_transfer);
+    return;
+  }
+
+  if ( bench_report.exchanged < bench.count )
+  {
+    uint64_t now = time_us_64();
+    if ( !link_pacer_due(&pacer, now) ) return;
+
+    if ( bench_chunks++ )
+    {
+      uint64_t late = now - pacer.release_us;
+      bench_late_us += late;
+      if ( late > bench_report.pacing_max_us ) bench_report.pacing_max_us = late;
+    }
+    else
+    {
+      bench_start_us = now;
+    }
+
+    uint32_t len = bench.count - bench_report.exchanged;
+    if ( len > bench.bytes_per_transfer ) len = bench.bytes_per_transfer;
+    for ( uint32_t i = 0; i < len; i++ )
+      bench_tx[i] = bench_report.exchanged + i;
+
+    on_wire = len;
+    bench_chunk_us = time_us_64();
+    pio_spi_dma_start(link_spi, bench_tx, bench_rx, len);
+    return;
+  }
+
+  uint8_t payload[LINK_PROTO_REPORT_LEN];
+  if ( spsc_ring_free(&link_rx_ring) < LINK_PROTO_HEADER_LEN + LINK_PROTO_REPORT_LEN ) return;
+
+  bench_restore();
+  if ( bench_chunks )
+  {
+    bench_report.elapsed_us = bench_end_us - bench_start_us;
+    if ( bench_report.elapsed_us )
+      bench_report.bytes_per_s = (uint64_t) bench_report.exchanged * 1000000 / bench_report.elapsed_us;
+  }
+  if ( bench_chunks > 1 )
+    bench_report.pacing_mean_us = bench_late_us / (bench_chunks - 1);
+
+  reply_header(frame.opcode, link_proto_put_report(payload, &bench_report));
+  spsc_ring_push(&link_rx_ring, payload, sizeof(payload));
+  frame_state = FRAME_HEADER;
+}
+
+static void __time_critical_func(framed_task)(void)
+{
+  switch ( frame_state )
+  {
+    case FRAME_HEADER:
+      frame_begin();
+      break;
+
+    case FRAME_DISPATCH:
+      frame_dispatch();
+      break;
+
+    case FRAME_RECORD:
+      frame_record();
+      break;
+
+    case FRAME_EXCHANGE:
+      if ( !burst_active() )
+      {
+        if ( !link_pacer_due(&pacer, time_us_64()) ) return;
+        burst_begin(record.len, record.gap_us);
+      }
+      if ( burst_step() )
+        frame_state = FRAME_RECORD;
+      break;
+
+    case FRAME_PAYLOAD:
+      frame_payload();
+      break;
+
+    case FRAME_RULES:
+      frame_rules();
+      break;
+
+    case FRAME_SCRIPT:
+      frame_script();
+      break;
+
+    case FRAME_BENCH:
+      frame_bench();
+      break;
+
+    case FRAME_PORT:
+      frame_port_data();
+      break;
+
+    case FRAME_COPY:
+      if ( frame_drain(true) )
+        frame_state = FRAME_HEADER;
+      break;
+
+    case FRAME_SKIP:
+      if ( frame_drain(false) )
+        frame_state = FRAME_HEADER;
+      break;
+  }
+}
+
+// Anything new for core 0 moves one of these, none of them ever goes back
+static uint32_t core0_progress(void)
+{
+  return atomic_load_explicit(&link_rx_ring.tail, memory_order_relaxed) +
+         atomic_load_explicit(&link_tx_ring.head, memory_order_relaxed) +
+         atomic_load_explicit(&link_trace_ring.tail, memory_order_relaxed) + bytes_done;
+}
+
+static void link_engine_core1_entry(void)
+{
+  link_mode_t active_mode = LINK_MODE_RAW;
+  uint32_t progress = 0;
+
+  // Lets core 0 write flash, see link_store.h
+  multicore_lockout_victim_init();
+  link_pacer_init(&pacer);
+
+  while (1)
+  {
+    // Wake core 0 once per pass that has something for it
+    uint32_t now_progress = core0_progress();
+    if ( now_progress != progress )
+    {
+      progress = now_progress;
+      link_event_post(LINK_EVENT_LINK, time_us_32());
+      __sev();
+    }
+
+    // Sleep through USB suspend once the link is quiet, core 0 wakes us
+    if ( suspended && !burst_active() )
+    {
+      __wfe();
+      continue;
+    }
+
+    if ( !burst_active() )
+      requests_take();
+
+    // The master SM is stopped in slave and printer mode, keep the request
+    // until it runs, or until a benchmark has put its own rate back
+    if ( clock_pending && !burst_active() && active_mode != LINK_MODE_SLAVE &&
+         active_mode != LINK_MODE_PRINTER && frame_state != FRAME_BENCH )
+    {
+      clock_pending = false;
+      apply_clock(clock_request_hz);
+    }
+
+    // Switch modes between bursts only, and start framing from scratch
+    if ( link_mode != active_mode && !burst_active() )
+    {
+      if ( active_mode == LINK_MODE_SLAVE )
+        slave_leave();
+      else if ( active_mode == LINK_MODE_GBA )
+        pio_gba_stop(link_gba);
+      else if ( active_mode == LINK_MODE_PRINTER )
+        printer_leave();
+      else if ( active_mode == LINK_MODE_FRAMED )
+      {
+        link_hub_drop();
+        if ( frame_state == FRAME_BENCH ) bench_restore();
+      }
+
+      active_mode = link_mode;
+      frame_state = FRAME_HEADER;
+      frame_left = 0;
+      format_apply(active_mode);
+
+      if ( active_mode == LINK_MODE_SLAVE )
+        slave_enter();
+      else if ( active_mode == LINK_MODE_GBA )
+        pio_gba_start(link_gba);
+      else if ( active_mode == LINK_MODE_PRINTER )
+        printer_enter();
+    }
+
+    // A new frame format for the mode in use, the slave starts over with it
+    if ( !format_applied(active_mode) && !burst_active() )
+    {
+      if ( active_mode == LINK_MODE_SLAVE ) slave_leave();
+      format_apply(active_mode);
+      if ( active_mode == LINK_MODE_SLAVE ) slave_enter();
+    }
+
+    switch ( active_mode )
+    {
+      case LINK_MODE_FRAMED:
+        framed_task();
+        break;
+
+      case LINK_MODE_SLAVE:
+        slave_task();
+        break;
+
+      case LINK_MODE_GBA:
+        gba_task();
+        break;
+
+      case LINK_MODE_PRINTER:
+        printer_task();
+        break;
+
+      default:
+        raw_task();
+        break;
+    }
+
+    // Hub ports keep exchanging in every mode, their replies only go out
+    // in framed mode
+    link_hub_task(&link_rx_ring, active_mode == LINK_MODE_FRAMED);
+  }
+}
+
+void link_engine_start(pio_spi_inst_t *spi, pio_spi_inst_t *slave, pio_gba_inst_t *gba)
+{
+  link_spi = spi;
+  link_slave = slave;
+  link_gba = gba;
+  spsc_ring_init(&link_tx_ring, tx_ring_buf, sizeof(tx_ring_buf));
+  spsc_ring_init(&link_rx_ring, rx_ring_buf, sizeof(rx_ring_buf));
+  link_trace_init();
+
+  multicore_launch_core1(link_engine_core1_entry);
+}
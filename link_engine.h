@@ -0,0 +1,132 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Game Boy link engine, runs on core 1.
+ *
+ * Core 0 runs the USB stack and pushes the bytes received from the host
+ * into link_tx_ring. Core 1 takes them out in chunks, exchanges them with
+ * the Game Boy over PIO SPI, paces the chunks, and pushes the bytes it got
+ * back into link_rx_ring for core 0 to send to the host. Neither core ever
+ * waits on the other. In framed mode (see link_proto.h) core 1 also parses
+ * the frames and writes the replies, so they stay in order with the link
+ * data without core 0 having to look at it.
+ *
+ * In slave mode the Game Boy drives the clock instead. A second SM follows
+ * it on the same pins, link_tx_ring holds the response bytes, queued ahead
+ * of the clock, and everything clocked in is captured by DMA into a ring
+ * of its own and streamed to link_rx_ring as it arrives.
+ *
+ * In GBA mode a third SM, on the other PIO, takes the pins over and runs
+ * GBA multiplayer transfers as the parent. DMA feeds it the parent's data
+ * and collects every slot, a chunk of packets at a time.
+ *
+ * Printer mode reuses the slave SM and capture, but answers the Game Boy
+ * from core 1 through link_printer.h and streams the image bands to the
+ * host as frames.
+ *
+ * The hub ports (see link_hub.h) run alongside whichever mode the main
+ * link is in.
+ *
+ * Core 1 posts LINK_EVENT_LINK (see link_event.h) whenever it has moved
+ * something core 0 waits on, so core 0 can sleep in between.
+ */
+
+#ifndef LINK_ENGINE_H_
+#define LINK_ENGINE_H_
+
+#include "pio/pio_spi.h"
+#include "pio/pio_gba.h"
+#include "spsc_ring.h"
+#include "link_proto.h"
+
+#define NUM_DEFAULT_BYTES_PER_TRANSFER 1
+#define US_DEFAULT_PER_TRANSFER 1000
+
+#define LINK_MAX_CHUNK 0x40
+
+// SM clock divider the link starts out with
+#define LINK_DEFAULT_CLKDIV (4058.838/128)
+
+// Must be a power of two
+#define LINK_RING_SIZE 1024
+
+// Slave mode capture buffer, 1 << LINK_CAPTURE_BITS bytes
+#define LINK_CAPTURE_BITS 12
+
+// Sent in slave mode when no response byte is queued, the line idles high
+#define LINK_SLAVE_IDLE 0xFF
+
+// GBA multiplayer bit rate, and how long an empty slot is waited for
+#define LINK_GBA_BAUD 115200
+#define LINK_GBA_TIMEOUT_BITS 32
+
+// Host bytes in and out per GBA transfer
+#define LINK_GBA_SEND_LEN 2
+#define LINK_GBA_REPLY_LEN (2 * PIO_GBA_SLOTS)
+
+extern spsc_ring_t link_tx_ring; // USB -> link, core 0 produces
+extern spsc_ring_t link_rx_ring; // link -> USB, core 0 consumes
+
+// Set up the rings and launch the engine on core 1. All SMs and their DMA
+// channels must already be initialised, with the slave and GBA SMs left
+// disabled.
+void link_engine_start(pio_spi_inst_t *spi, pio_spi_inst_t *slave, pio_gba_inst_t *gba);
+
+// The settings calls below post a request that core 1 applies between
+// bursts, in the order they were made; core 1 alone writes the settings
+// it runs with. Each returns false, changing nothing, if too many requests
+// are already waiting.
+
+// Takes effect from the next chunk. A gap of LINK_PROTO_ADAPTIVE_GAP turns
+// on adaptive pacing, any other value turns it off.
+bool link_engine_configure(uint8_t bytes_per_transfer, uint32_t us_between_transfer);
+
+// Hardware flow control. The peer signals that it can take the next chunk
+// with an edge on the ready line, towards active_high. With it on, a chunk
+// goes out as soon as the edge since the last chunk has been seen; the
+// configured gap only caps the wait, for peers that miss an edge. Raw mode
+// only, takes effect from the next chunk.
+void link_engine_set_ready_pin(uint pin);
+bool link_engine_set_ready(bool enable, bool active_high);
+
+// Change the SCK rate, 0 for LINK_DEFAULT_CLKDIV. Applied by core 1
+// between bursts; in framed mode use LINK_OP_SET_CLOCK instead, which
+// also reports the rate achieved.
+bool link_engine_set_clock(uint32_t sck_hz);
+
+// Frame format of raw and slave mode: 1 to 32 bits (0 for 8), MSB- or
+// LSB-first, see LINK_OP_FORMAT. Frames wider than a byte take 2 or 4
+// bytes of the rings each, little endian, and raw chunks are cut to whole
+// frames. Takes effect between bursts; slave mode restarts its capture.
+bool link_engine_set_format(uint8_t n_bits, bool lsb_first);
+
+// Raw mode streams link_tx_ring to the Game Boy in chunks; framed mode
+// parses it as link_proto frames; slave mode answers the Game Boy's clock
+// with it; GBA mode sends it as the multiplayer parent's data. The switch
+// happens between bursts, responses still queued when slave mode is left
+// are dropped.
+bool link_engine_set_mode(link_mode_t mode);
+
+// The settings core 1 runs with, which framed mode may also change, or
+// the last ones asked for while that request is still waiting
+link_mode_t link_engine_mode(void);
+uint8_t link_engine_bytes_per_transfer(void);
+uint32_t link_engine_us_between_transfer(void);
+bool link_engine_ready(void);
+
+// While suspended core 1 finishes the burst on the wire, if any, and then
+// sleeps in WFE instead of polling
+void link_engine_set_suspended(bool suspend);
+
+// Queue bytes for the Game Boy, returns the number accepted
+uint32_t link_engine_submit(uint8_t const *src, uint32_t len);
+
+// Zero-copy variant: write straight into link_tx_ring storage from
+// spsc_ring_reserve(), then queue len bytes of it
+void link_engine_commit(uint32_t len);
+
+// True once every submitted byte has been exchanged and its reply is in
+// link_rx_ring
+bool link_engine_idle(void);
+
+#endif /* LINK_ENGINE_H_ */
@@ -0,0 +1,54 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "link_event.h"
+
+link_event_t link_events[LINK_EVENT_COUNT];
+
+void link_event_post(link_event_id_t id, uint32_t now_us)
+{
+  link_event_t *event = &link_events[id];
+  uint32_t posted = atomic_load_explicit(&event->posted, memory_order_relaxed);
+
+  // Only the first post the loop has not seen yet starts the clock. A take
+  // racing with this can leave it a little early, never late.
+  if ( posted == atomic_load_explicit(&event->taken, memory_order_relaxed) )
+    atomic_store_explicit(&event->first_us, now_us, memory_order_relaxed);
+  atomic_store_explicit(&event->posted, posted + 1, memory_order_release);
+}
+
+bool link_event_pending(void)
+{
+  for ( uint32_t i = 0; i < LINK_EVENT_COUNT; i++ )
+  {
+    link_event_t *event = &link_events[i];
+    if ( atomic_load_explicit(&event->posted, memory_order_relaxed) !=
+         atomic_load_explicit(&event->taken, memory_order_relaxed) )
+      return true;
+  }
+  return false;
+}
+
+uint32_t link_event_take(uint32_t now_us, uint32_t *latency_us)
+{
+  uint32_t events = 0;
+  uint32_t oldest = 0;
+
+  for ( uint32_t i = 0; i < LINK_EVENT_COUNT; i++ )
+  {
+    link_event_t *event = &link_events[i];
+    uint32_t posted = atomic_load_explicit(&event->posted, memory_order_acquire);
+    if ( posted == atomic_load_explicit(&event->taken, memory_order_relaxed) ) continue;
+
+    // Posted after now_us was read counts as no wait at all
+    int32_t waited = now_us - atomic_load_explicit(&event->first_us, memory_order_relaxed);
+    if ( waited > (int32_t) oldest ) oldest = waited;
+
+    atomic_store_explicit(&event->taken, posted, memory_order_relaxed);
+    events |= 1u << i;
+  }
+
+  *latency_us = oldest;
+  return events;
+}
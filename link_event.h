@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Wake-up events for core 0's main loop.
+ *
+ * The main loop sleeps in WFE until something has work for it. Interrupt
+ * handlers and core 1 post an event and then SEV, the loop takes every
+ * event posted since it last looked and runs its tasks once. An event
+ * posted again before the loop gets to it is handled once, like a pending
+ * interrupt.
+ *
+ * Every event has a single poster, so posting is a couple of stores with
+ * no lock, and the loop is the single taker. The first post of an event
+ * starts its clock, and taking it reports how long it waited, the time
+ * from the interrupt to the handler.
+ *
+ * No SDK dependencies. The caller passes the time and does the sleeping,
+ * so tools/eventsim.c can drive it on the host.
+ */
+
+#ifndef LINK_EVENT_H_
+#define LINK_EVENT_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  LINK_EVENT_USB = 0, // USB interrupt queued work for tud_task()
+  LINK_EVENT_LINK,    // core 1 moved a ring or finished host bytes
+  LINK_EVENT_COUNT
+} link_event_id_t;
+
+typedef struct
+{
+  _Atomic uint32_t posted;   // poster only
+  _Atomic uint32_t first_us; // poster only, first post since the last take
+  _Atomic uint32_t taken;    // taker only
+} link_event_t;
+
+extern link_event_t link_events[LINK_EVENT_COUNT];
+
+void link_event_post(link_event_id_t id, uint32_t now_us);
+
+bool link_event_pending(void);
+
+// Takes every posted event, returns them as a mask of 1 << link_event_id_t.
+// *latency_us is how long the oldest of them waited.
+uint32_t link_event_take(uint32_t now_us, uint32_t *latency_us);
+
+#endif /* LINK_EVENT_H_ */
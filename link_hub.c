@@ -0,0 +1,267 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "link_hub.h"
+#include "link_engine.h"
+#include "link_pacer.h"
+#include "link_telemetry.h"
+
+typedef struct
+{
+  pio_spi_inst_t spi;
+  spsc_ring_t tx; // data from PORT_EXCHANGE frames
+  spsc_ring_t rx; // what came back, until it goes out in a reply
+  uint8_t tx_buf[LINK_HUB_RING_SIZE];
+  uint8_t rx_buf[LINK_HUB_RING_SIZE];
+
+  link_pacer_t pacer;
+  uint8_t bytes_per_transfer;
+  uint32_t us_between_transfer;
+
+  uint32_t burst_left; // bytes of the current chunk not started yet
+  uint32_t on_wire;    // bytes the DMA is exchanging right now
+  uint32_t discard;    // bytes coming back for dropped replies
+
+  uint pin;            // SCK, SIN is pin + 1 and SOUT pin + 2
+  bool enabled;        // the SM runs and drives the pins
+  bool dma_claimed;
+} link_port_t;
+
+typedef struct
+{
+  uint8_t port;
+  uint8_t seq;
+  uint16_t len;
+} link_hub_reply_t;
+
+static link_port_t ports[LINK_HUB_PORTS];
+static uint hub_prog_offs;
+
+// Ring of owed replies, oldest at reply_head
+static link_hub_reply_t replies[LINK_HUB_PENDING];
+static uint32_t reply_head = 0;
+static uint32_t reply_count = 0;
+static bool reply_open = false; // the oldest one's header is out
+static uint32_t reply_left;     // and this many of its data bytes are not
+
+void link_hub_init(PIO pio, uint first_sm, uint prog_offs)
+{
+  hub_prog_offs = prog_offs;
+
+  for ( uint i = 0; i < LINK_HUB_PORTS; i++ )
+  {
+    link_port_t *port = &ports[i];
+
+    port->spi.pio = pio;
+    port->spi.sm = first_sm + i;
+    port->pin = LINK_HUB_PIN_BASE + 3 * i;
+
+    spsc_ring_init(&port->tx, port->tx_buf, sizeof(port->tx_buf));
+    spsc_ring_init(&port->rx, port->rx_buf, sizeof(port->rx_buf));
+    link_pacer_init(&port->pacer);
+    port->bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+    port->us_between_transfer = US_DEFAULT_PER_TRANSFER;
+  }
+}
+
+static void port_claim(link_port_t *port)
+{
+  uint pin = port->pin;
+  pio_spi_init(port->spi.pio, port->spi.sm, hub_prog_offs, 8, LINK_DEFAULT_CLKDIV, 1, 1, pin, pin + 2, pin + 1);
+  if ( !port->dma_claimed ) pio_spi_dma_init(&port->spi);
+  port->dma_claimed = true;
+  link_pacer_init(&port->pacer);
+  port->enabled = true;
+}
+
+// Stop the SM mid-chunk if need be and leave the pins as they were at boot
+static void port_release(link_port_t *port)
+{
+  uint pin = port->pin;
+  pio_sm_set_enabled(port->spi.pio, port->spi.sm, false);
+  dma_channel_abort(port->spi.dma_tx);
+  dma_channel_abort(port->spi.dma_rx);
+
+  gpio_set_outover(pin, GPIO_OVERRIDE_NORMAL);
+  hw_clear_bits(&port->spi.pio->input_sync_bypass, 1u << (pin + 1));
+  for ( uint i = 0; i < 3; i++ )
+    gpio_init(pin + i);
+
+  spsc_ring_consume(&port->tx, spsc_ring_available(&port->tx));
+  spsc_ring_consume(&port->rx, spsc_ring_available(&port->rx));
+  port->burst_left = 0;
+  port->on_wire = 0;
+  port->discard = 0;
+  port->enabled = false;
+}
+
+bool link_hub_configure(link_port_config_t *config)
+{
+  if ( config->port >= LINK_HUB_PORTS ) return false;
+
+  if ( config->bytes_per_transfer > LINK_MAX_CHUNK ) config->bytes_per_transfer = LINK_MAX_CHUNK;
+
+  link_port_t *port = &ports[config->port];
+  if ( config->bytes_per_transfer == 0 )
+  {
+    if ( port->enabled ) port_release(port);
+    return true;
+  }
+
+  if ( !port->enabled ) port_claim(port);
+  port->bytes_per_transfer = config->bytes_per_transfer;
+  port->us_between_transfer = config->us_between_transfer;
+  return true;
+}
+
+bool link_hub_enabled(uint8_t port)
+{
+  return port < LINK_HUB_PORTS && ports[port].enabled;
+}
+
+bool link_hub_expect(uint8_t port, uint8_t seq, uint16_t len)
+{
+  if ( reply_count == LINK_HUB_PENDING ) return false;
+
+  replies[(reply_head + reply_count) % LINK_HUB_PENDING] = (link_hub_reply_t) { port, seq, len };
+  reply_count++;
+  return true;
+}
+
+uint32_t link_hub_submit(uint8_t port, uint8_t const *src, uint32_t len)
+{
+  return spsc_ring_push(&ports[port].tx, src, len);
+}
+
+uint32_t link_hub_pending(void)
+{
+  return reply_count;
+}
+
+void link_hub_drop(void)
+{
+  // Everything queued on a port, sent or not, belongs to a reply
+  for ( uint i = 0; i < LINK_HUB_PORTS; i++ )
+  {
+    link_port_t *port = &ports[i];
+    port->discard = spsc_ring_available(&port->tx) + port->on_wire + spsc_ring_available(&port->rx);
+  }
+
+  reply_count = 0;
+  reply_open = false;
+}
+
+// Same chunking as raw mode: a chunk that wraps around the end of either
+// ring goes out as two back to back segments, the gap follows the chunk
+static void __time_critical_func(port_step)(link_port_t *port)
+{
+  if ( port->on_wire )
+  {
+    if ( !pio_spi_dma_poll(&port->spi) ) return;
+
+    spsc_ring_consume(&port->tx, port->on_wire);
+    spsc_ring_commit(&port->rx, port->on_wire);
+    link_telemetry.link_tx_bytes += port->on_wire;
+    link_telemetry.link_rx_bytes += port->on_wire;
+    port->on_wire = 0;
+
+    if ( !port->burst_left )
+    {
+      link_pacer_done(&port->pacer, time_us_64(), port->us_between_transfer);
+      return;
+    }
+  }
+  else if ( !port->burst_left )
+  {
+    if ( !link_pacer_due(&port->pacer, time_us_64()) ) return;
+
+    uint32_t len = spsc_ring_available(&port->tx);
+    if ( len > port->bytes_per_transfer ) len = port->bytes_per_transfer;
+    port->burst_left = len;
+  }
+
+  uint8_t const *src;
+  uint8_t *dst;
+  uint32_t len = spsc_ring_peek(&port->tx, &src);
+  uint32_t space = spsc_ring_reserve(&port->rx, &dst);
+  if ( len > space ) len = space;
+  if ( len > port->burst_left ) len = port->burst_left;
+  if ( !len ) return; // wait for data, or for the reply to make room
+
+  port->burst_left -= len;
+  port->on_wire = len;
+  pio_spi_dma_start(&port->spi, src, dst, len);
+}
+
+static void port_discard(link_port_t *port)
+{
+  uint32_t len = spsc_ring_available(&port->rx);
+  if ( len > port->discard ) len = port->discard;
+  spsc_ring_consume(&port->rx, len);
+  port->discard -= len;
+}
+
+// Stream the oldest reply: header first, then its data as it comes back
+static void hub_reply(spsc_ring_t *out)
+{
+  if ( !reply_count ) return;
+
+  link_hub_reply_t const *reply = &replies[reply_head];
+  link_port_t *port = &ports[reply->port];
+
+  // Bytes for dropped replies come first
+  if ( port->discard ) return;
+
+  if ( !reply_open )
+  {
+    uint8_t header[LINK_PROTO_HEADER_LEN + 1];
+    if ( spsc_ring_free(out) < sizeof(header) ) return;
+
+    link_proto_put_header(header, LINK_OP_PORT_EXCHANGE | LINK_OP_REPLY, reply->seq, reply->len + 1);
+    header[LINK_PROTO_HEADER_LEN] = reply->port;
+    spsc_ring_push(out, header, sizeof(header));
+    reply_open = true;
+    reply_left = reply->len;
+  }
+
+  // Twice, for data that wraps around the end of the port's ring
+  for ( int pass = 0; pass < 2 && reply_left; pass++ )
+  {
+    uint8_t const *src;
+    uint8_t *dst;
+    uint32_t len = spsc_ring_peek(&port->rx, &src);
+    uint32_t space = spsc_ring_reserve(out, &dst);
+    if ( len > space ) len = space;
+    if ( len > reply_left ) len = reply_left;
+    if ( !len ) break;
+
+    memcpy(dst, src, len);
+    spsc_ring_commit(out, len);
+    spsc_ring_consume(&port->rx, len);
+    reply_left -= len;
+  }
+
+  if ( !reply_left )
+  {
+    reply_open = false;
+    reply_head = (reply_head + 1) % LINK_HUB_PENDING;
+    reply_count--;
+  }
+}
+
+void __time_critical_func(link_hub_task)(spsc_ring_t *out, bool reply)
+{
+  for ( uint i = 0; i < LINK_HUB_PORTS; i++ )
+  {
+    if ( !ports[i].enabled ) continue;
+    if ( ports[i].discard ) port_discard(&ports[i]);
+    port_step(&ports[i]);
+  }
+
+  if ( reply ) hub_reply(out);
+}
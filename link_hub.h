@@ -0,0 +1,74 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Link hub: extra link cables on spare PIO state machines.
+ *
+ * Each hub port is a spi_cpha1 master of its own, with its own DMA
+ * channels, pacing and pair of rings, and runs raw-mode style chunked
+ * exchanges independently of the main link and of the other ports. The
+ * host reaches the ports through the PORT_EXCHANGE and PORT_CONFIGURE
+ * frames (see link_proto.h).
+ *
+ * A port only drives its pins while it is on. Everything here runs on
+ * core 1, except link_hub_init(). Ports are
+ * serviced round robin, one step each per call to link_hub_task(): a port
+ * whose DMA is busy or whose gap has not run out costs a couple of loads,
+ * so the ports' transfers overlap and throughput grows with their number.
+ *
+ * Port replies go out strictly in request order. The hub keeps a queue of
+ * the replies it owes and streams the oldest one into the output ring as
+ * its port's bytes come in, while later ports keep exchanging into their
+ * own rings.
+ */
+
+#ifndef LINK_HUB_H_
+#define LINK_HUB_H_
+
+#include "pio/pio_spi.h"
+#include "spsc_ring.h"
+#include "link_proto.h"
+
+#define LINK_HUB_PORTS 2
+
+// Port n uses SCK, SIN and SOUT on LINK_HUB_PIN_BASE + 3n and up, in that
+// order, like the main link's pins
+#define LINK_HUB_PIN_BASE 8
+
+// Per port and direction, must be a power of two
+#define LINK_HUB_RING_SIZE 256
+
+// PORT_EXCHANGE frames whose replies can be outstanding at once
+#define LINK_HUB_PENDING 16
+
+// Core 0, before the engine starts: the ports are to use the SMs from
+// first_sm on, running the spi_cpha1 program already loaded at prog_offs.
+// Every port starts out off, without touching its pins.
+void link_hub_init(PIO pio, uint first_sm, uint prog_offs);
+
+// Takes effect from the next chunk, and turns the port on, claiming its
+// pins. A chunk size of 0 turns it off instead, releasing them as inputs
+// and dropping whatever it still holds. Returns false for a port that does
+// not exist, otherwise config is updated to the settings in effect.
+bool link_hub_configure(link_port_config_t *config);
+
+// Whether PORT_EXCHANGE data can go to port
+bool link_hub_enabled(uint8_t port);
+
+// Queue a reply to a PORT_EXCHANGE frame of len data bytes, returns false
+// if the queue is full. Its data must then be passed to link_hub_submit().
+bool link_hub_expect(uint8_t port, uint8_t seq, uint16_t len);
+
+uint32_t link_hub_submit(uint8_t port, uint8_t const *src, uint32_t len);
+
+// Replies not fully written out yet
+uint32_t link_hub_pending(void);
+
+// Drop every outstanding reply; the bytes still coming back for them are
+// thrown away as they arrive
+void link_hub_drop(void);
+
+// Run every port one step, and write what is ready of the replies to out
+// if reply is set
+void link_hub_task(spsc_ring_t *out, bool reply);
+
+#endif /* LINK_HUB_H_ */
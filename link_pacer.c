@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "link_pacer.h"
+
+void link_pacer_init(link_pacer_t *pacer)
+{
+  pacer->release_us = 0;
+}
+
+void link_pacer_done(link_pacer_t *pacer, uint64_t now_us, uint32_t gap_us)
+{
+  pacer->release_us = now_us + gap_us;
+}
+
+static uint32_t clamp(uint32_t v, uint32_t lo, uint32_t hi)
+{
+  if ( v < lo ) return lo;
+  if ( v > hi ) return hi;
+  return v;
+}
+
+void link_adapt_init(link_adapt_t *adapt, uint32_t min_us, uint32_t max_us, uint32_t start_us)
+{
+  if ( max_us < min_us ) max_us = min_us;
+
+  adapt->min_us = min_us;
+  adapt->max_us = max_us;
+  adapt->floor_us = min_us;
+  adapt->gap_us = clamp(start_us, min_us, max_us);
+  adapt->clean = 0;
+}
+
+uint32_t link_adapt_update(link_adapt_t *adapt, bool ok)
+{
+  uint32_t gap = adapt->gap_us;
+
+  if ( !ok )
+  {
+    adapt->floor_us = clamp(gap + gap / 8 + 1, adapt->min_us, adapt->max_us);
+    adapt->gap_us = clamp(gap * 2 + 1, adapt->min_us, adapt->max_us);
+    adapt->clean = 0;
+    return adapt->gap_us;
+  }
+
+  adapt->clean++;
+
+  if ( adapt->clean % LINK_ADAPT_STEP == 0 )
+  {
+    gap -= gap >= 8 ? gap / 8 : (gap ? 1 : 0);
+    adapt->gap_us = clamp(gap, adapt->floor_us, adapt->max_us);
+  }
+
+  if ( adapt->clean == LINK_ADAPT_FORGET )
+  {
+    adapt->floor_us = clamp(adapt->floor_us - adapt->floor_us / 8, adapt->min_us, adapt->max_us);
+    adapt->clean = 0;
+  }
+
+  return adapt->gap_us;
+}
@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Inter-chunk pacing for the link cable.
+ *
+ * Data from the host is exchanged in chunks of num_bytes_per_transfer
+ * bytes, and the Game Boy needs us_between_transfer microseconds between
+ * two chunks to process them. Instead of busy waiting, the link engine asks
+ * the pacer whether the next chunk is due and does other work until it is.
+ *
+ * Adaptive pacing finds the gap by itself instead. After every chunk the
+ * engine reports whether the Game Boy answered it: a chunk that came back
+ * as nothing but the peer's not-ready byte (0xFF on an idle line) means it
+ * went out too early. Each failure doubles the gap and raises a floor to
+ * just above the gap that failed; every run of clean chunks shortens the
+ * gap by an eighth, down to the floor. The floor itself decays slowly, so
+ * a peer that gets faster later in a session is probed again.
+ *
+ * This file has no SDK dependencies; the caller supplies the clock.
+ */
+
+#ifndef LINK_PACER_H_
+#define LINK_PACER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  uint64_t release_us; // the next chunk may not go out before this
+} link_pacer_t;
+
+void link_pacer_init(link_pacer_t *pacer);
+
+// The last chunk finished at now_us, hold the next one back for gap_us
+void link_pacer_done(link_pacer_t *pacer, uint64_t now_us, uint32_t gap_us);
+
+static inline bool link_pacer_due(link_pacer_t const *pacer, uint64_t now_us)
+{
+  return now_us >= pacer->release_us;
+}
+
+#define LINK_ADAPT_MIN_US 10
+#define LINK_ADAPT_MAX_US 100000
+#define LINK_ADAPT_STEP   8   // clean chunks between two shorter gaps
+#define LINK_ADAPT_FORGET 256 // clean chunks before the floor is lowered
+
+typedef struct
+{
+  uint32_t gap_us;   // gap in use
+  uint32_t floor_us; // just above the last gap that failed
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t clean;    // clean chunks since the last failure or floor change
+} link_adapt_t;
+
+void link_adapt_init(link_adapt_t *adapt, uint32_t min_us, uint32_t max_us, uint32_t start_us);
+
+// Report whether the last chunk was answered, returns the gap to use next
+uint32_t link_adapt_update(link_adapt_t *adapt, bool ok);
+
+#endif /* LINK_PACER_H_ */
@@ -0,0 +1,188 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "link_printer.h"
+
+void link_printer_init(link_printer_t *printer)
+{
+  memset(printer, 0, sizeof(*printer));
+  printer->pos = -1;
+}
+
+static void band_put(link_printer_t *printer, uint8_t b)
+{
+  if ( printer->band_len < LINK_PRINTER_BAND_LEN )
+    printer->band[printer->band_len++] = b;
+  else
+    printer->overflow = true;
+}
+
+// RLE: a control byte with bit 7 set repeats the next byte (c & 0x7F) + 2
+// times, one without it is followed by c + 1 literal bytes
+static void band_data(link_printer_t *printer, uint8_t b)
+{
+  if ( !printer->compression )
+  {
+    band_put(printer, b);
+  }
+  else if ( printer->run_byte )
+  {
+    while ( printer->run_left )
+    {
+      band_put(printer, b);
+      printer->run_left--;
+    }
+    printer->run_byte = false;
+  }
+  else if ( printer->run_left )
+  {
+    band_put(printer, b);
+    printer->run_left--;
+  }
+  else if ( b & 0x80 )
+  {
+    printer->run_left = (b & 0x7F) + 2;
+    printer->run_byte = true;
+  }
+  else
+  {
+    printer->run_left = b + 1;
+  }
+}
+
+// The checksum is in, act on the packet and work out the status to answer
+static uint8_t packet_end(link_printer_t *printer, link_printer_event_t *event)
+{
+  uint8_t reply;
+
+  printer->packets++;
+  if ( printer->sum != printer->checksum )
+  {
+    printer->errors++;
+    return printer->status | LINK_PRINTER_CHECKSUM_ERROR;
+  }
+
+  switch ( printer->command )
+  {
+    case LINK_PRINTER_INIT:
+    case LINK_PRINTER_BREAK:
+      printer->status = 0;
+      printer->busy = 0;
+      return 0;
+
+    case LINK_PRINTER_DATA:
+      if ( printer->overflow )
+      {
+        printer->errors++;
+        return printer->status | LINK_PRINTER_PACKET_ERROR;
+      }
+      // An empty DATA packet only marks the end of the image
+      if ( printer->band_len )
+      {
+        *event = LINK_PRINTER_BAND_READY;
+        printer->status |= LINK_PRINTER_UNPROCESSED;
+      }
+      return printer->status;
+
+    case LINK_PRINTER_PRINT:
+      if ( printer->len != LINK_PRINTER_PRINT_LEN )
+        return printer->status | LINK_PRINTER_PACKET_ERROR;
+
+      *event = LINK_PRINTER_PRINT_READY;
+      reply = printer->status;
+      printer->status = LINK_PRINTER_PRINTING | LINK_PRINTER_FULL;
+      printer->busy = LINK_PRINTER_BUSY_POLLS;
+      return reply;
+
+    case LINK_PRINTER_INQUIRY:
+      reply = printer->status;
+      if ( printer->busy && --printer->busy == 0 )
+        printer->status = 0;
+      return reply;
+
+    default:
+      return printer->status | LINK_PRINTER_PACKET_ERROR;
+  }
+}
+
+uint8_t link_printer_byte(link_printer_t *printer, uint8_t in, link_printer_event_t *event)
+{
+  int32_t pos = printer->pos + 1;
+  int32_t len = printer->len;
+
+  *event = LINK_PRINTER_NONE;
+
+  if ( pos == 0 )
+  {
+    if ( in != LINK_PRINTER_MAGIC0 ) return 0;
+  }
+  else if ( pos == 1 )
+  {
+    if ( in != LINK_PRINTER_MAGIC1 )
+    {
+      // Look for the packet again, this byte may start it
+      printer->pos = in == LINK_PRINTER_MAGIC0 ? 0 : -1;
+      return 0;
+    }
+    *event = LINK_PRINTER_SYNC;
+  }
+  else if ( pos == 2 )
+  {
+    printer->command = in;
+    printer->sum = in;
+    printer->band_len = 0;
+    printer->overflow = false;
+    printer->run_left = 0;
+    printer->run_byte = false;
+  }
+  else if ( pos == 3 )
+  {
+    printer->compression = in;
+    printer->sum += in;
+  }
+  else if ( pos == 4 )
+  {
+    printer->len = in;
+    printer->sum += in;
+  }
+  else if ( pos == 5 )
+  {
+    printer->len |= in << 8;
+    printer->sum += in;
+  }
+  else if ( pos < 6 + len )
+  {
+    printer->sum += in;
+    if ( printer->command == LINK_PRINTER_DATA )
+      band_data(printer, in);
+    else if ( printer->command == LINK_PRINTER_PRINT && pos - 6 < LINK_PRINTER_PRINT_LEN )
+      printer->print[pos - 6] = in;
+  }
+  else if ( pos == 6 + len )
+  {
+    printer->checksum = in;
+  }
+  else if ( pos == 7 + len )
+  {
+    printer->checksum |= in << 8;
+    printer->reply = packet_end(printer, event);
+  }
+  else if ( pos == 9 + len )
+  {
+    // The status went out, on to the next packet
+    printer->pos = -1;
+    return 0;
+  }
+
+  printer->pos = pos;
+
+  // The length is only known from pos 5 on, replies up to pos 7 are 0
+  // whatever it is
+  len = printer->len;
+  if ( pos >= 5 && pos + 2 == 8 + len ) return LINK_PRINTER_ID;
+  if ( pos >= 5 && pos + 2 == 9 + len ) return printer->reply;
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Game Boy Printer emulation.
+ *
+ * The Game Boy drives the clock and sends the printer packets:
+ *
+ *   packet   : 0x88 0x33 command compression len(2, LE) data[len]
+ *              checksum(2, LE) 0x00 0x00
+ *
+ * The checksum is the 16 bit sum of command through data. The printer
+ * answers 0x00 to everything but the last two bytes, to which it answers
+ * LINK_PRINTER_ID and its status. DATA packets carry 2bpp tiles, RLE
+ * compressed when compression is 1; PRINT carries sheets, margins, palette
+ * and exposure.
+ *
+ * The engine takes the received bytes one at a time. A slave SM has the
+ * reply to a byte queued before the byte starts, and the byte after may
+ * start as soon as it ends, so every call returns the reply to the byte
+ * two after the one passed in. Everything a reply depends on is known by
+ * then: the status only needs the checksum, which ends two bytes ahead of
+ * it.
+ *
+ * The two byte lag only holds while the replies keep up. A reply queued
+ * late goes out with the byte after the one it answers, and every reply
+ * after it too, so the caller lines them up again after LINK_PRINTER_SYNC:
+ * it drops what is queued and queues the last two replies returned again.
+ * That has to wait for a gap between bytes with every byte in taken, which
+ * on time is right after the 0x33 and otherwise may be later in the packet.
+ *
+ * A DATA packet's tiles are decompressed as they come in. Once its
+ * checksum checks out they are left in band for the caller, as are a PRINT
+ * packet's arguments in print.
+ *
+ * This file has no SDK dependencies, so captured sessions can be replayed
+ * through it on the host.
+ */
+
+#ifndef LINK_PRINTER_H_
+#define LINK_PRINTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LINK_PRINTER_MAGIC0 0x88
+#define LINK_PRINTER_MAGIC1 0x33
+#define LINK_PRINTER_ID     0x81
+
+// Two rows of 20 tiles, the most a DATA packet decompresses to
+#define LINK_PRINTER_BAND_LEN 640
+
+#define LINK_PRINTER_PRINT_LEN 4
+
+// Status polls answered as busy after a PRINT
+#define LINK_PRINTER_BUSY_POLLS 8
+
+enum
+{
+  LINK_PRINTER_INIT    = 0x01,
+  LINK_PRINTER_PRINT   = 0x02,
+  LINK_PRINTER_DATA    = 0x04,
+  LINK_PRINTER_BREAK   = 0x08,
+  LINK_PRINTER_INQUIRY = 0x0F
+};
+
+// Status bits
+enum
+{
+  LINK_PRINTER_CHECKSUM_ERROR = 0x01,
+  LINK_PRINTER_PRINTING       = 0x02,
+  LINK_PRINTER_FULL           = 0x04,
+  LINK_PRINTER_UNPROCESSED    = 0x08,
+  LINK_PRINTER_PACKET_ERROR   = 0x10
+};
+
+// What the last byte completed, see link_printer_byte()
+typedef enum
+{
+  LINK_PRINTER_NONE = 0,
+  LINK_PRINTER_BAND_READY, // band holds band_len bytes of tiles
+  LINK_PRINTER_PRINT_READY, // print holds the PRINT arguments
+  LINK_PRINTER_SYNC        // 0x88 0x33 came in, a packet starts
+} link_printer_event_t;
+
+typedef struct
+{
+  int32_t pos;        // of the last byte in its packet, -1 while looking for one
+  uint8_t command;
+  uint8_t compression;
+  uint16_t len;
+  uint16_t sum;
+  uint16_t checksum;
+
+  uint8_t status;
+  uint8_t reply;      // status to answer the current packet with
+  uint32_t busy;      // polls left to answer as printing
+
+  // RLE state, run_left counts the bytes left of the current run
+  uint8_t run_left;
+  bool run_byte;      // repeat run: its byte is still to come
+
+  uint8_t band[LINK_PRINTER_BAND_LEN];
+  uint16_t band_len;
+  bool overflow;      // the data decompressed to more than a band
+  uint8_t print[LINK_PRINTER_PRINT_LEN];
+
+  uint32_t packets;
+  uint32_t errors;    // bad checksums and overlong data
+} link_printer_t;
+
+void link_printer_init(link_printer_t *printer);
+
+// Feed one received byte, returns the reply to the byte two after it. Sets
+// *event when the byte started a packet or completed a band or a print.
+uint8_t link_printer_byte(link_printer_t *printer, uint8_t in, link_printer_event_t *event);
+
+#endif /* LINK_PRINTER_H_ */
@@ -0,0 +1,285 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "link_proto.h"
+
+static void put_u16(uint8_t *dst, uint16_t v)
+{
+  dst[0] = v;
+  dst[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *dst, uint32_t v)
+{
+  dst[0] = v;
+  dst[1] = v >> 8;
+  dst[2] = v >> 16;
+  dst[3] = v >> 24;
+}
+
+static uint16_t get_u16(uint8_t const *src)
+{
+  return src[0] | (src[1] << 8);
+}
+
+static uint32_t get_u32(uint8_t const *src)
+{
+  return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+uint32_t link_proto_put_header(uint8_t *dst, uint8_t opcode, uint8_t seq, uint16_t len)
+{
+  dst[0] = LINK_PROTO_SYNC;
+  dst[1] = LINK_PROTO_VERSION;
+  dst[2] = opcode;
+  dst[3] = seq;
+  put_u16(dst + 4, len);
+  return LINK_PROTO_HEADER_LEN;
+}
+
+bool link_proto_get_header(uint8_t const *src, link_frame_t *frame)
+{
+  if ( src[0] != LINK_PROTO_SYNC ) return false;
+
+  frame->version = src[1];
+  frame->opcode = src[2];
+  frame->seq = src[3];
+  frame->len = get_u16(src + 4);
+  return true;
+}
+
+uint32_t link_proto_put_exchange(uint8_t *dst, uint16_t len, uint32_t gap_us, uint8_t const *data)
+{
+  put_u16(dst, len);
+  put_u32(dst + 2, gap_us);
+  if ( data ) memcpy(dst + LINK_PROTO_RECORD_LEN, data, len);
+  return LINK_PROTO_RECORD_LEN + len;
+}
+
+void link_proto_get_exchange_header(uint8_t const *src, link_exchange_t *exchange)
+{
+  exchange->len = get_u16(src);
+  exchange->gap_us = get_u32(src + 2);
+  exchange->data = src + LINK_PROTO_RECORD_LEN;
+}
+
+bool link_proto_next_exchange(uint8_t const *payload, uint32_t len, uint32_t *offset, link_exchange_t *exchange)
+{
+  if ( *offset + LINK_PROTO_RECORD_LEN > len ) return false;
+
+  link_proto_get_exchange_header(payload + *offset, exchange);
+  if ( *offset + LINK_PROTO_RECORD_LEN + exchange->len > len ) return false;
+
+  *offset += LINK_PROTO_RECORD_LEN + exchange->len;
+  return true;
+}
+
+uint32_t link_proto_put_config(uint8_t *dst, link_config_t const *config)
+{
+  put_u32(dst, config->us_between_transfer);
+  dst[4] = config->bytes_per_transfer;
+  dst[5] = config->mode;
+  return LINK_PROTO_CONFIG_LEN;
+}
+
+void link_proto_get_config(uint8_t const *src, link_config_t *config)
+{
+  config->us_between_transfer = get_u32(src);
+  config->bytes_per_transfer = src[4];
+  config->mode = src[5];
+}
+
+bool link_proto_parse_config(uint8_t const *src, link_config_t *config, bool *ready)
+{
+  link_proto_get_config(src, config);
+  *ready = config->bytes_per_transfer & LINK_PROTO_READY_LINE;
+  config->bytes_per_transfer &= ~LINK_PROTO_READY_LINE;
+  return config->mode < LINK_MODE_COUNT;
+}
+
+uint32_t link_proto_put_u32(uint8_t *dst, uint32_t value)
+{
+  put_u32(dst, value);
+  return 4;
+}
+
+uint32_t link_proto_get_u32(uint8_t const *src)
+{
+  return get_u32(src);
+}
+
+uint32_t link_proto_put_rule(uint8_t *dst, link_rule_t const *rule)
+{
+  dst[0] = rule->state;
+  dst[1] = rule->mask;
+  dst[2] = rule->match;
+  dst[3] = rule->reply;
+  dst[4] = rule->next_state;
+  dst[5] = rule->flags;
+  put_u16(dst + 6, rule->wait_us);
+  return LINK_PROTO_RULE_LEN;
+}
+
+void link_proto_get_rule(uint8_t const *src, link_rule_t *rule)
+{
+  rule->state = src[0];
+  rule->mask = src[1];
+  rule->match = src[2];
+  rule->reply = src[3];
+  rule->next_state = src[4];
+  rule->flags = src[5];
+  rule->wait_us = get_u16(src + 6);
+}
+
+uint32_t link_proto_put_run(uint8_t *dst, link_run_t const *run)
+{
+  dst[0] = run->first;
+  dst[1] = run->state;
+  put_u32(dst + 2, run->limit);
+  return LINK_PROTO_RUN_LEN;
+}
+
+void link_proto_get_run(uint8_t const *src, link_run_t *run)
+{
+  run->first = src[0];
+  run->state = src[1];
+  run->limit = get_u32(src + 2);
+}
+
+uint32_t link_proto_put_result(uint8_t *dst, link_result_t const *result)
+{
+  dst[0] = result->reason;
+  dst[1] = result->last;
+  put_u32(dst + 2, result->exchanged);
+  return LINK_PROTO_RESULT_LEN;
+}
+
+void link_proto_get_result(uint8_t const *src, link_result_t *result)
+{
+  result->reason = src[0];
+  result->last = src[1];
+  result->exchanged = get_u32(src + 2);
+}
+
+uint32_t link_proto_put_adapt(uint8_t *dst, link_adapt_config_t const *adapt)
+{
+  dst[0] = adapt->enable;
+  dst[1] = adapt->idle;
+  put_u32(dst + 2, adapt->min_us);
+  put_u32(dst + 6, adapt->max_us);
+  return LINK_PROTO_ADAPT_LEN;
+}
+
+void link_proto_get_adapt(uint8_t const *src, link_adapt_config_t *adapt)
+{
+  adapt->enable = src[0];
+  adapt->idle = src[1];
+  adapt->min_us = get_u32(src + 2);
+  adapt->max_us = get_u32(src + 6);
+}
+
+uint32_t link_proto_put_port_config(uint8_t *dst, link_port_config_t const *config)
+{
+  dst[0] = config->port;
+  dst[1] = config->bytes_per_transfer;
+  put_u32(dst + 2, config->us_between_transfer);
+  return LINK_PROTO_PORT_CONFIG_LEN;
+}
+
+void link_proto_get_port_config(uint8_t const *src, link_port_config_t *config)
+{
+  config->port = src[0];
+  config->bytes_per_transfer = src[1];
+  config->us_between_transfer = get_u32(src + 2);
+}
+
+uint32_t link_proto_put_profile(uint8_t *dst, link_profile_t const *profile)
+{
+  memcpy(dst, profile->name, LINK_PROFILE_NAME_LEN);
+  dst += LINK_PROFILE_NAME_LEN;
+  dst[0] = profile->mode;
+  dst[1] = profile->bytes_per_transfer;
+  put_u32(dst + 2, profile->us_between_transfer);
+  put_u32(dst + 6, profile->sck_hz);
+  dst[10] = profile->flags;
+  dst[11] = profile->pin_sout;
+  dst[12] = profile->pin_si;
+  dst[13] = profile->frame_bits;
+  return LINK_PROTO_PROFILE_LEN;
+}
+
+void link_proto_get_profile(uint8_t const *src, link_profile_t *profile)
+{
+  memcpy(profile->name, src, LINK_PROFILE_NAME_LEN);
+  src += LINK_PROFILE_NAME_LEN;
+  profile->mode = src[0];
+  profile->bytes_per_transfer = src[1];
+  profile->us_between_transfer = get_u32(src + 2);
+  profile->sck_hz = get_u32(src + 6);
+  profile->flags = src[10];
+  profile->pin_sout = src[11];
+  profile->pin_si = src[12];
+  profile->frame_bits = src[13];
+}
+
+uint32_t link_proto_put_bench(uint8_t *dst, link_bench_t const *bench)
+{
+  put_u32(dst, bench->count);
+  put_u32(dst + 4, bench->sck_hz);
+  dst[8] = bench->bytes_per_transfer;
+  put_u32(dst + 9, bench->us_between_transfer);
+  dst[13] = bench->flags;
+  return LINK_PROTO_BENCH_LEN;
+}
+
+void link_proto_get_bench(uint8_t const *src, link_bench_t *bench)
+{
+  bench->count = get_u32(src);
+  bench->sck_hz = get_u32(src + 4);
+  bench->bytes_per_transfer = src[8];
+  bench->us_between_transfer = get_u32(src + 9);
+  bench->flags = src[13];
+}
+
+uint32_t link_proto_put_report(uint8_t *dst, link_report_t const *report)
+{
+  put_u32(dst, report->exchanged);
+  put_u32(dst + 4, report->elapsed_us);
+  put_u32(dst + 8, report->bytes_per_s);
+  put_u32(dst + 12, report->mismatches);
+  put_u32(dst + 16, report->stall_cycles);
+  put_u32(dst + 20, report->pacing_mean_us);
+  put_u32(dst + 24, report->pacing_max_us);
+  put_u32(dst + 28, report->sck_hz);
+  return LINK_PROTO_REPORT_LEN;
+}
+
+void link_proto_get_report(uint8_t const *src, link_report_t *report)
+{
+  report->exchanged = get_u32(src);
+  report->elapsed_us = get_u32(src + 4);
+  report->bytes_per_s = get_u32(src + 8);
+  report->mismatches = get_u32(src + 12);
+  report->stall_cycles = get_u32(src + 16);
+  report->pacing_mean_us = get_u32(src + 20);
+  report->pacing_max_us = get_u32(src + 24);
+  report->sck_hz = get_u32(src + 28);
+}
+
+uint32_t link_proto_put_stats(uint8_t *dst, link_stats_t const *stats)
+{
+  put_u32(dst, stats->bytes_exchanged);
+  put_u32(dst + 4, stats->frames);
+  put_u32(dst + 8, stats->errors);
+  return LINK_PROTO_STATS_LEN;
+}
+
+void link_proto_get_stats(uint8_t const *src, link_stats_t *stats)
+{
+  stats->bytes_exchanged = get_u32(src);
+  stats->frames = get_u32(src + 4);
+  stats->errors = get_u32(src + 8);
+}
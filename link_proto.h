@@ -0,0 +1,425 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Framed link protocol.
+ *
+ * In framed mode every host transfer is a sequence of frames, and every
+ * frame gets exactly one reply frame, in order:
+ *
+ *   frame    : sync(0xA7) version opcode seq len_lo len_hi payload[len]
+ *   reply    : same header with opcode | LINK_OP_REPLY and the same seq
+ *
+ * EXCHANGE carries any number of exchange records back to back:
+ *
+ *   record   : len_lo len_hi gap_us(4, LE) data[len]
+ *
+ * Each record is clocked out to the Game Boy in one burst, then the link
+ * is left idle for gap_us before the next one. The reply has the same
+ * layout and length as the request, with every data[] replaced by the
+ * bytes received while it went out, so a whole batch of exchanges takes
+ * one USB round trip.
+ *
+ * CONFIGURE sets the pacing used in raw mode and can switch to any other
+ * mode; LINK_PROTO_READY_LINE in its bytes_per_transfer turns the ready
+ * line on, as with the vendor request. The reply has the settings in
+ * effect, and a mode that does not exist is answered with
+ * LINK_STATUS_BAD_MODE and changes nothing. SET_CLOCK takes a SCK rate in Hz (u32 LE, 0 for the boot
+ * default) and replies with the rate actually achieved, STATS returns
+ * link_stats_t, PING echoes its payload. Anything the device cannot handle
+ * is answered with an ERROR frame whose payload is the offending opcode and
+ * a link_status_t.
+ *
+ * SCRIPT_LOAD replaces the on-device response script (see link_script.h)
+ * with its payload of rules, and replies with the number of rules kept:
+ *
+ *   rule     : state mask match reply next_state flags wait_us(2, LE)
+ *
+ * SCRIPT_RUN then runs it against the Game Boy without the host:
+ *
+ *   run      : first state limit(4, LE)
+ *   result   : reason last exchanged(4, LE) forwarded[]
+ *
+ * first is the byte to open with, limit caps the number of exchanges (0
+ * for none). The reply only comes once the script has stopped, with the
+ * link_script_reason_t, the last byte received, and every byte a rule
+ * asked to forward. Frames after SCRIPT_RUN wait for it.
+ *
+ * ADAPT controls adaptive pacing for raw mode (see link_pacer.h) and
+ * replies with the settings in effect:
+ *
+ *   adapt    : enable idle min_us(4, LE) max_us(4, LE)
+ *
+ * idle is the byte the peer answers with while it is not ready.
+ *
+ * READY turns the hardware ready line on or off for raw mode, payload and
+ * reply are enable and active_high (one byte each).
+ *
+ * FORMAT sets the frame format of raw and slave mode, payload and reply
+ * are bits (1 to 32, 0 for 8) and lsb_first (one byte each); the reply has
+ * the format in effect. Frames wider than a byte take 2 or 4 bytes of the
+ * data stream each, little endian, and chunks are cut to whole frames. A
+ * frame is right-justified in its bytes: the bits above its width are not
+ * sent, and come back as 0. A trailing partial frame waits for the rest.
+ * Every other mode, and framed mode itself, keeps exchanging 8 bit
+ * MSB-first bytes.
+ *
+ * PORT_EXCHANGE and PORT_CONFIGURE drive the hub ports, extra link cables
+ * that run next to the main one (see link_hub.h):
+ *
+ *   port_exchange : port data[]
+ *   port_config   : port bytes_per_transfer gap_us(4, LE)
+ *
+ * Data sent to a port is exchanged in chunks paced by its own settings,
+ * while other ports and the main link run, and the reply carries the port
+ * and the bytes received. Replies still come in request order: frames for
+ * other ports keep being taken in, but any other frame waits until every
+ * earlier port reply is out. PORT_CONFIGURE replies with the settings in
+ * effect. Ports start out off, with their pins left alone; the first
+ * PORT_CONFIGURE turns a port on, and one with bytes_per_transfer 0 turns
+ * it off again and lets go of its pins. PORT_EXCHANGE to a port that is
+ * off is answered with LINK_STATUS_BAD_PORT.
+ *
+ * BENCH runs a link benchmark on the device, without the host in the loop,
+ * and replies once it is over; frames after it wait:
+ *
+ *   bench    : count(4, LE) sck_hz(4, LE) bytes_per_transfer gap_us(4, LE)
+ *              flags
+ *   report   : exchanged(4, LE) elapsed_us(4, LE) bytes_per_s(4, LE)
+ *              mismatches(4, LE) stall_cycles(4, LE) pacing_mean_us(4, LE)
+ *              pacing_max_us(4, LE) sck_hz(4, LE)
+ *
+ * count bytes go out in chunks paced like raw mode, at sck_hz (0 for the
+ * rate in use, which is restored afterwards). With LINK_BENCH_LOOPBACK
+ * the SM reads back its own SOUT instead of SIN, so no cable or Game Boy
+ * is needed and mismatches counts the bytes that did not come back as
+ * sent: a self-test of the PIO and DMA path. stall_cycles are SM cycles
+ * spent on top of the 4 per bit the program needs, waiting on the FIFOs
+ * or the core, measured to the microsecond; pacing error is how late
+ * chunks started against their gap. A PING round trip next to it gives
+ * the USB side's share of a session.
+ *
+ * Framed mode is entered with the legacy magic config packet, using
+ * LINK_PROTO_ENTER_FRAMED as the bytes-per-transfer value. Slave, GBA and
+ * printer mode are entered the same way with LINK_PROTO_ENTER_SLAVE,
+ * LINK_PROTO_ENTER_GBA and LINK_PROTO_ENTER_PRINTER. The configure vendor
+ * request does the same out of band, with a CONFIGURE payload, and leaves
+ * the data path a plain byte pipe; once a host has used it, data that
+ * looks like a magic packet is just data until the host reconnects.
+ *
+ * In GBA mode the device is the parent of a GBA multiplayer session. The
+ * host sends the parent's data, and gets every slot back per transfer:
+ *
+ *   send     : data(2, LE)
+ *   reply    : parent(2, LE) child1(2, LE) child2(2, LE) child3(2, LE)
+ *
+ * Empty slots read 0xFFFF. Transfers are paced like raw mode chunks, a
+ * chunk of bytes-per-transfer bytes being one or more whole sends.
+ *
+ * In printer mode the device answers the Game Boy as a Game Boy Printer
+ * (see link_printer.h) and ignores the host's data. All the host gets is
+ * frames in the header format above, seq counting them:
+ *
+ *   PRINTER_BAND  : the decompressed 2bpp tiles of a DATA packet
+ *   PRINTER_PRINT : sheets margins palette exposure
+ *
+ * both with LINK_OP_REPLY set.
+ *
+ * Profiles are named sets of link settings kept in flash (see
+ * link_store.h), read and written with a vendor request in any mode:
+ *
+ *   profile  : name[12] mode bytes_per_transfer gap_us(4, LE) sck_hz(4, LE)
+ *              flags pin_sout pin_si frame_bits
+ *
+ * name is NUL padded. gap_us and sck_hz take the same special values as
+ * CONFIGURE and SET_CLOCK, and the pins LINK_PROFILE_PIN_STRAP.
+ * frame_bits and LINK_PROFILE_LSB_FIRST are the frame format, as FORMAT
+ * sets it.
+ *
+ * Firmware built with USB_INTERRUPT has a HID interface with an interrupt
+ * endpoint pair polled every frame, for interactive exchanges of a few
+ * bytes that cannot wait on the host's bulk scheduling. In raw mode every
+ * output report is exchanged as one burst and answered with one input
+ * report, both of LINK_PROTO_HID_REPORT_LEN bytes:
+ *
+ *   request  : seq len data[len]
+ *   reply    : seq len data[len]
+ *
+ * The reply carries the bytes received. A request is held until the link
+ * is idle, so it goes out between the chunks of the bulk interfaces, never
+ * inside one. len 0 in a reply means nothing was exchanged: the device is
+ * in another mode or a config change is pending. Only one request may be
+ * outstanding, one sent before the previous reply is dropped.
+ *
+ * These helpers have no SDK dependencies and are meant to be shared with
+ * host tools.
+ */
+
+#ifndef LINK_PROTO_H_
+#define LINK_PROTO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LINK_PROTO_SYNC            0xA7
+#define LINK_PROTO_VERSION         1
+#define LINK_PROTO_HEADER_LEN      6
+#define LINK_PROTO_RECORD_LEN      6
+#define LINK_PROTO_CONFIG_LEN      6
+#define LINK_PROTO_STATS_LEN       12
+#define LINK_PROTO_CLOCK_LEN       4
+#define LINK_PROTO_RULE_LEN        8
+#define LINK_PROTO_RUN_LEN         6
+#define LINK_PROTO_RESULT_LEN      6
+#define LINK_PROTO_ADAPT_LEN       10
+#define LINK_PROTO_READY_LEN       2
+#define LINK_PROTO_FORMAT_LEN      2
+#define LINK_PROTO_PORT_CONFIG_LEN 6
+#define LINK_PROTO_PROFILE_LEN     26
+#define LINK_PROTO_HID_REPORT_LEN  8
+#define LINK_PROTO_BENCH_LEN       14
+#define LINK_PROTO_REPORT_LEN      32
+
+#define LINK_PROTO_ENTER_FRAMED  0xFF
+#define LINK_PROTO_ENTER_SLAVE   0xFE
+#define LINK_PROTO_ENTER_GBA     0xFD
+#define LINK_PROTO_ENTER_PRINTER 0xFC
+
+// Flag in the bytes-per-transfer value of CONFIGURE and the legacy magic
+// config packet, turns on the ready line (see link_engine_set_ready())
+#define LINK_PROTO_READY_LINE    0x80
+
+// us_between_transfer value, in CONFIGURE or the legacy magic config packet,
+// that turns on adaptive pacing with the default bounds
+#define LINK_PROTO_ADAPTIVE_GAP  0xFFFFFF
+
+enum
+{
+  LINK_OP_PING           = 0x01,
+  LINK_OP_CONFIGURE      = 0x02,
+  LINK_OP_STATS          = 0x03,
+  LINK_OP_EXCHANGE       = 0x04,
+  LINK_OP_SET_CLOCK      = 0x05,
+  LINK_OP_SCRIPT_LOAD    = 0x06,
+  LINK_OP_SCRIPT_RUN     = 0x07,
+  LINK_OP_ADAPT          = 0x08,
+  LINK_OP_READY          = 0x09,
+  LINK_OP_FORMAT         = 0x0A,
+  LINK_OP_PORT_EXCHANGE  = 0x0B,
+  LINK_OP_PORT_CONFIGURE = 0x0C,
+  LINK_OP_PRINTER_BAND   = 0x0D,
+  LINK_OP_PRINTER_PRINT  = 0x0E,
+  LINK_OP_BENCH          = 0x0F,
+  LINK_OP_ERROR          = 0x7F,
+
+  LINK_OP_REPLY          = 0x80
+};
+
+typedef enum
+{
+  LINK_MODE_RAW = 0,
+  LINK_MODE_FRAMED,
+  LINK_MODE_SLAVE,   // the Game Boy supplies the clock
+  LINK_MODE_GBA,     // GBA multiplayer parent
+  LINK_MODE_PRINTER, // Game Boy Printer emulation
+  LINK_MODE_COUNT
+} link_mode_t;
+
+#define LINK_PROFILE_NAME_LEN 12
+
+// Profile flags
+enum
+{
+  LINK_PROFILE_READY_LINE = 0x01, // turn the ready line on
+  LINK_PROFILE_ACTIVE_LOW = 0x02, // and the Game Boy pulls it low when ready
+  LINK_PROFILE_LSB_FIRST  = 0x04  // frames go out LSB-first
+};
+
+// Profile pin value for the board's own choice, made with TEST_PIN at boot
+#define LINK_PROFILE_PIN_STRAP 0xFF
+
+// BENCH flags
+enum
+{
+  LINK_BENCH_LOOPBACK = 0x01 // SOUT wired to SIN inside the PIO
+};
+
+// Serial clock rates of the Game Boy family, for SET_CLOCK
+enum
+{
+  LINK_CLOCK_DEFAULT         = 0,
+  LINK_CLOCK_DMG             = 8192,   // normal speed
+  LINK_CLOCK_CGB_DOUBLE      = 16384,  // CGB in double speed mode
+  LINK_CLOCK_CGB_FAST        = 262144, // CGB fast clock (SC bit 1)
+  LINK_CLOCK_CGB_FAST_DOUBLE = 524288  // both of the above
+};
+
+typedef enum
+{
+  LINK_STATUS_OK = 0,
+  LINK_STATUS_BAD_VERSION,
+  LINK_STATUS_BAD_OPCODE,
+  LINK_STATUS_BAD_LENGTH,
+  LINK_STATUS_BAD_PORT,
+  LINK_STATUS_BAD_MODE
+} link_status_t;
+
+typedef struct
+{
+  uint8_t version;
+  uint8_t opcode;
+  uint8_t seq;
+  uint16_t len;
+} link_frame_t;
+
+typedef struct
+{
+  uint16_t len;
+  uint32_t gap_us;
+  uint8_t const *data;
+} link_exchange_t;
+
+typedef struct
+{
+  uint32_t us_between_transfer;
+  uint8_t bytes_per_transfer;
+  uint8_t mode; // link_mode_t
+} link_config_t;
+
+typedef struct
+{
+  uint8_t state;      // only considered while the script is in this state
+  uint8_t mask;       // bits of the received byte compared with match
+  uint8_t match;
+  uint8_t reply;      // byte sent next
+  uint8_t next_state;
+  uint8_t flags;      // LINK_SCRIPT_FORWARD, LINK_SCRIPT_STOP
+  uint16_t wait_us;   // idle time before the reply goes out
+} link_rule_t;
+
+typedef struct
+{
+  uint8_t first;
+  uint8_t state;
+  uint32_t limit;
+} link_run_t;
+
+typedef struct
+{
+  uint8_t reason; // link_script_reason_t
+  uint8_t last;
+  uint32_t exchanged;
+} link_result_t;
+
+typedef struct
+{
+  uint8_t enable;
+  uint8_t idle;
+  uint32_t min_us;
+  uint32_t max_us;
+} link_adapt_config_t;
+
+typedef struct
+{
+  uint8_t port;
+  uint8_t bytes_per_transfer;
+  uint32_t us_between_transfer;
+} link_port_config_t;
+
+typedef struct
+{
+  char name[LINK_PROFILE_NAME_LEN]; // not NUL terminated when full
+  uint8_t mode;                     // link_mode_t
+  uint8_t bytes_per_transfer;
+  uint32_t us_between_transfer;
+  uint32_t sck_hz;
+  uint8_t flags;
+  uint8_t pin_sout;
+  uint8_t pin_si;
+  uint8_t frame_bits;               // 1 to 32, 0 for 8
+} link_profile_t;
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t sck_hz;
+  uint8_t bytes_per_transfer;
+  uint32_t us_between_transfer;
+  uint8_t flags;
+} link_bench_t;
+
+typedef struct
+{
+  uint32_t exchanged;
+  uint32_t elapsed_us;   // first chunk start to last chunk end
+  uint32_t bytes_per_s;
+  uint32_t mismatches;   // loopback only
+  uint32_t stall_cycles;
+  uint32_t pacing_mean_us;
+  uint32_t pacing_max_us;
+  uint32_t sck_hz;       // rate achieved
+} link_report_t;
+
+typedef struct
+{
+  uint32_t bytes_exchanged;
+  uint32_t frames;
+  uint32_t errors;
+} link_stats_t;
+
+// All put functions return the number of bytes written to dst
+
+uint32_t link_proto_put_header(uint8_t *dst, uint8_t opcode, uint8_t seq, uint16_t len);
+
+// Returns false if src does not start with the sync byte
+bool link_proto_get_header(uint8_t const *src, link_frame_t *frame);
+
+// data may be NULL to leave the data bytes untouched, e.g. when they are
+// filled in separately
+uint32_t link_proto_put_exchange(uint8_t *dst, uint16_t len, uint32_t gap_us, uint8_t const *data);
+
+// Record header only, data is not touched
+void link_proto_get_exchange_header(uint8_t const *src, link_exchange_t *exchange);
+
+// Walks the records of an EXCHANGE payload. Start with *offset at 0; returns
+// false once the payload is used up or the next record is truncated.
+bool link_proto_next_exchange(uint8_t const *payload, uint32_t len, uint32_t *offset, link_exchange_t *exchange);
+
+uint32_t link_proto_put_config(uint8_t *dst, link_config_t const *config);
+void link_proto_get_config(uint8_t const *src, link_config_t *config);
+
+// CONFIGURE's payload as settings, with LINK_PROTO_READY_LINE taken out of
+// bytes_per_transfer into ready. Returns false for a mode that does not
+// exist.
+bool link_proto_parse_config(uint8_t const *src, link_config_t *config, bool *ready);
+
+uint32_t link_proto_put_u32(uint8_t *dst, uint32_t value);
+uint32_t link_proto_get_u32(uint8_t const *src);
+
+uint32_t link_proto_put_rule(uint8_t *dst, link_rule_t const *rule);
+void link_proto_get_rule(uint8_t const *src, link_rule_t *rule);
+
+uint32_t link_proto_put_run(uint8_t *dst, link_run_t const *run);
+void link_proto_get_run(uint8_t const *src, link_run_t *run);
+
+uint32_t link_proto_put_result(uint8_t *dst, link_result_t const *result);
+void link_proto_get_result(uint8_t const *src, link_result_t *result);
+
+uint32_t link_proto_put_adapt(uint8_t *dst, link_adapt_config_t const *adapt);
+void link_proto_get_adapt(uint8_t const *src, link_adapt_config_t *adapt);
+
+uint32_t link_proto_put_port_config(uint8_t *dst, link_port_config_t const *config);
+void link_proto_get_port_config(uint8_t const *src, link_port_config_t *config);
+
+uint32_t link_proto_put_profile(uint8_t *dst, link_profile_t const *profile);
+void link_proto_get_profile(uint8_t const *src, link_profile_t *profile);
+
+uint32_t link_proto_put_bench(uint8_t *dst, link_bench_t const *bench);
+void link_proto_get_bench(uint8_t const *src, link_bench_t *bench);
+
+uint32_t link_proto_put_report(uint8_t *dst, link_report_t const *report);
+void link_proto_get_report(uint8_t const *src, link_report_t *report);
+
+uint32_t link_proto_put_stats(uint8_t *dst, link_stats_t const *stats);
+void link_proto_get_stats(uint8_t const *src, link_stats_t *stats);
+
+#endif /* LINK_PROTO_H_ */
@@ -0,0 +1,36 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <stddef.h>
+
+#include "link_script.h"
+
+void link_script_clear(link_script_t *script)
+{
+  script->count = 0;
+  script->state = 0;
+}
+
+bool link_script_add(link_script_t *script, link_rule_t const *rule)
+{
+  if ( script->count == LINK_SCRIPT_MAX_RULES ) return false;
+
+  script->rules[script->count++] = *rule;
+  return true;
+}
+
+link_rule_t const *link_script_match(link_script_t *script, uint8_t received)
+{
+  for ( uint8_t i = 0; i < script->count; i++ )
+  {
+    link_rule_t const *rule = &script->rules[i];
+    if ( rule->state == script->state && (received & rule->mask) == rule->match )
+    {
+      script->state = rule->next_state;
+      return rule;
+    }
+  }
+
+  return NULL;
+}
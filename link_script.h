@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * On-device response scripts.
+ *
+ * Handshakes such as trades are long runs of "the Game Boy sent X, answer
+ * with Y", and going through the host for every byte costs a USB round trip
+ * each. A script is a table of link_rule_t the host uploads once; the link
+ * engine then looks every received byte up in it and sends the reply by
+ * itself, at link speed. Only what the rules do not cover, or ask to
+ * forward, ends up at the host.
+ *
+ * The script is a small state machine. A rule applies while the script is
+ * in rule.state and (received & rule.mask) == rule.match; the first such
+ * rule wins, its reply goes out after wait_us and the script moves on to
+ * rule.next_state. A received byte no rule matches stops the script.
+ *
+ * This file has no SDK dependencies, so scripts can be checked on the host.
+ */
+
+#ifndef LINK_SCRIPT_H_
+#define LINK_SCRIPT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "link_proto.h"
+
+#define LINK_SCRIPT_MAX_RULES   64
+#define LINK_SCRIPT_MAX_FORWARD 256
+
+// link_rule_t flags
+enum
+{
+  LINK_SCRIPT_FORWARD = 0x01, // pass the received byte on to the host
+  LINK_SCRIPT_STOP    = 0x02  // stop after this byte, the reply is not sent
+};
+
+// Why a script stopped
+typedef enum
+{
+  LINK_SCRIPT_DONE = 0,     // a LINK_SCRIPT_STOP rule matched
+  LINK_SCRIPT_NO_MATCH,     // no rule for the last byte received
+  LINK_SCRIPT_LIMIT,        // ran for the number of exchanges asked for
+  LINK_SCRIPT_FORWARD_FULL  // no room left for forwarded bytes
+} link_script_reason_t;
+
+typedef struct
+{
+  link_rule_t rules[LINK_SCRIPT_MAX_RULES];
+  uint8_t count;
+  uint8_t state;
+} link_script_t;
+
+void link_script_clear(link_script_t *script);
+
+// Returns false if the script is full
+bool link_script_add(link_script_t *script, link_rule_t const *rule);
+
+// Looks up the rule for a received byte and moves the script on to its
+// next state. Returns NULL, leaving the state alone, if there is none.
+link_rule_t const *link_script_match(link_script_t *script, uint8_t received);
+
+#endif /* LINK_SCRIPT_H_ */
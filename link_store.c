@@ -0,0 +1,185 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+#include "link_engine.h"
+#include "link_store.h"
+
+// The last two sectors of flash, one record per page
+#define STORE_SECTORS 2
+#define STORE_OFFSET (PICO_FLASH_SIZE_BYTES - STORE_SECTORS * FLASH_SECTOR_SIZE)
+#define STORE_PAGES (STORE_SECTORS * FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define SECTOR_PAGES (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+// Record: magic(4) seq(4) boot profiles[] ... crc(4) at the end of the page
+#define STORE_MAGIC 0x53424C47 // "GLBS"
+#define RECORD_PROFILES 9
+#define RECORD_CRC (FLASH_PAGE_SIZE - 4)
+
+_Static_assert(RECORD_PROFILES + LINK_STORE_PROFILES * LINK_PROTO_PROFILE_LEN <= RECORD_CRC,
+               "profiles do not fit a flash page");
+
+static link_profile_t profiles[LINK_STORE_PROFILES];
+static uint32_t boot_index;
+static uint32_t store_seq;
+static uint store_page; // of the newest record
+static bool store_dirty = false;
+
+static uint32_t crc32(uint8_t const *src, uint32_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  while ( len-- )
+  {
+    crc ^= *src++;
+    for ( int bit = 0; bit < 8; bit++ )
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint8_t const *page_addr(uint page)
+{
+  return (uint8_t const *) (XIP_BASE + STORE_OFFSET + page * FLASH_PAGE_SIZE);
+}
+
+static bool page_blank(uint page)
+{
+  uint8_t const *src = page_addr(page);
+  for ( uint i = 0; i < FLASH_PAGE_SIZE; i++ )
+    if ( src[i] != 0xFF ) return false;
+  return true;
+}
+
+static bool record_valid(uint8_t const *record)
+{
+  return link_proto_get_u32(record) == STORE_MAGIC &&
+         link_proto_get_u32(record + RECORD_CRC) == crc32(record, RECORD_CRC);
+}
+
+static void store_defaults(void)
+{
+  memset(profiles, 0, sizeof(profiles));
+  for ( uint i = 0; i < LINK_STORE_PROFILES; i++ )
+  {
+    link_profile_t *profile = &profiles[i];
+    profile->mode = LINK_MODE_RAW;
+    profile->bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+    profile->us_between_transfer = US_DEFAULT_PER_TRANSFER;
+    profile->sck_hz = LINK_CLOCK_DEFAULT;
+    profile->pin_sout = LINK_PROFILE_PIN_STRAP;
+    profile->pin_si = LINK_PROFILE_PIN_STRAP;
+  }
+  memcpy(profiles[0].name, "default", sizeof("default"));
+  boot_index = 0;
+}
+
+static bool profile_valid(link_profile_t const *profile)
+{
+  return profile->mode < LINK_MODE_COUNT && profile->frame_bits <= 32 &&
+         (profile->pin_sout < NUM_BANK0_GPIOS || profile->pin_sout == LINK_PROFILE_PIN_STRAP) &&
+         (profile->pin_si < NUM_BANK0_GPIOS || profile->pin_si == LINK_PROFILE_PIN_STRAP);
+}
+
+void link_store_init(void)
+{
+  store_defaults();
+
+  // No valid record at all makes the next save start on page 0
+  uint8_t const *newest = NULL;
+  store_page = STORE_PAGES - 1;
+
+  for ( uint page = 0; page < STORE_PAGES; page++ )
+  {
+    uint8_t const *record = page_addr(page);
+    if ( !record_valid(record) ) continue;
+
+    uint32_t seq = link_proto_get_u32(record + 4);
+    if ( newest && (int32_t) (seq - store_seq) <= 0 ) continue;
+
+    newest = record;
+    store_seq = seq;
+    store_page = page;
+  }
+  if ( !newest ) return;
+
+  for ( uint i = 0; i < LINK_STORE_PROFILES; i++ )
+  {
+    link_profile_t profile;
+    link_proto_get_profile(newest + RECORD_PROFILES + i * LINK_PROTO_PROFILE_LEN, &profile);
+    if ( profile_valid(&profile) ) profiles[i] = profile;
+  }
+  if ( newest[8] < LINK_STORE_PROFILES ) boot_index = newest[8];
+}
+
+void link_store_save(void)
+{
+  uint8_t record[FLASH_PAGE_SIZE];
+  memset(record, 0xFF, sizeof(record));
+  link_proto_put_u32(record, STORE_MAGIC);
+  link_proto_put_u32(record + 4, ++store_seq);
+  record[8] = boot_index;
+  for ( uint i = 0; i < LINK_STORE_PROFILES; i++ )
+    link_proto_put_profile(record + RECORD_PROFILES + i * LINK_PROTO_PROFILE_LEN, &profiles[i]);
+  link_proto_put_u32(record + RECORD_CRC, crc32(record, RECORD_CRC));
+
+  // The next blank page after the newest record. Moving on to the other
+  // sector erases it, it only holds older records.
+  uint page = store_page;
+  bool erase;
+  do
+  {
+    page = (page + 1) % STORE_PAGES;
+    erase = page % SECTOR_PAGES == 0;
+  } while ( !erase && !page_blank(page) );
+  store_page = page;
+
+  // Core 1 runs from flash too, park it in RAM while flash is off the bus
+  multicore_lockout_start_blocking();
+  uint32_t irq = save_and_disable_interrupts();
+  if ( erase ) flash_range_erase(STORE_OFFSET + page / SECTOR_PAGES * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+  flash_range_program(STORE_OFFSET + page * FLASH_PAGE_SIZE, record, FLASH_PAGE_SIZE);
+  restore_interrupts(irq);
+  multicore_lockout_end_blocking();
+  store_dirty = false;
+}
+
+bool link_store_dirty(void)
+{
+  return store_dirty;
+}
+
+link_profile_t const *link_store_profile(uint32_t index)
+{
+  return index < LINK_STORE_PROFILES ? &profiles[index] : NULL;
+}
+
+uint32_t link_store_boot(void)
+{
+  return boot_index;
+}
+
+bool link_store_set_profile(uint32_t index, link_profile_t const *profile)
+{
+  if ( index >= LINK_STORE_PROFILES || !profile_valid(profile) ) return false;
+
+  profiles[index] = *profile;
+  if ( profiles[index].bytes_per_transfer > LINK_MAX_CHUNK ) profiles[index].bytes_per_transfer = LINK_MAX_CHUNK;
+  if ( profiles[index].bytes_per_transfer == 0 ) profiles[index].bytes_per_transfer = 1;
+  store_dirty = true;
+  return true;
+}
+
+bool link_store_set_boot(uint32_t index)
+{
+  if ( index >= LINK_STORE_PROFILES ) return false;
+
+  boot_index = index;
+  store_dirty = true;
+  return true;
+}
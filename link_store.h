@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Link profiles kept in flash.
+ *
+ * The store holds LINK_STORE_PROFILES profiles (see link_proto.h) and the
+ * index of the one the device boots with. The boot profile picks the pins
+ * and the settings the link starts out with, and is applied again whenever
+ * the host reconnects, so a host whose settings are saved never has to
+ * send them.
+ *
+ * Every change writes the whole store as a new record into the next blank
+ * page of the last two flash sectors, and the newest record with a good
+ * checksum is the one loaded at boot. A sector is only erased once the
+ * other one has filled up, so the newest record always survives, an erase
+ * is good for a sector's worth of saves, and losing power mid-write loses
+ * that one change at most.
+ *
+ * Writing flash stops both cores, the link included: about a millisecond
+ * per save, and some 50 ms more when a sector has to be erased first. So
+ * changes only go to RAM, and the caller saves them with link_store_save()
+ * once the link is quiet, never from a USB callback.
+ *
+ * Core 0 only, once core 1 has called multicore_lockout_victim_init().
+ */
+
+#ifndef LINK_STORE_H_
+#define LINK_STORE_H_
+
+#include "link_proto.h"
+
+#define LINK_STORE_PROFILES 8
+
+// Load the store from flash, or the defaults if it holds nothing valid
+void link_store_init(void);
+
+// NULL for an index out of range
+link_profile_t const *link_store_profile(uint32_t index);
+
+uint32_t link_store_boot(void);
+
+// Both change the store in RAM and leave it to be saved. set_profile
+// returns false for an index out of range or a profile with a mode, pins
+// or a frame width that do not exist; a chunk size out of range is clamped.
+bool link_store_set_profile(uint32_t index, link_profile_t const *profile);
+bool link_store_set_boot(uint32_t index);
+
+// Whether there are changes not saved yet, and write them to flash
+bool link_store_dirty(void);
+void link_store_save(void);
+
+#endif /* LINK_STORE_H_ */
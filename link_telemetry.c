@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "link_proto.h"
+#include "link_telemetry.h"
+
+link_telemetry_t link_telemetry;
+
+static void histogram(uint32_t *hist, uint32_t *max_us, uint32_t us)
+{
+  uint32_t bucket = us ? 32 - __builtin_clz(us) : 0;
+  if ( bucket >= LINK_TELEMETRY_LOOP_BUCKETS ) bucket = LINK_TELEMETRY_LOOP_BUCKETS - 1;
+
+  hist[bucket]++;
+  if ( us > *max_us ) *max_us = us;
+}
+
+void link_telemetry_loop(uint32_t iteration_us)
+{
+  histogram(link_telemetry.loop_hist, &link_telemetry.loop_max_us, iteration_us);
+}
+
+void link_telemetry_wake(uint32_t latency_us)
+{
+  histogram(link_telemetry.wake_hist, &link_telemetry.wake_max_us, latency_us);
+}
+
+uint32_t link_telemetry_put(uint8_t *dst, link_telemetry_t const *telemetry)
+{
+  // Every field is a u32
+  uint32_t const *src = (uint32_t const *) telemetry;
+  for ( uint32_t i = 0; i < LINK_TELEMETRY_LEN / sizeof(uint32_t); i++ )
+    link_proto_put_u32(dst + i * sizeof(uint32_t), src[i]);
+
+  return LINK_TELEMETRY_LEN;
+}
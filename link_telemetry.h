@@ -0,0 +1,78 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Free running counters for seeing what the firmware does under load.
+ *
+ * Every field has a single writer, either core 0 (USB side) or core 1 (link
+ * side), and is a plain aligned 32 bit word, so updating one costs a load
+ * and a store and core 0 can read all of them at any time. Nothing is ever
+ * reset; the host diffs two snapshots. Times come from the 1 MHz system
+ * timer, the Cortex-M0+ has no cycle counter.
+ *
+ * Stall counters count the times a side started waiting, not how long it
+ * waited.
+ */
+
+#ifndef LINK_TELEMETRY_H_
+#define LINK_TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Main loop histogram: bucket 0 counts iterations under 1 us, bucket i
+// those of 2^(i-1) us up to 2^i us, the last one everything longer
+#define LINK_TELEMETRY_LOOP_BUCKETS 12
+
+// A chunk going out more than this late, with its data already queued,
+// counts as a pacing overrun
+#define LINK_TELEMETRY_SLACK_US 50
+
+typedef struct
+{
+  // Core 0
+  uint32_t usb_rx_bytes;    // host -> link
+  uint32_t usb_tx_bytes;    // link -> host
+  uint32_t usb_rx_stalls;   // host data left in the endpoint FIFO, link_tx_ring full
+  uint32_t usb_tx_stalls;   // link_rx_ring data held back, endpoint FIFO full
+  uint32_t loop_max_us;
+  uint32_t loop_hist[LINK_TELEMETRY_LOOP_BUCKETS];
+  uint32_t trace_dropped;   // trace records thrown away unread to make room
+
+  // Core 1
+  uint32_t link_tx_bytes;   // clocked out to the Game Boy
+  uint32_t link_rx_bytes;   // clocked in from the Game Boy
+  uint32_t link_stalls;     // exchange held back, link_rx_ring full
+  uint32_t pacing_overruns;
+  uint32_t trace_overflows; // trace records lost to a full link_trace_ring
+  uint32_t adapt_gap_us;    // gap adaptive pacing is using
+  uint32_t adapt_backoffs;  // chunks adaptive pacing found unanswered
+  uint32_t ready_releases;  // chunks the ready line let out before the gap was up
+
+  // Core 0, time from an event being posted to the main loop taking it (see
+  // link_event.h), bucketed like loop_hist
+  uint32_t wake_max_us;
+  uint32_t wake_hist[LINK_TELEMETRY_LOOP_BUCKETS];
+} link_telemetry_t;
+
+#define LINK_TELEMETRY_LEN (sizeof(link_telemetry_t))
+
+extern link_telemetry_t link_telemetry;
+
+// Counts a stall when one starts; *stalled remembers whether the last check
+// found one
+static inline void link_telemetry_stall(uint32_t *counter, bool *stalled, bool now_stalled)
+{
+  if ( now_stalled && !*stalled ) (*counter)++;
+  *stalled = now_stalled;
+}
+
+// Core 0, once per main loop iteration, not counting the time it slept
+void link_telemetry_loop(uint32_t iteration_us);
+
+// Core 0, once per wake-up
+void link_telemetry_wake(uint32_t latency_us);
+
+// Little endian snapshot in field order, returns LINK_TELEMETRY_LEN
+uint32_t link_telemetry_put(uint8_t *dst, link_telemetry_t const *telemetry);
+
+#endif /* LINK_TELEMETRY_H_ */
@@ -0,0 +1,50 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "link_telemetry.h"
+#include "link_trace.h"
+
+spsc_ring_t link_trace_ring;
+
+static alignas(LINK_TRACE_RECORD_LEN) uint8_t trace_buf[LINK_TRACE_SIZE];
+
+void link_trace_init(void)
+{
+  spsc_ring_init(&link_trace_ring, trace_buf, sizeof(trace_buf));
+}
+
+void link_trace_bytes(uint32_t now_us, uint8_t const *out, uint8_t const *in, uint32_t len, uint8_t flags)
+{
+  if ( out ) flags |= LINK_TRACE_OUT;
+  if ( in ) flags |= LINK_TRACE_IN;
+
+  while ( len )
+  {
+    // Only whole records are ever committed, so the contiguous part of
+    // the free space always holds a whole number of them
+    uint8_t *dst;
+    uint32_t n = spsc_ring_reserve(&link_trace_ring, &dst) / LINK_TRACE_RECORD_LEN;
+    if ( !n )
+    {
+      link_telemetry.trace_overflows += len;
+      return;
+    }
+    if ( n > len ) n = len;
+
+    link_trace_record_t *record = (link_trace_record_t *) dst;
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+      record[i].time_us = now_us;
+      record[i].out = out ? out[i] : 0;
+      record[i].in = in ? in[i] : 0;
+      record[i].flags = flags;
+      record[i].reserved = 0;
+    }
+    spsc_ring_commit(&link_trace_ring, n * LINK_TRACE_RECORD_LEN);
+
+    if ( out ) out += n;
+    if ( in ) in += n;
+    len -= n;
+  }
+}
@@ -0,0 +1,65 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Link trace: every byte exchanged with the Game Boy, timestamped.
+ *
+ * Core 1 appends one fixed size record per link byte to link_trace_ring,
+ * core 0 streams the ring to the host over its own vendor interface. It is
+ * always on and uses fixed memory: when the host is not reading, core 0
+ * drops the oldest records to keep room for new ones, so a dump taken after
+ * a desync ends with what led up to it.
+ *
+ * Record, 8 bytes, little endian:
+ *
+ *   time_us(4) out in flags reserved
+ *
+ * time_us is the low 32 bits of the microsecond timer when the byte's DMA
+ * segment completed. flags says which of out/in are valid: a master mode
+ * exchange has both, slave mode records responses and captured bytes
+ * separately since they are not paired up on the device. GBA mode does the
+ * same with the parent's data and the slots it gets back.
+ *
+ * This file has no SDK dependencies, tools/trace2pcap.c uses it to decode
+ * dumps.
+ */
+
+#ifndef LINK_TRACE_H_
+#define LINK_TRACE_H_
+
+#include <stdint.h>
+
+#include "spsc_ring.h"
+
+#define LINK_TRACE_RECORD_LEN 8
+
+// Must be a power of two
+#define LINK_TRACE_SIZE (4096 * LINK_TRACE_RECORD_LEN)
+
+enum
+{
+  LINK_TRACE_OUT    = 0x01, // out is valid
+  LINK_TRACE_IN     = 0x02, // in is valid
+  LINK_TRACE_SLAVE  = 0x04, // the Game Boy drove the clock
+  LINK_TRACE_SCRIPT = 0x08, // sent by a response script
+  LINK_TRACE_GBA    = 0x10  // GBA multiplayer, sends and slots are not paired up
+};
+
+typedef struct
+{
+  uint32_t time_us;
+  uint8_t out;
+  uint8_t in;
+  uint8_t flags;
+  uint8_t reserved;
+} link_trace_record_t;
+
+extern spsc_ring_t link_trace_ring;
+
+void link_trace_init(void);
+
+// Core 1: one record per byte, all stamped now_us. out or in may be NULL
+// for bytes that only went one way. Records that do not fit are counted
+// in link_telemetry.trace_overflows.
+void link_trace_bytes(uint32_t now_us, uint8_t const *out, uint8_t const *in, uint32_t len, uint8_t flags);
+
+#endif /* LINK_TRACE_H_ */
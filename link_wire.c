@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "link_wire.h"
+
+static void frames_shift(uint8_t *buf, uint32_t len, uint32_t n_bits, bool left)
+{
+  uint32_t size = link_wire_size(n_bits);
+  uint32_t shift = 8 * size - n_bits;
+
+  for ( uint32_t i = 0; i + size <= len; i += size )
+  {
+    uint32_t v = 0;
+    for ( uint32_t j = 0; j < size; j++ )
+      v |= (uint32_t) buf[i + j] << (8 * j);
+
+    v = left ? v << shift : v >> shift;
+    for ( uint32_t j = 0; j < size; j++ )
+      buf[i + j] = v >> (8 * j);
+  }
+}
+
+void link_wire_to_fifo(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first)
+{
+  if ( !lsb_first && !link_wire_direct(n_bits) ) frames_shift(buf, len, n_bits, true);
+}
+
+void link_wire_sent(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first)
+{
+  if ( !lsb_first && !link_wire_direct(n_bits) ) frames_shift(buf, len, n_bits, false);
+}
+
+void link_wire_from_fifo(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first)
+{
+  if ( lsb_first && !link_wire_direct(n_bits) ) frames_shift(buf, len, n_bits, false);
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Raw and slave mode frames of 1 to 32 bits between the rings and the PIO
+ * FIFOs.
+ *
+ * In the rings a frame is right-justified in 1, 2 or 4 bytes, little
+ * endian, whichever is the smallest that fits. The DMA moves those 8, 16
+ * or 32 bits to and from the FIFO word whole, but the SM only shifts the
+ * frame's own bits: MSB-first frames go out from the top of the word, and
+ * LSB-first frames come in at its top (see pio/pio_spi.c). A frame that
+ * does not fill its bytes is therefore moved up before it goes out
+ * MSB-first, and down once it has come in LSB-first. 8, 16 and 32 bit
+ * frames need neither.
+ *
+ * This file has no SDK dependencies.
+ */
+
+#ifndef LINK_WIRE_H_
+#define LINK_WIRE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bytes a frame of n_bits takes in the rings
+static inline uint32_t link_wire_size(uint32_t n_bits)
+{
+  return n_bits <= 8 ? 1 : n_bits <= 16 ? 2 : 4;
+}
+
+// Whether frames of n_bits go between the rings and the FIFOs as they are,
+// whatever the order
+static inline bool link_wire_direct(uint32_t n_bits)
+{
+  return n_bits == 8 * link_wire_size(n_bits);
+}
+
+// In place, over the len bytes of whole frames at buf: frames about to be
+// sent into FIFO position, the same frames back to ring order once sent,
+// and received frames from FIFO position into ring order
+void link_wire_to_fifo(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first);
+void link_wire_sent(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first);
+void link_wire_from_fifo(uint8_t *buf, uint32_t len, uint32_t n_bits, bool lsb_first);
+
+#endif /* LINK_WIRE_H_ */
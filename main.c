@@ -35,14 +35,18 @@
 #include "hardware/pio.h"
 #include "pio/pio_spi.h"
 #include "pico/time.h"
+#include "hardware/sync.h"
+#include "link_engine.h"
+#include "link_event.h"
+#include "link_hub.h"
+#include "link_store.h"
+#include "link_telemetry.h"
+#include "link_trace.h"
 
 #define NUM_CMP_BYTES 0x20
 #define NUM_CMP_BYTES_RECV (NUM_CMP_BYTES+4)
 
-#define NUM_DEFAULT_BYTES_PER_TRANSFER 1
-#define US_DEFAULT_PER_TRANSFER 1000
-
-#define MAX_TRANSFER_BYTES 0x40
+#define MAX_TRANSFER_BYTES LINK_MAX_CHUNK
 
 #define PIN_SCK 0
 #define PIN_SIN 1
@@ -69,24 +73,45 @@ bool is_test_pin_grounded() {
 /* Blink pattern
  * - 250 ms  : device not mounted
  * - 1000 ms : device mounted
- * - 2500 ms : device is suspended
+ * - off     : device is suspended
  */
 enum  {
   BLINK_NOT_MOUNTED = 250,
   BLINK_MOUNTED     = 1000,
-  BLINK_SUSPENDED   = 2500,
 
   BLINK_ALWAYS_ON   = UINT32_MAX,
   BLINK_ALWAYS_OFF  = 0
 };
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
-static uint8_t data_buf[MAX_TRANSFER_BYTES];
+// When led_blinking_task() next has something to do
+static absolute_time_t led_due;
 static uint8_t compare_bytes[NUM_CMP_BYTES] = {0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xCA, 0xFE, 0xDE, 0xAD, 0xBE, 0xEF, 0xDE, 0xAD, 0xBE, 0xEF, 0xDE, 0xAD, 0xBE, 0xEF, 0xDE, 0xAD, 0xBE, 0xEF};
-static uint8_t buf_count;
-static uint8_t num_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
-static uint32_t us_between_transfer = US_DEFAULT_PER_TRANSFER;
-static uint32_t total_transferred = 0;
+
+// Set when a config packet has been received but the link core is still
+// busy with data queued before it. The settings it carries wait here, the
+// ones in effect come from link_engine.
+static bool config_pending = false;
+// Set when the boot profile of a new session found the link core's request
+// ring full, applied from data_transfer_task() before any data goes in
+static bool profile_pending = false;
+static uint8_t pending_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+static uint32_t pending_us_between_transfer = US_DEFAULT_PER_TRANSFER;
+static link_mode_t pending_mode = LINK_MODE_RAW;
+static bool pending_ready = false;
+static bool pending_ready_high = true;
+static bool pending_clock = false;
+static uint32_t pending_sck_hz;
+static bool pending_format = false;
+static uint8_t pending_frame_bits;
+static bool pending_lsb_first;
+
+// Legacy in-band config packets are looked for until the host uses the
+// control requests, and again from its next connect
+static bool magic_config = true;
+
+// Data stage of the vendor requests, large enough for any of them
+static uint8_t control_buf[LINK_PROTO_PROFILE_LEN];
 
 #define URL  "tetris.gblink.io"
 
@@ -100,12 +125,27 @@ const tusb_desc_webusb_url_t desc_url =
 
 static bool web_serial_connected = false;
 
+static bool usb_rx_stalled = false;
+static bool usb_tx_stalled = false;
+
+// An interrupt endpoint request waiting for the link to go idle, and one
+// whose replies are at the head of link_rx_ring
+static bool hid_queued = false;
+static bool hid_exchanging = false;
+static uint8_t hid_request[LINK_PROTO_HID_REPORT_LEN];
+
 //------------- prototypes -------------//
+uint8_t* link_input_buffer(uint32_t available, uint8_t* bounce, uint32_t* len);
 void handle_input_data(uint8_t* buf_in, uint32_t count);
 void data_transfer_task(void);
 void led_blinking_task(void);
 void cdc_task(void);
 void webserial_task(void);
+void trace_task(void);
+void hid_task(void);
+void profile_load(link_profile_t const *profile);
+bool config_load(link_config_t const *config, bool ready);
+bool config_apply(void);
 
 /*------------- MAIN -------------*/
 
@@ -114,9 +154,32 @@ void webserial_task(void);
           .sm = 0
   };
 
+  // Same pins as spi, for when the Game Boy drives the clock
+  pio_spi_inst_t spi_slave = {
+          .pio = pio1,
+          .sm = 1
+  };
+
+  // GBA multiplayer parent, takes SCK, SOUT and SI_PIN over as SC, SO and SD
+  pio_gba_inst_t gba = {
+          .pio = pio0,
+          .sm = 0
+  };
+
+
+// A profile's own pin, unless it leaves it to TEST_PIN or names one of the
+// fixed ones
+uint profile_pin(uint8_t pin, uint strap) {
+  if(pin == LINK_PROFILE_PIN_STRAP || pin == PIN_SCK || pin == PIN_SIN || pin == TEST_PIN)
+    return strap;
+  return pin;
+}
 
 int main(void)
 {
+  link_store_init();
+  link_profile_t const *boot = link_store_profile(link_store_boot());
+
   // Check the state of TEST_PIN
   if (is_test_pin_grounded()) {
     // GPIO 6 (TEST_PIN) is grounded, update PIN_SOUT and SI_PIN
@@ -128,21 +191,52 @@ int main(void)
     PIN_SOUT = 2;
     SI_PIN = 3;
   }
+  PIN_SOUT = profile_pin(boot->pin_sout, PIN_SOUT);
+  SI_PIN = profile_pin(boot->pin_si, SI_PIN);
 
   //board_init();
-  buf_count = 0;
   uint cpha1_prog_offs = pio_add_program(spi.pio, &spi_cpha1_program);
-  pio_spi_init(spi.pio, spi.sm, cpha1_prog_offs, 8, 4058.838/128, 1, 1, PIN_SCK, PIN_SOUT, PIN_SIN);
+  pio_spi_init(spi.pio, spi.sm, cpha1_prog_offs, 8, LINK_DEFAULT_CLKDIV, 1, 1, PIN_SCK, PIN_SOUT, PIN_SIN);
+  pio_spi_dma_init(&spi);
+  uint slave_prog_offs = pio_add_program(spi_slave.pio, &spi_slave_program);
+  pio_spi_slave_init(spi_slave.pio, spi_slave.sm, slave_prog_offs, LINK_SLAVE_IDLE, PIN_SCK, PIN_SOUT, PIN_SIN);
+  pio_spi_dma_init(&spi_slave);
+  uint gba_prog_offs = pio_add_program(gba.pio, &gba_multi_program);
+  pio_gba_init(&gba, gba_prog_offs, LINK_GBA_BAUD, LINK_GBA_TIMEOUT_BITS, PIN_SCK, SI_PIN, PIN_SOUT);
+  link_engine_set_ready_pin(SI_PIN);
+  profile_load(boot);
+  config_apply();
+  // Extra link ports on the SMs left over on pio1, their pins stay free
+  // until the host turns a port on
+  link_hub_init(spi.pio, 2, cpha1_prog_offs);
+  link_engine_start(&spi, &spi_slave, &gba);
 
   tusb_init();
 
   while (1)
   {
+    // Sleep until an interrupt or core 1 has work for us, or the LED is due.
+    // Every task below leaves work undone only while it waits on one of
+    // those.
+    while ( !link_event_pending() && !tud_task_event_ready() && !time_reached(led_due) )
+      best_effort_wfe_or_timeout(led_due);
+
+    uint32_t loop_start = time_us_32();
+    uint32_t waited;
+    if ( link_event_take(loop_start, &waited) )
+      link_telemetry_wake(waited);
+
     tud_task(); // tinyusb device task
+#if CFG_TUD_HID
+    hid_task();
+#endif
     data_transfer_task();
     cdc_task();
     webserial_task();
+    trace_task();
     led_blinking_task();
+
+    link_telemetry_loop(time_us_32() - loop_start);
   }
 
   return 0;
@@ -166,7 +260,7 @@ int oldmain(void)
 }
 
 // send characters to both CDC and WebUSB
-void echo_all(uint8_t buf[], uint32_t count)
+void echo_all(uint8_t const buf[], uint32_t count)
 {
   // echo to web serial
   if ( web_serial_connected )
@@ -178,10 +272,7 @@ void echo_all(uint8_t buf[], uint32_t count)
   // echo to cdc
   if ( tud_cdc_connected() )
   {
-    for(uint32_t i=0; i<count; i++)
-    {
-      tud_cdc_write_char(buf[i]);
-    }
+    tud_cdc_write(buf, count);
     tud_cdc_write_flush();
   }
 }
@@ -208,13 +299,27 @@ void tud_umount_cb(void)
 void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void) remote_wakeup_en;
-  blink_interval_ms = BLINK_SUSPENDED;
+  // Both cores sleep until the bus resumes, with the LED off
+  board_led_write(false);
+  blink_interval_ms = BLINK_ALWAYS_OFF;
+  link_engine_set_suspended(true);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
   blink_interval_ms = BLINK_MOUNTED;
+  link_engine_set_suspended(false);
+}
+
+// Invoked by the USB interrupt for every event it queues for tud_task()
+void tud_event_hook_cb(uint8_t rhport, uint32_t eventid, bool in_isr)
+{
+  (void) rhport;
+  (void) eventid;
+  (void) in_isr;
+  link_event_post(LINK_EVENT_USB, time_us_32());
+  __sev();
 }
 
 //--------------------------------------------------------------------+
@@ -224,8 +329,44 @@ void tud_resume_cb(void)
 // Invoked when a control transfer occurred on an interface of this class
 // Driver response accordingly to the request and the transfer stage (setup/data/ack)
 // return false to stall control endpoint (e.g unsupported request)
+//
+// Link control requests, none of which touch the data path: settings
+// change at the next chunk or burst, whatever is queued.
+// - STATS     IN: link_telemetry_t snapshot
+// - PROFILE   wValue is the profile. IN reads it, OUT with a profile writes
+//             it, OUT without one switches to it and, with wIndex set, also
+//             boots with it from then on. Flash is written later, once
+//             the link is idle.
+// - CONFIGURE IN reads, OUT sets a link_config_t, as the CONFIGURE frame.
+//             LINK_PROTO_READY_LINE in its bytes_per_transfer turns the
+//             ready line on.
+// - RESET     back to the boot profile
 bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
 {
+  // Writes only have their payload once the data stage is in
+  if (stage == CONTROL_STAGE_DATA && request->bmRequestType_bit.direction == TUSB_DIR_OUT)
+  {
+    switch (request->bRequest)
+    {
+      case VENDOR_REQUEST_PROFILE:
+      {
+        link_profile_t profile;
+        link_proto_get_profile(control_buf, &profile);
+        return link_store_set_profile(request->wValue, &profile);
+      }
+
+      case VENDOR_REQUEST_CONFIGURE:
+      {
+        link_config_t config;
+        bool ready;
+        if ( !link_proto_parse_config(control_buf, &config, &ready) ) return false;
+        return config_load(&config, ready);
+      }
+
+      default: return true;
+    }
+  }
+
   // nothing to do for DATA & ACK stage
   if (stage != CONTROL_STAGE_SETUP) return true;
 
@@ -248,13 +389,66 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
       {
         return false;
       }
+    case VENDOR_REQUEST_STATS:
+    {
+      // Snapshot, the counters keep moving while the data stage goes out
+      static uint8_t telemetry[LINK_TELEMETRY_LEN];
+      uint16_t len = link_telemetry_put(telemetry, &link_telemetry);
+      return tud_control_xfer(rhport, request, telemetry, len);
+    }
+
+    case VENDOR_REQUEST_PROFILE:
+    {
+      link_profile_t const *stored = link_store_profile(request->wValue);
+      if ( !stored ) return false;
+      magic_config = false;
+
+      if ( request->bmRequestType_bit.direction == TUSB_DIR_IN )
+      {
+        uint16_t len = link_proto_put_profile(control_buf, stored);
+        return tud_control_xfer(rhport, request, control_buf, len);
+      }
+      if ( request->wLength == LINK_PROTO_PROFILE_LEN )
+        return tud_control_xfer(rhport, request, control_buf, LINK_PROTO_PROFILE_LEN);
+      if ( request->wLength ) return false;
+
+      if ( request->wIndex ) link_store_set_boot(request->wValue);
+      profile_load(stored);
+      if ( !config_apply() ) return false;
+      return tud_control_status(rhport, request);
+    }
+
+    case VENDOR_REQUEST_CONFIGURE:
+    {
+      magic_config = false;
+      if ( request->bmRequestType_bit.direction == TUSB_DIR_IN )
+      {
+        link_config_t config = {
+          .us_between_transfer = link_engine_us_between_transfer(),
+          .bytes_per_transfer = link_engine_bytes_per_transfer() | (link_engine_ready() ? LINK_PROTO_READY_LINE : 0),
+          .mode = link_engine_mode()
+        };
+        uint16_t len = link_proto_put_config(control_buf, &config);
+        return tud_control_xfer(rhport, request, control_buf, len);
+      }
+      if ( request->wLength != LINK_PROTO_CONFIG_LEN ) return false;
+      return tud_control_xfer(rhport, request, control_buf, LINK_PROTO_CONFIG_LEN);
+    }
+
+    case VENDOR_REQUEST_RESET:
+      magic_config = false;
+      profile_load(link_store_profile(link_store_boot()));
+      if ( !config_apply() ) return false;
+      return tud_control_status(rhport, request);
+
     case 0x22:
       // Webserial simulate the CDC_REQUEST_SET_CONTROL_LINE_STATE (0x22) to connect and disconnect.
       web_serial_connected = (request->wValue != 0);
-      
-      total_transferred = 0;
-      num_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
-      us_between_transfer = US_DEFAULT_PER_TRANSFER;
+
+      // Every session starts out with the boot profile
+      profile_load(link_store_profile(link_store_boot()));
+      profile_pending = !config_apply();
+      magic_config = true;
 
       // Always lit LED if connected
       if ( web_serial_connected )
@@ -289,67 +483,311 @@ bool tud_vendor_control_complete_cb(uint8_t rhport, tusb_control_request_t const
   return true;
 }
 
+// Send what the link core got back from the Game Boy to the host, and apply
+// a pending config packet or save profile changes once everything queued
+// before them is done.
 void data_transfer_task(void) {
-    //if(buf_count) {
-        //uint8_t buf_out[MAX_TRANSFER_BYTES];
-    //    for(int i = 0; i < (buf_count+3) >> 2; i++) {
-    //        pio_spi_write8_blocking(&spi, data_buf+(4*i), 4);
-    //        busy_wait_us(36);
-    //    }
-        //pio_spi_write8_read8_blocking(&spi, data_buf, buf_out, buf_count);
-        //echo_all(buf_out, buf_count);
-    //    buf_count = 0;
-    //}
+  // Each request sets a value outright, so the whole profile can go again
+  if(profile_pending)
+    profile_pending = !config_apply();
+
+  // Write straight out of the ring into the endpoint FIFOs, but only as much
+  // as every connected interface can take so none of them gets a short copy.
+  // A second pass picks up the rest when the data wraps around the ring.
+  // The replies to an interrupt endpoint request go back in a report
+  for(int pass = 0; pass < 2 && !hid_exchanging; pass++) {
+    uint8_t const *buf_out;
+    uint32_t ready = spsc_ring_peek(&link_rx_ring, &buf_out);
+    uint32_t count = ready;
+    if(count && web_serial_connected && tud_vendor_write_available() < count)
+      count = tud_vendor_write_available();
+    if(count && tud_cdc_connected() && tud_cdc_write_available() < count)
+      count = tud_cdc_write_available();
+    link_telemetry_stall(&link_telemetry.usb_tx_stalls, &usb_tx_stalled, count < ready);
+    if(!count)
+      break;
+    echo_all(buf_out, count);
+    spsc_ring_consume(&link_rx_ring, count);
+    link_telemetry.usb_tx_bytes += count;
+  }
+
+  if(config_pending && link_engine_idle() && spsc_ring_empty(&link_rx_ring) && config_apply()) {
+    config_pending = false;
+    uint8_t processed = 1;
+    echo_all(&processed, 1);
+  }
+
+  // Writing flash stops the link for a millisecond or more, so wait for a
+  // quiet moment rather than cut into a burst
+  if(link_store_dirty() && link_engine_idle() && spsc_ring_empty(&link_rx_ring))
+    link_store_save();
+}
+
+// Take a profile's settings as the pending ones
+void profile_load(link_profile_t const *profile) {
+  pending_bytes_per_transfer = profile->bytes_per_transfer;
+  pending_us_between_transfer = profile->us_between_transfer;
+  pending_mode = profile->mode;
+  pending_ready = profile->flags & LINK_PROFILE_READY_LINE;
+  pending_ready_high = !(profile->flags & LINK_PROFILE_ACTIVE_LOW);
+  pending_clock = true;
+  pending_sck_hz = profile->sck_hz;
+  pending_format = true;
+  pending_frame_bits = profile->frame_bits;
+  pending_lsb_first = profile->flags & LINK_PROFILE_LSB_FIRST;
+}
+
+// Take the settings of a CONFIGURE request, as link_proto_parse_config()
+// gives them, as the pending ones and apply them. Returns false if the
+// link core has too many requests waiting.
+bool config_load(link_config_t const *config, bool ready) {
+  pending_bytes_per_transfer = config->bytes_per_transfer;
+  if(pending_bytes_per_transfer > MAX_TRANSFER_BYTES)
+    pending_bytes_per_transfer = MAX_TRANSFER_BYTES;
+  if(pending_bytes_per_transfer == 0)
+    pending_bytes_per_transfer = 1;
+  pending_us_between_transfer = config->us_between_transfer;
+  pending_mode = config->mode;
+  pending_ready = ready;
+  pending_ready_high = true;
+  pending_clock = false;
+  pending_format = false;
+  return config_apply();
+}
+
+// Hand the pending settings to the link core, false if it could not take
+// them all. Each request sets a value outright, so it is safe to try again.
+bool config_apply(void) {
+  bool ok = link_engine_configure(pending_bytes_per_transfer, pending_us_between_transfer);
+  ok &= link_engine_set_mode(pending_mode);
+  ok &= link_engine_set_ready(pending_ready, pending_ready_high);
+  if(pending_clock)
+    ok &= link_engine_set_clock(pending_sck_hz);
+  if(pending_format)
+    ok &= link_engine_set_format(pending_frame_bits, pending_lsb_first);
+  return ok;
+}
+
+// Where the next USB read should go. Normally that is straight into
+// link_tx_ring; only when the free space wraps around the end of the ring
+// does the read go through the caller's bounce buffer, so a config packet
+// is never split. Leaves room to pad the last chunk.
+uint8_t* link_input_buffer(uint32_t available, uint8_t* bounce, uint32_t* len) {
+  *len = 0;
+  if(config_pending || profile_pending)
+    return bounce;
+  uint8_t chunk = link_engine_bytes_per_transfer();
+
+  uint32_t space = spsc_ring_free(&link_tx_ring);
+  link_telemetry_stall(&link_telemetry.usb_rx_stalls, &usb_rx_stalled, space < chunk);
+  if(space < chunk)
+    return bounce;
+  space -= chunk - 1;
+  // A read cut short ends on a chunk boundary, so only the host's own last
+  // chunk ever gets padded
+  if(available > space)
+    available = space - space % chunk;
+
+  uint8_t* buf_in;
+  if(spsc_ring_reserve(&link_tx_ring, &buf_in) >= available) {
+    *len = available;
+    return buf_in;
+  }
+
+  *len = available;
+  if(*len > MAX_TRANSFER_BYTES*2)
+    *len = MAX_TRANSFER_BYTES*2 - (MAX_TRANSFER_BYTES*2) % chunk;
+  return bounce;
 }
 
 void handle_input_data(uint8_t* buf_in, uint32_t count) {
-  for(int i = count; i < (MAX_TRANSFER_BYTES*2); i++)
-    buf_in[i] = 0;
-  uint8_t processed = 0;
-  if(count == NUM_CMP_BYTES_RECV) {
-    uint8_t failed = 0;
-    for(int i = 0; i < NUM_CMP_BYTES; i++)
-      if(buf_in[i] != compare_bytes[i]) {
-        failed = 1;
-        break;
-      }
-    if(!failed) {
-      us_between_transfer = (buf_in[NUM_CMP_BYTES]<<0) + (buf_in[NUM_CMP_BYTES+1]<<8) + (buf_in[NUM_CMP_BYTES+2]<<16);
-      num_bytes_per_transfer = buf_in[NUM_CMP_BYTES+3];
-      if(num_bytes_per_transfer > MAX_TRANSFER_BYTES)
-        num_bytes_per_transfer = MAX_TRANSFER_BYTES;
-      processed = 1;
-      echo_all(&processed, 1);
+  static uint8_t const padding[MAX_TRANSFER_BYTES] = { 0 };
+
+  // In framed mode the link core parses everything, just pass it on
+  link_mode_t mode = link_engine_mode();
+
+  if(magic_config && mode != LINK_MODE_FRAMED && count == NUM_CMP_BYTES_RECV && !memcmp(buf_in, compare_bytes, NUM_CMP_BYTES)) {
+    // Not committed to the ring, so the link core never sees it
+    pending_us_between_transfer = (buf_in[NUM_CMP_BYTES]<<0) + (buf_in[NUM_CMP_BYTES+1]<<8) + (buf_in[NUM_CMP_BYTES+2]<<16);
+    pending_bytes_per_transfer = buf_in[NUM_CMP_BYTES+3];
+    pending_mode = LINK_MODE_RAW;
+    pending_ready = false;
+    pending_ready_high = true;
+    pending_clock = false;
+    pending_format = false;
+    if(pending_bytes_per_transfer == LINK_PROTO_ENTER_FRAMED) {
+      pending_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+      pending_mode = LINK_MODE_FRAMED;
     }
-  }
-  if(!processed) {
-    // pprintf("Sending: %02x", buf[0]);
-    uint8_t total_processed = 0;
-    uint8_t buf_out[MAX_TRANSFER_BYTES*2];
-    while(total_processed < count) {
-      uint8_t transferable = num_bytes_per_transfer;
-      //if(count-total_processed < transferable)
-        //transferable = count-total_processed;
-      pio_spi_write8_read8_blocking(&spi, buf_in + total_processed, buf_out + total_processed, transferable);
-      total_transferred += transferable;
-      total_processed += transferable;
-      busy_wait_us(us_between_transfer);
+    else if(pending_bytes_per_transfer == LINK_PROTO_ENTER_SLAVE) {
+      pending_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+      pending_mode = LINK_MODE_SLAVE;
+    }
+    else if(pending_bytes_per_transfer == LINK_PROTO_ENTER_GBA) {
+      // One packet per chunk, padded out like raw mode chunks
+      pending_bytes_per_transfer = LINK_GBA_SEND_LEN;
+      pending_mode = LINK_MODE_GBA;
     }
-    echo_all(buf_out, total_processed);
-    //echo_all(&availables, 1);
+    else if(pending_bytes_per_transfer == LINK_PROTO_ENTER_PRINTER) {
+      pending_bytes_per_transfer = NUM_DEFAULT_BYTES_PER_TRANSFER;
+      pending_mode = LINK_MODE_PRINTER;
+    }
+    else if(pending_bytes_per_transfer & LINK_PROTO_READY_LINE) {
+      pending_bytes_per_transfer &= ~LINK_PROTO_READY_LINE;
+      pending_ready = true;
+    }
+    if(pending_bytes_per_transfer > MAX_TRANSFER_BYTES)
+      pending_bytes_per_transfer = MAX_TRANSFER_BYTES;
+    if(pending_bytes_per_transfer == 0)
+      pending_bytes_per_transfer = 1;
+    config_pending = true;
+    return;
   }
+
+  if(!count)
+    return;
+  link_telemetry.usb_rx_bytes += count;
+
+  uint8_t* reserved;
+  spsc_ring_reserve(&link_tx_ring, &reserved);
+  if(buf_in == reserved)
+    link_engine_commit(count);
+  else
+    link_engine_submit(buf_in, count);
+
+  // Pad the last chunk with zeroes, link_input_buffer() left room for it.
+  // Slave responses go out one byte per clocked byte, no chunks to fill.
+  uint8_t chunk = link_engine_bytes_per_transfer();
+  uint32_t partial = count % chunk;
+  if(partial && (mode == LINK_MODE_RAW || mode == LINK_MODE_GBA))
+    link_engine_submit(padding, chunk - partial);
 }
 
 void webserial_task(void)
 {
   if ( web_serial_connected )
-    if ( tud_vendor_available() ) {
-      uint8_t buf_in[MAX_TRANSFER_BYTES*2];
-      uint32_t count = tud_vendor_read(buf_in, sizeof(buf_in));
+    // Drain everything the FIFO holds in one pass, while the link queue has room
+    while ( tud_vendor_available() ) {
+      uint8_t bounce[MAX_TRANSFER_BYTES*2];
+      uint32_t len;
+      uint8_t* buf_in = link_input_buffer(tud_vendor_available(), bounce, &len);
+      // Leave new data in the FIFO until the link core can take it
+      if ( !len ) return;
+      uint32_t count = tud_vendor_read(buf_in, len);
       handle_input_data(buf_in, count);
     }
 }
 
+// Stream the link trace out of its own interface. Whatever the host is not
+// reading gets dropped from the old end, so recording never has to stop.
+void trace_task(void)
+{
+  uint8_t const *buf;
+  uint32_t count = spsc_ring_peek(&link_trace_ring, &buf);
+  uint32_t room = tud_vendor_n_write_available(VENDOR_INSTANCE_TRACE);
+  if ( count > room ) count = room;
+  count -= count % LINK_TRACE_RECORD_LEN;
+  if ( count )
+  {
+    tud_vendor_n_write(VENDOR_INSTANCE_TRACE, buf, count);
+    tud_vendor_n_flush(VENDOR_INSTANCE_TRACE);
+    spsc_ring_consume(&link_trace_ring, count);
+  }
+
+  // Whole records go in and out, so this stays a whole number of them
+  uint32_t used = spsc_ring_available(&link_trace_ring);
+  if ( used > LINK_TRACE_SIZE / 4 * 3 )
+  {
+    uint32_t drop = used - LINK_TRACE_SIZE / 4 * 3;
+    spsc_ring_consume(&link_trace_ring, drop);
+    link_telemetry.trace_dropped += drop / LINK_TRACE_RECORD_LEN;
+  }
+}
+
+//--------------------------------------------------------------------+
+// USB HID, interrupt endpoint exchanges
+//--------------------------------------------------------------------+
+#if CFG_TUD_HID
+TU_VERIFY_STATIC(CFG_TUD_HID_EP_BUFSIZE == LINK_PROTO_HID_REPORT_LEN, "One report per packet");
+
+// Exchange a request once everything queued before it is out and its
+// replies passed on, so the link is all its own for the burst, and answer
+// it as soon as the last reply byte is in. Outside raw mode, or with a
+// config change pending, it is answered without being exchanged.
+void hid_task(void)
+{
+  uint8_t report[LINK_PROTO_HID_REPORT_LEN] = { hid_request[0] };
+  uint8_t len = hid_request[1];
+
+  if ( hid_queued )
+  {
+    if ( link_engine_mode() != LINK_MODE_RAW || config_pending || profile_pending )
+    {
+      if ( tud_hid_ready() ) {
+        tud_hid_report(0, report, sizeof(report));
+        hid_queued = false;
+      }
+      return;
+    }
+    if ( !link_engine_idle() || !spsc_ring_empty(&link_rx_ring) || spsc_ring_free(&link_tx_ring) < len )
+      return;
+
+    link_engine_submit(&hid_request[2], len);
+    link_telemetry.usb_rx_bytes += len;
+    hid_queued = false;
+    hid_exchanging = true;
+  }
+
+  if ( hid_exchanging && spsc_ring_available(&link_rx_ring) >= len )
+  {
+    // Replies to a host that has gone away are dropped
+    if ( !tud_hid_ready() && tud_mounted() )
+      return;
+
+    report[1] = len;
+    spsc_ring_pop(&link_rx_ring, &report[2], len);
+    if ( tud_mounted() ) {
+      tud_hid_report(0, report, sizeof(report));
+      link_telemetry.usb_tx_bytes += len;
+    }
+    hid_exchanging = false;
+  }
+}
+
+// Invoked when received GET_REPORT control request, the replies only come
+// on the IN endpoint
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
+{
+  (void) instance;
+  (void) report_id;
+  (void) report_type;
+  (void) buffer;
+  (void) reqlen;
+
+  return 0;
+}
+
+// Invoked when received SET_REPORT control request or
+// received data on OUT endpoint ( Report ID = 0, Type = 0 )
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
+{
+  (void) instance;
+  (void) report_id;
+  (void) report_type;
+
+  // One request at a time
+  if ( hid_queued || hid_exchanging || bufsize < 2 )
+    return;
+
+  if ( bufsize > sizeof(hid_request) )
+    bufsize = sizeof(hid_request);
+  memset(hid_request, 0, sizeof(hid_request));
+  memcpy(hid_request, buffer, bufsize);
+  if ( hid_request[1] > bufsize - 2 )
+    hid_request[1] = bufsize - 2;
+  hid_queued = true;
+}
+#endif
 
 //--------------------------------------------------------------------+
 // USB CDC
@@ -357,10 +795,14 @@ void webserial_task(void)
 void cdc_task(void)
 {
   if ( tud_cdc_connected() )
-    // connected and there are data available
-    if ( tud_cdc_available() ) {
-      uint8_t buf_in[MAX_TRANSFER_BYTES*2];
-      uint32_t count = tud_cdc_read((uint8_t*)buf_in, sizeof(buf_in));
+    // Drain everything the FIFO holds in one pass, while the link queue has room
+    while ( tud_cdc_available() ) {
+      uint8_t bounce[MAX_TRANSFER_BYTES*2];
+      uint32_t len;
+      uint8_t* buf_in = link_input_buffer(tud_cdc_available(), bounce, &len);
+      // Leave new data in the FIFO until the link core can take it
+      if ( !len ) return;
+      uint32_t count = tud_cdc_read(buf_in, len);
       handle_input_data(buf_in, count);
     }
 }
@@ -373,6 +815,8 @@ void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
   // connected
   if ( dtr && rts )
   {
+    magic_config = true;
+
     // print initial message when connected
     // tud_cdc_write_str("\r\nTinyUSB WebUSB device example\r\n");
   }
@@ -392,10 +836,23 @@ void led_blinking_task(void)
   static uint32_t start_ms = 0;
   static bool led_state = false;
 
+  // Nothing to blink until the interval changes, which takes an event
+  if ( blink_interval_ms == BLINK_ALWAYS_ON || blink_interval_ms == BLINK_ALWAYS_OFF )
+  {
+    led_due = at_the_end_of_time;
+    return;
+  }
+
   // Blink every interval ms
-  if ( board_millis() - start_ms < blink_interval_ms) return; // not enough time
-  start_ms += blink_interval_ms;
+  uint32_t elapsed = board_millis() - start_ms;
+  if ( elapsed >= blink_interval_ms )
+  {
+    start_ms = board_millis();
+    elapsed = 0;
+
+    board_led_write(led_state);
+    led_state = 1 - led_state; // toggle
+  }
 
-  board_led_write(led_state);
-  led_state = 1 - led_state; // toggle
+  led_due = make_timeout_time_ms(blink_interval_ms - elapsed);
 }
@@ -0,0 +1,81 @@
+/**
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include "hardware/gpio.h"
+#include "hardware/structs/iobank0.h"
+#include "hardware/structs/padsbank0.h"
+
+#include "pio_gba.h"
+
+void pio_gba_init(pio_gba_inst_t *gba, uint prog_offs, uint baud, uint timeout_bits,
+                  uint pin_sc, uint pin_sd, uint pin_so) {
+    gba_multi_program_init(gba->pio, gba->sm, prog_offs, baud, timeout_bits, pin_sc, pin_sd, pin_so);
+    gba->pins[0] = pin_sc;
+    gba->pins[1] = pin_sd;
+    gba->pins[2] = pin_so;
+
+    gba->dma_tx = dma_claim_unused_channel(true);
+    gba->dma_rx = dma_claim_unused_channel(true);
+
+    // TX: 16 bit writes are halfword-replicated, which the program relies on
+    // for the parent's own slot
+    dma_channel_config c = dma_channel_get_default_config(gba->dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(gba->pio, gba->sm, true));
+    dma_channel_configure(gba->dma_tx, &c, &gba->pio->txf[gba->sm], NULL, 0, false);
+
+    // RX: the data is shifted in from the top, read the upper halfword
+    c = dma_channel_get_default_config(gba->dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(gba->pio, gba->sm, false));
+    dma_channel_configure(gba->dma_rx, &c, NULL, (const volatile uint8_t *) &gba->pio->rxf[gba->sm] + 2, 0, false);
+}
+
+void pio_gba_start(pio_gba_inst_t *gba) {
+    for (uint i = 0; i < PIO_GBA_PINS; i++) {
+        uint pin = gba->pins[i];
+        gba->saved_ctrl[i] = io_bank0_hw->io[pin].ctrl;
+        gba->saved_pad[i] = padsbank0_hw->io[pin];
+        pio_gpio_init(gba->pio, pin);
+        gpio_set_outover(pin, GPIO_OVERRIDE_NORMAL);
+    }
+    // SD idles high with nobody driving it
+    gpio_pull_up(gba->pins[1]);
+
+    // Start from the top of the program with nothing half shifted, Y (the
+    // timeout) survives this
+    uint start = (gba->pio->sm[gba->sm].execctrl & PIO_SM0_EXECCTRL_WRAP_BOTTOM_BITS) >> PIO_SM0_EXECCTRL_WRAP_BOTTOM_LSB;
+    pio_sm_clear_fifos(gba->pio, gba->sm);
+    pio_sm_restart(gba->pio, gba->sm);
+    pio_sm_exec(gba->pio, gba->sm, pio_encode_jmp(start) | pio_encode_sideset(1, 1));
+    pio_sm_set_enabled(gba->pio, gba->sm, true);
+}
+
+void pio_gba_stop(pio_gba_inst_t *gba) {
+    pio_sm_set_enabled(gba->pio, gba->sm, false);
+
+    for (uint i = 0; i < PIO_GBA_PINS; i++) {
+        uint pin = gba->pins[i];
+        io_bank0_hw->io[pin].ctrl = gba->saved_ctrl[i];
+        padsbank0_hw->io[pin] = gba->saved_pad[i];
+    }
+}
+
+void __time_critical_func(pio_gba_dma_start)(const pio_gba_inst_t *gba, const uint16_t *src, uint16_t *dst,
+                                             size_t packets) {
+    dma_channel_set_write_addr(gba->dma_rx, dst, false);
+    dma_channel_set_trans_count(gba->dma_rx, packets * PIO_GBA_SLOTS, false);
+    dma_channel_set_read_addr(gba->dma_tx, src, false);
+    dma_channel_set_trans_count(gba->dma_tx, packets, false);
+    dma_start_channel_mask((1u << gba->dma_rx) | (1u << gba->dma_tx));
+}
+
+bool __time_critical_func(pio_gba_dma_poll)(const pio_gba_inst_t *gba) {
+    // The last slot of the last packet is pushed as its transfer ends
+    return !dma_channel_is_busy(gba->dma_rx);
+}
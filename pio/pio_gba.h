@@ -0,0 +1,50 @@
+/**
+ * SPDX-License-Identifier: GPL-3.0
+ */
+#ifndef _PIO_GBA_H
+#define _PIO_GBA_H
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "gba_multi.pio.h"
+
+// Parent and three children
+#define PIO_GBA_SLOTS 4
+
+#define PIO_GBA_PINS 3
+
+typedef struct pio_gba_inst {
+    PIO pio;
+    uint sm;
+    // DMA channels claimed by pio_gba_init()
+    int dma_tx;
+    int dma_rx;
+    // SC, SD, SO, and how they were set up before pio_gba_start()
+    uint pins[PIO_GBA_PINS];
+    uint32_t saved_ctrl[PIO_GBA_PINS];
+    uint32_t saved_pad[PIO_GBA_PINS];
+} pio_gba_inst_t;
+
+// prog_offs is where gba_multi_program was added. The SM is left disabled
+// and the pins untouched, so they can be shared with another link driver.
+// timeout_bits is how long, in bit times, a child slot is waited for before
+// it reads as 0xFFFF.
+void pio_gba_init(pio_gba_inst_t *gba, uint prog_offs, uint baud, uint timeout_bits,
+                  uint pin_sc, uint pin_sd, uint pin_so);
+
+// pio_gba_start() takes the pins over from whatever drives them and starts
+// the SM, pio_gba_stop() stops it and hands the pins back as they were.
+// Both expect no DMA transfer in flight.
+void pio_gba_start(pio_gba_inst_t *gba);
+
+void pio_gba_stop(pio_gba_inst_t *gba);
+
+// DMA-driven multiplayer transfers, one per packet: src[i] goes out as the
+// parent's data, dst[PIO_GBA_SLOTS * i ...] gets what every slot held,
+// parent first. Both must be halfword aligned and stay valid until
+// pio_gba_dma_poll() returns true.
+void pio_gba_dma_start(const pio_gba_inst_t *gba, const uint16_t *src, uint16_t *dst, size_t packets);
+
+bool pio_gba_dma_poll(const pio_gba_inst_t *gba);
+
+#endif
@@ -4,16 +4,26 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+
 #include "pio_spi.h"
 
-// Just 8 bit functions provided here. The PIO program supports any frame size
-// 1...32, but the software to do the necessary FIFO shuffling is left as an
-// exercise for the reader :)
+// The 8 bit functions below only handle the default 8 bit MSB-first
+// format. The DMA functions move whole 8, 16 or 32 bit FIFO words, which
+// suits frames that fill them in either order.
+//
+// Frames are justified in the FIFO word according to the shift direction:
+// MSB-first shifts out from bit 31 and in at bit 0, LSB-first the other way
+// round. Narrow FIFO writes are replicated across the word, so 8 and 16 bit
+// frames need no shifting on the way out in either order. On the way in
+// LSB-first frames end up at the top of the word, a narrow read at a 3 byte
+// or one halfword offset picks them up for 8 and 16 bits.
 //
-// Likewise we only provide MSB-first here. To do LSB-first, you need to
-// - Do shifts when reading from the FIFO, for general case n != 8, 16, 32
-// - Do a narrow read at a one halfword or 3 byte offset for n == 16, 8
-// in order to get the read data correctly justified. 
+// Any other width sits in the top bits of its byte, halfword or word where
+// the SM meets it: MSB-first frames have to be written there, and
+// LSB-first ones are read back from there. The caller moves them, see
+// link_wire.h.
 
 void __time_critical_func(pio_spi_write8_blocking)(const pio_spi_inst_t *spi, const uint8_t *src, size_t len) {
     size_t tx_remain = len, rx_remain = len;
@@ -66,3 +76,238 @@ void __time_critical_func(pio_spi_write8_read8_blocking)(const pio_spi_inst_t *s
     }
 }
 
+static enum dma_channel_transfer_size pio_spi_dma_size(const pio_spi_inst_t *spi) {
+    size_t size = pio_spi_frame_size(spi);
+    return size == 1 ? DMA_SIZE_8 : size == 2 ? DMA_SIZE_16 : DMA_SIZE_32;
+}
+
+static const volatile void *pio_spi_rx_fifo(const pio_spi_inst_t *spi) {
+    const volatile uint8_t *rxf = (const volatile uint8_t *) &spi->pio->rxf[spi->sm];
+    return spi->lsb_first ? rxf + 4 - pio_spi_frame_size(spi) : rxf;
+}
+
+static dma_channel_config pio_spi_dma_tx_config(const pio_spi_inst_t *spi) {
+    // TX: memory -> FIFO, paced by the SM's TX DREQ. 8 bit writes are
+    // byte-replicated by the bus fabric, same trick as the blocking version.
+    dma_channel_config c = dma_channel_get_default_config(spi->dma_tx);
+    channel_config_set_transfer_data_size(&c, pio_spi_dma_size(spi));
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, true));
+    return c;
+}
+
+static dma_channel_config pio_spi_dma_rx_config(const pio_spi_inst_t *spi) {
+    // RX: FIFO -> memory, paced by the SM's RX DREQ. A narrow read at the
+    // right offset picks up the frame, see pio_spi_rx_fifo().
+    dma_channel_config c = dma_channel_get_default_config(spi->dma_rx);
+    channel_config_set_transfer_data_size(&c, pio_spi_dma_size(spi));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, false));
+    return c;
+}
+
+void pio_spi_dma_init(pio_spi_inst_t *spi) {
+    spi->dma_tx = dma_claim_unused_channel(true);
+    spi->dma_rx = dma_claim_unused_channel(true);
+
+    dma_channel_config c = pio_spi_dma_tx_config(spi);
+    dma_channel_configure(spi->dma_tx, &c, &spi->pio->txf[spi->sm], NULL, 0, false);
+
+    c = pio_spi_dma_rx_config(spi);
+    dma_channel_configure(spi->dma_rx, &c, NULL, pio_spi_rx_fifo(spi), 0, false);
+}
+
+void __time_critical_func(pio_spi_dma_start)(const pio_spi_inst_t *spi, const uint8_t *src, uint8_t *dst,
+                                             size_t len) {
+    dma_channel_set_write_addr(spi->dma_rx, dst, false);
+    dma_channel_set_trans_count(spi->dma_rx, len, false);
+    dma_channel_set_read_addr(spi->dma_tx, src, false);
+    dma_channel_set_trans_count(spi->dma_tx, len, false);
+    // Start both together, RX must be armed before the first byte comes back
+    dma_start_channel_mask((1u << spi->dma_rx) | (1u << spi->dma_tx));
+}
+
+bool __time_critical_func(pio_spi_dma_poll)(const pio_spi_inst_t *spi) {
+    // Every TX byte produces exactly one RX byte, so RX finishing last means
+    // the whole exchange is done.
+    return !dma_channel_is_busy(spi->dma_rx);
+}
+
+void __time_critical_func(pio_spi_dma_complete)(const pio_spi_inst_t *spi) {
+    dma_channel_wait_for_finish_blocking(spi->dma_rx);
+}
+
+static void pio_spi_stop_between_transfers(const pio_spi_inst_t *spi) {
+    pio_spi_dma_complete(spi);
+    // Every byte has been clocked in, so the SM is stalled on an empty TX
+    // FIFO with SCK deasserted. Stop it there while the divider changes.
+    pio_sm_set_enabled(spi->pio, spi->sm, false);
+}
+
+void pio_spi_set_clkdiv(const pio_spi_inst_t *spi, float clkdiv) {
+    pio_spi_stop_between_transfers(spi);
+    pio_sm_set_clkdiv(spi->pio, spi->sm, clkdiv);
+    pio_sm_clkdiv_restart(spi->pio, spi->sm);
+    pio_sm_set_enabled(spi->pio, spi->sm, true);
+}
+
+uint32_t pio_spi_set_rate(const pio_spi_inst_t *spi, uint32_t sck_hz) {
+    // Divider in 1/256ths, as the SM's 16.8 fixed point register holds it
+    uint64_t div = ((uint64_t) clock_get_hz(clk_sys) * 256) / ((uint64_t) sck_hz * PIO_SPI_CYCLES_PER_BIT);
+    if (div < 256)
+        div = 256;
+    if (div > 0xffffff)
+        div = 0xffffff;
+
+    pio_spi_stop_between_transfers(spi);
+    pio_sm_set_clkdiv_int_frac(spi->pio, spi->sm, div >> 8, div & 0xff);
+    pio_sm_clkdiv_restart(spi->pio, spi->sm);
+    pio_sm_set_enabled(spi->pio, spi->sm, true);
+
+    return pio_spi_get_rate(spi);
+}
+
+void pio_spi_set_frame(pio_spi_inst_t *spi, uint n_bits, bool lsb_first) {
+    if (n_bits < 1 || n_bits > 32)
+        n_bits = 8;
+
+    // A slave SM waiting for its turn stays disabled
+    bool enabled = spi->pio->ctrl & (1u << (PIO_CTRL_SM_ENABLE_LSB + spi->sm));
+    pio_spi_stop_between_transfers(spi);
+
+    // A threshold of 32 is encoded as 0
+    uint thresh = n_bits & 0x1f;
+    hw_write_masked(&spi->pio->sm[spi->sm].shiftctrl,
+                    (thresh << PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB) |
+                    (thresh << PIO_SM0_SHIFTCTRL_PUSH_THRESH_LSB) |
+                    (lsb_first ? PIO_SM0_SHIFTCTRL_OUT_SHIFTDIR_BITS | PIO_SM0_SHIFTCTRL_IN_SHIFTDIR_BITS : 0),
+                    PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS | PIO_SM0_SHIFTCTRL_PUSH_THRESH_BITS |
+                    PIO_SM0_SHIFTCTRL_OUT_SHIFTDIR_BITS | PIO_SM0_SHIFTCTRL_IN_SHIFTDIR_BITS);
+    spi->n_bits = n_bits;
+    spi->lsb_first = lsb_first;
+
+    dma_channel_config c = pio_spi_dma_tx_config(spi);
+    dma_channel_set_config(spi->dma_tx, &c, false);
+    c = pio_spi_dma_rx_config(spi);
+    dma_channel_set_config(spi->dma_rx, &c, false);
+    dma_channel_set_read_addr(spi->dma_rx, pio_spi_rx_fifo(spi), false);
+
+    // Nothing half shifted in either direction
+    pio_sm_restart(spi->pio, spi->sm);
+    pio_sm_set_enabled(spi->pio, spi->sm, enabled);
+}
+
+uint32_t pio_spi_get_rate(const pio_spi_inst_t *spi) {
+    uint32_t div = spi->pio->sm[spi->sm].clkdiv >> PIO_SM0_CLKDIV_FRAC_LSB;
+    return ((uint64_t) clock_get_hz(clk_sys) * 256) / ((uint64_t) div * PIO_SPI_CYCLES_PER_BIT);
+}
+
+void pio_spi_set_loopback(pio_spi_inst_t *spi, bool enable) {
+    if (enable == spi->loopback)
+        return;
+
+    uint32_t pinctrl = spi->pio->sm[spi->sm].pinctrl;
+    uint out_pin = (pinctrl & PIO_SM0_PINCTRL_OUT_BASE_BITS) >> PIO_SM0_PINCTRL_OUT_BASE_LSB;
+
+    pio_spi_stop_between_transfers(spi);
+    if (enable) {
+        spi->in_pin = (pinctrl & PIO_SM0_PINCTRL_IN_BASE_BITS) >> PIO_SM0_PINCTRL_IN_BASE_LSB;
+        pio_sm_set_in_pins(spi->pio, spi->sm, out_pin);
+        // Sampled half a bit after it changes, too soon for the synchroniser
+        // at the top rates
+        hw_set_bits(&spi->pio->input_sync_bypass, 1u << out_pin);
+    } else {
+        pio_sm_set_in_pins(spi->pio, spi->sm, spi->in_pin);
+        hw_clear_bits(&spi->pio->input_sync_bypass, 1u << out_pin);
+    }
+    spi->loopback = enable;
+    pio_sm_set_enabled(spi->pio, spi->sm, true);
+}
+
+void pio_spi_slave_start(const pio_spi_inst_t *slave, const pio_spi_inst_t *master) {
+    uint sck = (slave->pio->sm[slave->sm].execctrl & PIO_SM0_EXECCTRL_JMP_PIN_BITS) >> PIO_SM0_EXECCTRL_JMP_PIN_LSB;
+    uint start = (slave->pio->sm[slave->sm].execctrl & PIO_SM0_EXECCTRL_WRAP_BOTTOM_BITS) >> PIO_SM0_EXECCTRL_WRAP_BOTTOM_LSB;
+
+    pio_sm_set_enabled(master->pio, master->sm, false);
+    pio_sm_set_pindirs_with_mask(slave->pio, slave->sm, 0, 1u << sck);
+
+    // Start from the top of the program with nothing half shifted and no
+    // byte flagged as under way, X (the idle byte) survives this
+    pio_sm_clear_fifos(slave->pio, slave->sm);
+    pio_sm_restart(slave->pio, slave->sm);
+    pio_sm_exec(slave->pio, slave->sm, pio_encode_jmp(start));
+    slave->pio->irq = 1u << slave->sm;
+    pio_sm_set_enabled(slave->pio, slave->sm, true);
+}
+
+void pio_spi_slave_stop(const pio_spi_inst_t *slave, const pio_spi_inst_t *master) {
+    uint sck = (master->pio->sm[master->sm].pinctrl & PIO_SM0_PINCTRL_SIDESET_BASE_BITS) >> PIO_SM0_PINCTRL_SIDESET_BASE_LSB;
+
+    pio_sm_set_enabled(slave->pio, slave->sm, false);
+
+    // Drive SCK again, deasserted as the master left it
+    pio_sm_set_pins_with_mask(master->pio, master->sm, 0, 1u << sck);
+    pio_sm_set_pindirs_with_mask(master->pio, master->sm, 1u << sck, 1u << sck);
+    pio_sm_set_enabled(master->pio, master->sm, true);
+}
+
+void pio_spi_slave_set_idle(const pio_spi_inst_t *slave, uint8_t idle) {
+    // Parked in X as in pio_spi_slave_init()
+    pio_sm_clear_fifos(slave->pio, slave->sm);
+    pio_sm_put(slave->pio, slave->sm, idle * 0x01010101u);
+    pio_sm_exec(slave->pio, slave->sm, pio_encode_pull(false, false));
+    pio_sm_exec(slave->pio, slave->sm, pio_encode_mov(pio_x, pio_osr));
+}
+
+bool __time_critical_func(pio_spi_slave_flush)(const pio_spi_inst_t *slave) {
+    // Mid byte a pull would replace the rest of the byte, and as the SM
+    // only pulls once the OSR is empty every byte after it would go out
+    // across two of the Game Boy's. The SM flags a byte under way (see
+    // spi.pio); with interrupts off nothing comes between the check and
+    // the pulls but the few cycles they take.
+    uint32_t save = save_and_disable_interrupts();
+    bool idle = !(slave->pio->irq & (1u << slave->sm));
+    if (idle) {
+        // Pulling into the OSR leaves the RX FIFO alone, unlike clearing
+        // the FIFOs; the last byte pulled is shifted out of the OSR unsent,
+        // so the next byte pulls afresh
+        while (!pio_sm_is_tx_fifo_empty(slave->pio, slave->sm))
+            pio_sm_exec(slave->pio, slave->sm, pio_encode_pull(false, false));
+        pio_sm_exec(slave->pio, slave->sm, pio_encode_out(pio_null, 32));
+    }
+    restore_interrupts(save);
+    return idle;
+}
+
+// Large enough to never run out: over 18 hours of back to back bytes at the
+// fastest Game Boy clock
+#define PIO_SPI_CAPTURE_COUNT 0xffffffffu
+
+void pio_spi_capture_start(const pio_spi_inst_t *spi, uint8_t *ring, uint ring_bits) {
+    dma_channel_config c = pio_spi_dma_rx_config(spi);
+    channel_config_set_ring(&c, true, ring_bits);
+    dma_channel_configure(spi->dma_rx, &c, ring, pio_spi_rx_fifo(spi), PIO_SPI_CAPTURE_COUNT, true);
+}
+
+uint32_t __time_critical_func(pio_spi_capture_count)(const pio_spi_inst_t *spi) {
+    return PIO_SPI_CAPTURE_COUNT - dma_channel_hw_addr(spi->dma_rx)->transfer_count;
+}
+
+void pio_spi_capture_stop(const pio_spi_inst_t *spi) {
+    dma_channel_abort(spi->dma_rx);
+    dma_channel_abort(spi->dma_tx);
+
+    // Back to plain transfers for pio_spi_dma_start()
+    dma_channel_config c = pio_spi_dma_rx_config(spi);
+    dma_channel_set_config(spi->dma_rx, &c, false);
+}
+
+void __time_critical_func(pio_spi_dma_write_start)(const pio_spi_inst_t *spi, const uint8_t *src, size_t len) {
+    dma_channel_transfer_from_buffer_now(spi->dma_tx, src, len);
+}
+
+bool __time_critical_func(pio_spi_dma_write_poll)(const pio_spi_inst_t *spi) {
+    return !dma_channel_is_busy(spi->dma_tx);
+}
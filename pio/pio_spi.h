@@ -7,12 +7,22 @@
 #define _PIO_SPI_H
 
 #include "hardware/pio.h"
+#include "hardware/dma.h"
 #include "spi.pio.h"
 
 typedef struct pio_spi_inst {
     PIO pio;
     uint sm;
     uint cs_pin;
+    // DMA channels, only valid once pio_spi_dma_init() has claimed them
+    int dma_tx;
+    int dma_rx;
+    // Frame format set by pio_spi_set_frame(), 0 bits means 8 bit MSB-first
+    uint n_bits;
+    bool lsb_first;
+    // Set by pio_spi_set_loopback(), with the IN pin to go back to
+    bool loopback;
+    uint in_pin;
 } pio_spi_inst_t;
 
 void pio_spi_write8_blocking(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
@@ -21,4 +31,97 @@ void pio_spi_read8_blocking(const pio_spi_inst_t *spi, uint8_t *dst, size_t len)
 
 void pio_spi_write8_read8_blocking(const pio_spi_inst_t *spi, uint8_t *src, uint8_t *dst, size_t len);
 
+// Frames of any width from 1 to 32 bits, MSB- or LSB-first. Reprograms the
+// SM's shift direction and autopush/pull thresholds, and the DMA transfer
+// size, so call it after pio_spi_dma_init() and between transfers, and not
+// on a slave while it captures. The 8 bit helpers above need the default
+// 8 bit MSB-first format; frames other than 8, 16 or 32 bits need moving
+// within their bytes around the DMA, see pio_spi.c.
+void pio_spi_set_frame(pio_spi_inst_t *spi, uint n_bits, bool lsb_first);
+
+static inline uint pio_spi_frame_bits(const pio_spi_inst_t *spi) {
+    return spi->n_bits ? spi->n_bits : 8;
+}
+
+// Frames are held right-justified in a uint8_t, uint16_t or uint32_t,
+// whichever is the smallest that fits
+static inline size_t pio_spi_frame_size(const pio_spi_inst_t *spi) {
+    uint n_bits = pio_spi_frame_bits(spi);
+    return n_bits <= 8 ? 1 : n_bits <= 16 ? 2 : 4;
+}
+
+// DMA-driven full duplex transfers. A paired TX/RX channel moves the data
+// between memory and the SM FIFOs, so the CPU is free while bytes are on the
+// wire. Call pio_spi_dma_init() once after pio_spi_init(), then:
+// - pio_spi_dma_start() kicks off a transfer and returns immediately
+// - pio_spi_dma_poll() returns true once every byte has been clocked back in
+// - pio_spi_dma_complete() blocks until that happens
+// src and dst must stay valid until the transfer has completed. len counts
+// frames, i.e. bytes with the default format, each held in 1, 2 or 4 bytes
+// as pio_spi_frame_size() says.
+void pio_spi_dma_init(pio_spi_inst_t *spi);
+
+void pio_spi_dma_start(const pio_spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+
+bool pio_spi_dma_poll(const pio_spi_inst_t *spi);
+
+void pio_spi_dma_complete(const pio_spi_inst_t *spi);
+
+// spi_cpha0 and spi_cpha1 both take 4 SM cycles per bit
+#define PIO_SPI_CYCLES_PER_BIT 4
+
+// Change the SCK rate mid-session. Waits for a DMA transfer in flight to
+// finish, then restarts the SM's clock divider with the SM stopped, so the
+// new rate applies cleanly from the next bit.
+void pio_spi_set_clkdiv(const pio_spi_inst_t *spi, float clkdiv);
+
+// As above from a bit rate, returns the rate actually achieved
+uint32_t pio_spi_set_rate(const pio_spi_inst_t *spi, uint32_t sck_hz);
+
+uint32_t pio_spi_get_rate(const pio_spi_inst_t *spi);
+
+// Internal loopback: the SM samples its own MOSI pad instead of MISO, so
+// every byte comes back as it went out without a jumper. MOSI and SCK keep
+// driving the pins. Waits for a DMA transfer in flight, like the above.
+void pio_spi_set_loopback(pio_spi_inst_t *spi, bool enable);
+
+// Slave mode. A spi_slave SM set up with pio_spi_slave_init() shares the
+// pins of a spi_cpha1 master SM; only one of them runs at a time.
+// - pio_spi_slave_start() stops the master, releases SCK and starts the slave
+// - pio_spi_slave_stop() stops the slave and gives SCK back to the master
+// Both expect no DMA transfer in flight on either SM.
+void pio_spi_slave_start(const pio_spi_inst_t *slave, const pio_spi_inst_t *master);
+
+void pio_spi_slave_stop(const pio_spi_inst_t *slave, const pio_spi_inst_t *master);
+
+// Change the byte a stopped slave sends when nothing is queued
+void pio_spi_slave_set_idle(const pio_spi_inst_t *slave, uint8_t idle);
+
+// Queue one response byte from the CPU, for a slave not using its TX channel
+static inline void pio_spi_slave_put(const pio_spi_inst_t *slave, uint8_t b) {
+    *(io_rw_8 *) &slave->pio->txf[slave->sm] = b;
+}
+
+// Drop the response bytes queued on a running slave, so the next byte takes
+// the next one put. Only done between bytes: while a byte is under way it
+// drops nothing and returns false.
+bool pio_spi_slave_flush(const pio_spi_inst_t *slave);
+
+// Continuous capture for a slave, which does not know how many bytes are
+// coming. The RX channel writes into ring, a buffer of (1 << ring_bits) bytes
+// aligned to its size, wrapping at its end; pio_spi_capture_count() tells
+// how many frames, bytes with the default format, have been written since
+// the capture started.
+void pio_spi_capture_start(const pio_spi_inst_t *spi, uint8_t *ring, uint ring_bits);
+
+uint32_t pio_spi_capture_count(const pio_spi_inst_t *spi);
+
+void pio_spi_capture_stop(const pio_spi_inst_t *spi);
+
+// TX channel only, for queueing slave responses into the TX FIFO. len
+// counts frames, as for pio_spi_dma_start().
+void pio_spi_dma_write_start(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
+
+bool pio_spi_dma_write_poll(const pio_spi_inst_t *spi);
+
 #endif
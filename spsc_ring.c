@@ -0,0 +1,72 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ */
+
+#include <string.h>
+
+#include "spsc_ring.h"
+
+void spsc_ring_init(spsc_ring_t *ring, uint8_t *buf, uint32_t size)
+{
+  ring->buf = buf;
+  ring->mask = size - 1;
+  ring->head_cache = 0;
+  ring->tail_cache = 0;
+  atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+}
+
+uint32_t spsc_ring_push(spsc_ring_t *ring, uint8_t const *src, uint32_t len)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t space = spsc_ring_space(ring, len);
+  if ( len > space ) len = space;
+
+  // Copy in at most two pieces, up to the end of the buffer then from the start
+  uint32_t idx = tail & ring->mask;
+  uint32_t first = ring->mask + 1 - idx;
+  if ( first > len ) first = len;
+  memcpy(ring->buf + idx, src, first);
+  memcpy(ring->buf, src + first, len - first);
+
+  // Publish the data only once it has been written
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+  return len;
+}
+
+uint32_t spsc_ring_reserve(spsc_ring_t *ring, uint8_t **ptr)
+{
+  uint32_t idx = atomic_load_explicit(&ring->tail, memory_order_relaxed) & ring->mask;
+  uint32_t contiguous = ring->mask + 1 - idx;
+  uint32_t space = spsc_ring_space(ring, contiguous);
+
+  *ptr = ring->buf + idx;
+  return space < contiguous ? space : contiguous;
+}
+
+uint32_t spsc_ring_pop(spsc_ring_t *ring, uint8_t *dst, uint32_t len)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t count = spsc_ring_count(ring, len);
+  if ( len > count ) len = count;
+
+  uint32_t idx = head & ring->mask;
+  uint32_t first = ring->mask + 1 - idx;
+  if ( first > len ) first = len;
+  memcpy(dst, ring->buf + idx, first);
+  memcpy(dst + first, ring->buf, len - first);
+
+  // Hand the space back only once the data has been read
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  return len;
+}
+
+uint32_t spsc_ring_peek(spsc_ring_t *ring, uint8_t const **ptr)
+{
+  uint32_t idx = atomic_load_explicit(&ring->head, memory_order_relaxed) & ring->mask;
+  uint32_t contiguous = ring->mask + 1 - idx;
+  uint32_t count = spsc_ring_count(ring, contiguous);
+
+  *ptr = ring->buf + idx;
+  return count < contiguous ? count : contiguous;
+}
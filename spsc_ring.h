@@ -0,0 +1,142 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Lock-free single-producer/single-consumer byte ring.
+ *
+ * One side only ever pushes and the other only ever pops, so the two
+ * indices each have a single writer and no lock is needed. This is the
+ * buffering primitive for all link traffic between the USB core and the
+ * link core, in both directions.
+ *
+ * The producer and consumer indices live on separate cache lines, and each
+ * side keeps a private copy of the other side's index that it only
+ * refreshes when the copy says the ring is full/empty. On a host with
+ * caches this keeps the two threads from bouncing a line between them on
+ * every call.
+ *
+ * Besides copying push/pop there is a zero-copy interface: reserve/commit
+ * for the producer and peek/consume for the consumer hand out pointers
+ * straight into the ring storage, e.g. for DMA or a USB FIFO read. These
+ * only ever return the contiguous part, up to the end of the storage, so
+ * callers loop once more when the data wraps.
+ *
+ * Portable C11, so it also builds and runs on a host with pthreads.
+ */
+
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SPSC_RING_CACHE_LINE
+  #if defined(__ARM_ARCH_6M__)
+    // Cortex-M0+ has no data cache, don't waste RAM on padding
+    #define SPSC_RING_CACHE_LINE 4
+  #else
+    #define SPSC_RING_CACHE_LINE 64
+  #endif
+#endif
+
+typedef struct
+{
+  // Written by the producer only
+  alignas(SPSC_RING_CACHE_LINE) _Atomic uint32_t tail; // free running write count
+  uint32_t head_cache;                                  // producer's copy of head
+
+  // Written by the consumer only
+  alignas(SPSC_RING_CACHE_LINE) _Atomic uint32_t head; // free running read count
+  uint32_t tail_cache;                                  // consumer's copy of tail
+
+  // Read-only after init
+  alignas(SPSC_RING_CACHE_LINE) uint8_t *buf;
+  uint32_t mask; // capacity - 1, capacity is a power of two
+} spsc_ring_t;
+
+// size must be a power of two
+void spsc_ring_init(spsc_ring_t *ring, uint8_t *buf, uint32_t size);
+
+static inline uint32_t spsc_ring_capacity(spsc_ring_t const *ring)
+{
+  return ring->mask + 1;
+}
+
+//------------- Producer side -------------//
+
+// Free space as seen through the cached head. The real head is only loaded
+// when the cached value shows less than want bytes free.
+static inline uint32_t spsc_ring_space(spsc_ring_t *ring, uint32_t want)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t space = ring->mask + 1 - (tail - ring->head_cache);
+  if ( space < want ) {
+    ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+    space = ring->mask + 1 - (tail - ring->head_cache);
+  }
+  return space;
+}
+
+// Bytes that can be pushed. Exact, may only grow behind the producer's back.
+static inline uint32_t spsc_ring_free(spsc_ring_t *ring)
+{
+  return spsc_ring_space(ring, UINT32_MAX);
+}
+
+// Copies as many bytes as fit, returns the number copied
+uint32_t spsc_ring_push(spsc_ring_t *ring, uint8_t const *src, uint32_t len);
+
+// Points *ptr at the free space after the tail and returns how many bytes
+// can be written there contiguously. Nothing is visible to the consumer
+// until spsc_ring_commit().
+uint32_t spsc_ring_reserve(spsc_ring_t *ring, uint8_t **ptr);
+
+// Publish len bytes written through spsc_ring_reserve()
+static inline void spsc_ring_commit(spsc_ring_t *ring, uint32_t len)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
+
+//------------- Consumer side -------------//
+
+// Data available as seen through the cached tail. The real tail is only
+// loaded when the cached value shows less than want bytes.
+static inline uint32_t spsc_ring_count(spsc_ring_t *ring, uint32_t want)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t count = ring->tail_cache - head;
+  if ( count < want ) {
+    ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    count = ring->tail_cache - head;
+  }
+  return count;
+}
+
+// Bytes waiting to be popped. Exact, may only grow behind the consumer's back.
+static inline uint32_t spsc_ring_available(spsc_ring_t *ring)
+{
+  return spsc_ring_count(ring, UINT32_MAX);
+}
+
+static inline bool spsc_ring_empty(spsc_ring_t *ring)
+{
+  return spsc_ring_available(ring) == 0;
+}
+
+// Copies up to len bytes out, returns the number copied
+uint32_t spsc_ring_pop(spsc_ring_t *ring, uint8_t *dst, uint32_t len);
+
+// Points *ptr at the oldest data and returns how many bytes can be read
+// there contiguously. The data stays in the ring until spsc_ring_consume().
+uint32_t spsc_ring_peek(spsc_ring_t *ring, uint8_t const **ptr);
+
+// Release len bytes read through spsc_ring_peek()
+static inline void spsc_ring_consume(spsc_ring_t *ring, uint32_t len)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+#endif /* SPSC_RING_H_ */
@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * The harness of the host check tools. CHECK() counts a check and prints
+ * the line of each one that fails; a tool that finds a failure some other
+ * way counts it in failures itself. check_report() prints the totals and
+ * returns main()'s exit status, 1 if anything failed.
+ */
+
+#ifndef TOOLS_CHECK_H_
+#define TOOLS_CHECK_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static unsigned checks, failures;
+
+static inline void check(bool ok, char const *what, int line)
+{
+  checks++;
+  if ( ok ) return;
+
+  printf("line %d: %s\n", line, what);
+  failures++;
+}
+
+#define CHECK(cond) check(cond, #cond, __LINE__)
+
+static inline int check_report(void)
+{
+  printf("%u checks, %u failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
+
+#endif /* TOOLS_CHECK_H_ */
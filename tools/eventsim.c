@@ -0,0 +1,152 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Drives link_event.c on the host the way the firmware does, and reports
+ * percentiles of the time from an event being posted to the main loop
+ * taking it.
+ *
+ * Two poster threads stand in for the USB interrupt and core 1, each
+ * posting its own event at random intervals and then doing a SEV. The main
+ * thread runs core 0's loop: WFE until an event is pending, take it, spend
+ * a while on the tasks. WFE and SEV are modelled with an event register
+ * behind a condition variable, so a SEV that comes before the WFE is not
+ * lost, as on the RP2040. "spin" polls instead of sleeping, like the loop
+ * did before events.
+ *
+ *   cc -O2 -I. -pthread -o eventsim tools/eventsim.c link_event.c -lm
+ *   eventsim [wfe|spin] [events] [mean_gap_us] [task_us]
+ *
+ * The figures are the host scheduler's, not the RP2040's, the firmware's
+ * own are in the wake_hist telemetry.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "link_event.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool event_register = false;
+
+static volatile bool running = true;
+static uint32_t mean_gap_us = 200;
+static uint32_t task_us = 5;
+
+static uint32_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void spin_us(uint32_t us)
+{
+  uint32_t start = now_us();
+  while ( now_us() - start < us )
+    ;
+}
+
+static void sev(void)
+{
+  pthread_mutex_lock(&lock);
+  event_register = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+static void wfe(void)
+{
+  pthread_mutex_lock(&lock);
+  while ( !event_register ) pthread_cond_wait(&cond, &lock);
+  event_register = false;
+  pthread_mutex_unlock(&lock);
+}
+
+static void *poster(void *arg)
+{
+  link_event_id_t id = (link_event_id_t) (intptr_t) arg;
+  unsigned seed = id + 1;
+
+  while ( running )
+  {
+    // Exponential gaps, a Poisson stream of interrupts
+    double u = (rand_r(&seed) + 1.0) / ((double) RAND_MAX + 2.0);
+    uint32_t gap = -log(u) * mean_gap_us;
+    struct timespec ts = { gap / 1000000, gap % 1000000 * 1000 };
+    nanosleep(&ts, NULL);
+
+    link_event_post(id, now_us());
+    sev();
+  }
+  return NULL;
+}
+
+static int compare(void const *a, void const *b)
+{
+  uint32_t x = *(uint32_t const *) a, y = *(uint32_t const *) b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+  bool spin = argc > 1 && !strcmp(argv[1], "spin");
+  uint32_t count = argc > 2 ? strtoul(argv[2], NULL, 0) : 20000;
+  if ( argc > 3 ) mean_gap_us = strtoul(argv[3], NULL, 0);
+  if ( argc > 4 ) task_us = strtoul(argv[4], NULL, 0);
+  if ( !count || !mean_gap_us )
+  {
+    fprintf(stderr, "usage: %s [wfe|spin] [events] [mean_gap_us] [task_us]\n", argv[0]);
+    return 2;
+  }
+
+  uint32_t *latency = malloc(count * sizeof(*latency));
+  pthread_t threads[LINK_EVENT_COUNT];
+  for ( intptr_t i = 0; i < LINK_EVENT_COUNT; i++ )
+    pthread_create(&threads[i], NULL, poster, (void *) i);
+
+  uint32_t wakes = 0;
+  clock_t cpu = clock();
+  uint32_t start = now_us();
+
+  while ( wakes < count )
+  {
+    if ( spin )
+    {
+      while ( !link_event_pending() )
+        ;
+    }
+    else
+    {
+      while ( !link_event_pending() ) wfe();
+    }
+
+    uint32_t waited;
+    if ( !link_event_take(now_us(), &waited) ) continue;
+    latency[wakes++] = waited;
+    spin_us(task_us);
+  }
+
+  double elapsed = (now_us() - start) / 1e6;
+  double busy = (double) (clock() - cpu) / CLOCKS_PER_SEC;
+  running = false;
+  for ( int i = 0; i < LINK_EVENT_COUNT; i++ )
+    pthread_join(threads[i], NULL);
+
+  qsort(latency, count, sizeof(*latency), compare);
+  printf("%s: %u wake-ups in %.2f s, %.0f%% of a core\n", spin ? "spin" : "wfe", count, elapsed,
+         100 * busy / elapsed);
+  printf("latency us: p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+         latency[count / 2], latency[count * 9 / 10], latency[count * 99 / 100],
+         latency[count * 999 / 1000], latency[count - 1]);
+  free(latency);
+  return 0;
+}
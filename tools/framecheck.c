@@ -0,0 +1,187 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Checks link_wire.c on the host against a model of the PIO FIFOs and
+ * shift registers: raw mode frames of every width from 1 to 32 bits, in
+ * both orders, go through link_wire_to_fifo(), the TX DMA, the SM and an
+ * internal loopback, the RX DMA and link_wire_from_fifo(). Each frame must
+ * go out on the wire bit by bit in the order asked for and come back into
+ * the ring as it was sent, and link_wire_sent() must give the trace the
+ * frame as it was in the ring. A 12 bit frame is also checked byte by
+ * byte, and bits above the width must never reach the wire.
+ *
+ *   cc -O2 -I. -o framecheck tools/framecheck.c link_wire.c
+ *   framecheck
+ *
+ * Prints each failed check and exits 1 if there was one.
+ *
+ * The model follows the RP2040 datasheet: a narrow DMA write to a TX FIFO
+ * is replicated across the word, the SM shifts the OSR out left (MSB-first)
+ * or right (LSB-first) and the ISR in the same way, autopush at the frame
+ * width, and the RX DMA reads 1, 2 or 4 bytes at the offset pio_spi.c
+ * points it at, the top of the word for LSB-first.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "link_wire.h"
+
+#define FRAMES 64
+
+static uint32_t get_frame(uint8_t const *buf, uint32_t size)
+{
+  uint32_t v = 0;
+  for ( uint32_t j = 0; j < size; j++ )
+    v |= (uint32_t) buf[j] << (8 * j);
+  return v;
+}
+
+static void put_frame(uint8_t *buf, uint32_t size, uint32_t v)
+{
+  for ( uint32_t j = 0; j < size; j++ )
+    buf[j] = v >> (8 * j);
+}
+
+static uint32_t mask_of(uint32_t n_bits)
+{
+  return n_bits == 32 ? 0xFFFFFFFFu : (1u << n_bits) - 1;
+}
+
+//--------------------------------------------------------------------+
+// PIO model
+//--------------------------------------------------------------------+
+
+// A DMA write of size bytes into the TX FIFO
+static uint32_t fifo_write(uint32_t v, uint32_t size)
+{
+  return size == 1 ? (v & 0xFF) * 0x01010101u : size == 2 ? (v & 0xFFFF) * 0x00010001u : v;
+}
+
+// A DMA read of size bytes from the RX FIFO, at pio_spi_rx_fifo()'s offset
+static uint32_t fifo_read(uint32_t word, uint32_t size, bool lsb_first)
+{
+  uint32_t offset = lsb_first ? 4 - size : 0;
+  return (word >> (8 * offset)) & (size == 4 ? 0xFFFFFFFFu : (1u << (8 * size)) - 1);
+}
+
+// One frame through the SM with its input looped back to its output. The
+// bits in the order they went out are in wire, the word pushed is returned.
+static uint32_t sm_exchange(uint32_t osr, uint32_t n_bits, bool lsb_first, uint8_t *wire)
+{
+  uint32_t isr = 0;
+  for ( uint32_t k = 0; k < n_bits; k++ )
+  {
+    uint32_t bit = lsb_first ? osr & 1 : osr >> 31;
+    osr = lsb_first ? osr >> 1 : osr << 1;
+    wire[k] = bit;
+    isr = lsb_first ? (isr >> 1) | (bit << 31) : (isr << 1) | bit;
+  }
+  return isr;
+}
+
+//--------------------------------------------------------------------+
+// Checks
+//--------------------------------------------------------------------+
+
+// A burst of FRAMES frames, the way burst_step() moves them. junk is ORed
+// into the bits above the width, which the host may leave set.
+static bool check_burst(uint32_t n_bits, bool lsb_first, uint32_t seed, uint32_t junk)
+{
+  uint32_t size = link_wire_size(n_bits);
+  uint32_t mask = mask_of(n_bits);
+  uint8_t ring[FRAMES * 4], tx[FRAMES * 4], rx[FRAMES * 4];
+  uint32_t len = FRAMES * size;
+  bool ok = true;
+
+  for ( uint32_t i = 0; i < FRAMES; i++ )
+  {
+    seed = seed * 1103515245u + 12345u;
+    put_frame(ring + i * size, size, (seed & mask) | (junk & ~mask));
+  }
+  memcpy(tx, ring, len);
+  link_wire_to_fifo(tx, len, n_bits, lsb_first);
+
+  for ( uint32_t i = 0; i < FRAMES; i++ )
+  {
+    uint32_t want = get_frame(ring + i * size, size) & mask;
+    uint8_t wire[32];
+    uint32_t word = sm_exchange(fifo_write(get_frame(tx + i * size, size), size), n_bits, lsb_first,
+                                wire);
+    for ( uint32_t k = 0; k < n_bits; k++ )
+      ok &= wire[k] == ((want >> (lsb_first ? k : n_bits - 1 - k)) & 1);
+    put_frame(rx + i * size, size, fifo_read(word, size, lsb_first));
+  }
+
+  link_wire_from_fifo(rx, len, n_bits, lsb_first);
+  link_wire_sent(tx, len, n_bits, lsb_first);
+  for ( uint32_t i = 0; i < FRAMES; i++ )
+  {
+    uint32_t want = get_frame(ring + i * size, size) & mask;
+    ok &= get_frame(rx + i * size, size) == want;
+    ok &= (get_frame(tx + i * size, size) & mask) == want;
+  }
+  return ok;
+}
+
+static void check_widths(void)
+{
+  for ( uint32_t n_bits = 1; n_bits <= 32; n_bits++ )
+  {
+    for ( int lsb_first = 0; lsb_first <= 1; lsb_first++ )
+    {
+      bool ok = check_burst(n_bits, lsb_first, n_bits, 0) &&
+                check_burst(n_bits, lsb_first, n_bits * 7, 0xFFFFFFFFu);
+      if ( !ok ) printf("%u bit %s frames do not make it there and back\n", n_bits,
+                        lsb_first ? "LSB-first" : "MSB-first");
+      CHECK(ok);
+    }
+  }
+}
+
+// 0xABC in 12 bits, byte by byte
+static void check_12_bits(void)
+{
+  uint8_t buf[2];
+  uint8_t wire[12];
+
+  CHECK(link_wire_size(12) == 2);
+  CHECK(!link_wire_direct(12));
+  CHECK(link_wire_direct(8) && link_wire_direct(16) && link_wire_direct(32));
+
+  // MSB-first goes out from the top of the halfword
+  put_frame(buf, 2, 0xFABC);
+  link_wire_to_fifo(buf, 2, 12, false);
+  CHECK(buf[0] == 0xC0 && buf[1] == 0xAB);
+  uint32_t word = sm_exchange(fifo_write(get_frame(buf, 2), 2), 12, false, wire);
+  CHECK(!memcmp(wire, "\1\0\1\0\1\0\1\1\1\1\0\0", 12));
+  CHECK(fifo_read(word, 2, false) == 0xABC);
+  link_wire_sent(buf, 2, 12, false);
+  CHECK(get_frame(buf, 2) == 0x0ABC);
+
+  // Unmoved, it would have sent the top nibble the host left set
+  sm_exchange(fifo_write(0xFABC, 2), 12, false, wire);
+  CHECK(memcmp(wire, "\1\0\1\0\1\0\1\1\1\1\0\0", 12));
+
+  // LSB-first goes out as it is and comes back in at the top of the word
+  put_frame(buf, 2, 0x0ABC);
+  link_wire_to_fifo(buf, 2, 12, true);
+  CHECK(get_frame(buf, 2) == 0x0ABC);
+  word = sm_exchange(fifo_write(get_frame(buf, 2), 2), 12, true, wire);
+  CHECK(!memcmp(wire, "\0\0\1\1\1\1\0\1\0\1\0\1", 12));
+  put_frame(buf, 2, fifo_read(word, 2, true));
+  CHECK(buf[0] == 0xC0 && buf[1] == 0xAB);
+  link_wire_from_fifo(buf, 2, 12, true);
+  CHECK(get_frame(buf, 2) == 0x0ABC);
+}
+
+int main(void)
+{
+  check_12_bits();
+  check_widths();
+
+  return check_report();
+}
@@ -0,0 +1,261 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Measures the round trip of single byte link exchanges, one at a time the
+ * way an interactive game makes them, and prints its percentiles.
+ *
+ *   cc -O2 -I. -o hidbench tools/hidbench.c
+ *   hidbench [-n count] [-x exchange_us] device
+ *
+ * device is the interrupt endpoint interface of firmware built with
+ * USB_INTERRUPT, as a hidraw node such as /dev/hidraw0, which must be in
+ * raw mode; a tty such as /dev/ttyACM0, which is put in raw mode with one
+ * byte chunks, to compare against the bulk endpoints; or "loop" for a
+ * stand-in of the interrupt interface whose SOUT is wired to its SIN.
+ *
+ * The stand-in runs in a child process and follows the host's schedule for
+ * a 1 ms interrupt endpoint: a request goes out in the frame after it is
+ * written, the byte takes exchange_us on the link, and the reply is picked
+ * up in the first frame after that. Its figures are those of the schedule
+ * and the host's scheduler, not of a device; the bound they show, two
+ * frames plus the exchange, is the one the real interface should keep.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "link_proto.h"
+
+// Legacy magic config packet, see handle_input_data() in main.c
+#define MAGIC_LEN 0x20
+#define CONFIG_LEN (MAGIC_LEN + 4)
+
+#define FRAME_US 1000
+#define TIMEOUT_MS 1000
+
+typedef enum
+{
+  DEVICE_HID,
+  DEVICE_TTY,
+  DEVICE_LOOP
+} device_kind_t;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t)
+{
+  struct timespec ts = { t / 1000000, t % 1000000 * 1000 };
+  while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+    ;
+}
+
+static bool read_timeout(int fd, uint8_t *dst, size_t len)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  while ( len )
+  {
+    if ( poll(&pfd, 1, TIMEOUT_MS) != 1 ) return false;
+    ssize_t n = read(fd, dst, len);
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n <= 0 ) return false;
+    dst += n;
+    len -= n;
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Loopback stand-in
+//--------------------------------------------------------------------+
+
+// Next frame start at or after t, frames counted from start
+static uint64_t frame_after(uint64_t start, uint64_t t)
+{
+  return start + (t - start + FRAME_US - 1) / FRAME_US * FRAME_US;
+}
+
+static void loop_run(int fd, uint32_t exchange_us)
+{
+  uint64_t start = now_us();
+  uint8_t report[LINK_PROTO_HID_REPORT_LEN];
+
+  while ( read(fd, report, sizeof(report)) == sizeof(report) )
+  {
+    uint64_t out = frame_after(start, now_us());
+    uint8_t len = report[1];
+    if ( len > LINK_PROTO_HID_REPORT_LEN - 2 ) len = report[1] = LINK_PROTO_HID_REPORT_LEN - 2;
+
+    // SOUT wired to SIN: every byte comes back as it went out. The reply
+    // can only be polled in a frame after the one that carried the request.
+    uint64_t in = frame_after(start, out + len * exchange_us + 1);
+    sleep_until(in);
+    if ( write(fd, report, sizeof(report)) != sizeof(report) ) break;
+  }
+  _exit(0);
+}
+
+//--------------------------------------------------------------------+
+// Devices
+//--------------------------------------------------------------------+
+
+static int device_open(char const *path, device_kind_t *kind, uint32_t exchange_us, pid_t *child)
+{
+  if ( !strcmp(path, "loop") )
+  {
+    int sv[2];
+    if ( socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) ) return -1;
+    *child = fork();
+    if ( *child < 0 ) return -1;
+    if ( *child == 0 )
+    {
+      close(sv[0]);
+      loop_run(sv[1], exchange_us);
+    }
+    close(sv[1]);
+    *kind = DEVICE_LOOP;
+    return sv[0];
+  }
+
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if ( fd < 0 ) return -1;
+
+  struct termios tio;
+  if ( tcgetattr(fd, &tio) )
+  {
+    *kind = DEVICE_HID;
+    return fd;
+  }
+
+  *kind = DEVICE_TTY;
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+  usleep(100000);
+  tcflush(fd, TCIOFLUSH);
+
+  // Raw mode, one byte chunks, no gap
+  uint8_t config[CONFIG_LEN] = { 0 };
+  for ( int i = 0; i < MAGIC_LEN / 2; i++ )
+    config[i] = i & 1 ? 0xFE : 0xCA;
+  for ( int i = MAGIC_LEN / 2; i < MAGIC_LEN; i += 4 )
+    memcpy(config + i, "\xDE\xAD\xBE\xEF", 4);
+  config[MAGIC_LEN + 3] = 1;
+
+  uint8_t ack;
+  if ( write(fd, config, sizeof(config)) != sizeof(config) || !read_timeout(fd, &ack, 1) )
+  {
+    fprintf(stderr, "%s: no answer to the config packet\n", path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// One byte out and its reply back, false if the device did not exchange it
+static bool exchange(int fd, device_kind_t kind, uint8_t seq, uint8_t out, uint8_t *in)
+{
+  if ( kind == DEVICE_TTY )
+    return write(fd, &out, 1) == 1 && read_timeout(fd, in, 1);
+
+  // hidraw takes the report ID first, 0 for a device without IDs
+  uint8_t request[1 + LINK_PROTO_HID_REPORT_LEN] = { 0, seq, 1, out };
+  uint8_t *report = kind == DEVICE_HID ? request : request + 1;
+  size_t len = kind == DEVICE_HID ? sizeof(request) : LINK_PROTO_HID_REPORT_LEN;
+  if ( write(fd, report, len) != (ssize_t) len ) return false;
+
+  uint8_t reply[LINK_PROTO_HID_REPORT_LEN];
+  do
+  {
+    if ( !read_timeout(fd, reply, sizeof(reply)) ) return false;
+  } while ( reply[0] != seq );
+  if ( reply[1] != 1 ) return false;
+
+  *in = reply[2];
+  return true;
+}
+
+static int compare(void const *a, void const *b)
+{
+  uint32_t x = *(uint32_t const *) a, y = *(uint32_t const *) b;
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t count = 2000;
+  uint32_t exchange_us = 125;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "n:x:")) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      case 'x': exchange_us = strtoul(optarg, NULL, 0); break;
+      default: count = 0; break;
+    }
+  }
+  if ( optind != argc - 1 || !count )
+  {
+    fprintf(stderr, "usage: %s [-n count] [-x exchange_us] device\n", argv[0]);
+    return 2;
+  }
+
+  device_kind_t kind;
+  pid_t child = 0;
+  int fd = device_open(argv[optind], &kind, exchange_us, &child);
+  if ( fd < 0 )
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  uint32_t *rtt = malloc(count * sizeof(*rtt));
+  uint32_t mismatched = 0;
+  uint64_t total = 0;
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    uint8_t out = rand(), in;
+    uint64_t start = now_us();
+    if ( !exchange(fd, kind, i, out, &in) )
+    {
+      fprintf(stderr, "%s: exchange %u failed%s\n", argv[optind], i,
+              kind == DEVICE_HID ? ", is the device in raw mode?" : "");
+      return 1;
+    }
+    rtt[i] = now_us() - start;
+    total += rtt[i];
+    mismatched += in != out;
+  }
+
+  if ( child )
+  {
+    close(fd);
+    waitpid(child, NULL, 0);
+  }
+
+  qsort(rtt, count, sizeof(*rtt), compare);
+  printf("%s: %u exchanges, %u came back different\n", argv[optind], count, mismatched);
+  printf("round trip us: mean %llu  p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+         (unsigned long long) (total / count), rtt[count / 2], rtt[count * 9 / 10],
+         rtt[count * 99 / 100], rtt[count * 999 / 1000], rtt[count - 1]);
+  free(rtt);
+  return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Tells the USB side of a slow session from the link side. Puts the device
+ * in framed mode, times PING round trips, which cross USB and the link core
+ * but not the cable, then has the device run a BENCH on its own and prints
+ * both (see link_proto.h).
+ *
+ *   cc -O2 -I. -o linkbench tools/linkbench.c link_proto.c
+ *   linkbench [-n count] [-c sck_hz] [-b bytes_per_transfer] [-g gap_us]
+ *             [-p pings] [-L] [-s] device
+ *
+ * -L runs the benchmark through the PIO's internal loopback, a self-test
+ * that needs neither cable nor Game Boy; it fails if a byte came back
+ * different.
+ *
+ * -s runs a handshake of count single byte exchanges, gap_us apart, both
+ * ways a game's can go instead of BENCH: as a response script the device
+ * runs by itself (SCRIPT_LOAD, SCRIPT_RUN), and as EXCHANGE frames the
+ * host sends one at a time, each waiting for the byte the last one got
+ * back. The script has one rule that answers any byte, so it runs on
+ * whatever is on the cable, Game Boy or not, at the SCK rate in use; -c,
+ * -b and -L only apply to BENCH. It replaces any script loaded before.
+ *
+ * The device is left in framed mode.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link_proto.h"
+#include "link_script.h"
+
+// Legacy magic config packet, see handle_input_data() in main.c
+#define MAGIC_LEN 0x20
+#define CONFIG_LEN (MAGIC_LEN + 4)
+
+#define PING_MAX 512
+
+static uint8_t seq;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool write_all(int fd, uint8_t const *src, size_t len)
+{
+  while ( len )
+  {
+    ssize_t n = write(fd, src, len);
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n <= 0 ) return false;
+    src += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_timeout(int fd, uint8_t *dst, size_t len, int timeout_ms)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  while ( len )
+  {
+    if ( poll(&pfd, 1, timeout_ms) != 1 ) return false;
+    ssize_t n = read(fd, dst, len);
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n <= 0 ) return false;
+    dst += n;
+    len -= n;
+  }
+  return true;
+}
+
+static int device_open(char const *path)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if ( fd < 0 ) return -1;
+
+  struct termios tio;
+  if ( tcgetattr(fd, &tio) == 0 )
+  {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  usleep(100000);
+  tcflush(fd, TCIOFLUSH);
+
+  // Into framed mode. A device already there takes this for garbage and
+  // skips it, so the ack may not come.
+  uint8_t config[CONFIG_LEN] = { 0 };
+  for ( int i = 0; i < MAGIC_LEN / 2; i++ )
+    config[i] = i & 1 ? 0xFE : 0xCA;
+  for ( int i = MAGIC_LEN / 2; i < MAGIC_LEN; i += 4 )
+    memcpy(config + i, "\xDE\xAD\xBE\xEF", 4);
+  config[MAGIC_LEN + 3] = LINK_PROTO_ENTER_FRAMED;
+
+  uint8_t ack;
+  if ( !write_all(fd, config, sizeof(config)) ) return -1;
+  read_timeout(fd, &ack, 1, 200);
+  return fd;
+}
+
+// One frame out and its reply back into reply, returns the reply's payload
+// length or -1
+static int transact(int fd, uint8_t opcode, uint8_t const *payload, uint16_t len, uint8_t *reply,
+                    uint16_t reply_max, int timeout_ms)
+{
+  uint8_t frame[LINK_PROTO_HEADER_LEN + PING_MAX];
+  link_proto_put_header(frame, opcode, ++seq, len);
+  memcpy(frame + LINK_PROTO_HEADER_LEN, payload, len);
+  if ( !write_all(fd, frame, LINK_PROTO_HEADER_LEN + len) ) return -1;
+
+  uint8_t header[LINK_PROTO_HEADER_LEN];
+  link_frame_t in;
+  if ( !read_timeout(fd, header, sizeof(header), timeout_ms) || !link_proto_get_header(header, &in) )
+    return -1;
+  if ( in.len > reply_max || !read_timeout(fd, reply, in.len, timeout_ms) ) return -1;
+
+  if ( in.opcode == (LINK_OP_ERROR | LINK_OP_REPLY) )
+  {
+    fprintf(stderr, "opcode 0x%02x: error %u\n", reply[0], in.len > 1 ? reply[1] : 0);
+    return -1;
+  }
+  if ( in.opcode != (opcode | LINK_OP_REPLY) || in.seq != seq ) return -1;
+  return in.len;
+}
+
+static int compare(void const *a, void const *b)
+{
+  uint32_t x = *(uint32_t const *) a, y = *(uint32_t const *) b;
+  return x < y ? -1 : x > y;
+}
+
+// count single byte exchanges run by a response script, then driven by the
+// host, and their time per exchange
+static bool script_bench(int fd, uint32_t count, uint32_t gap_us)
+{
+  uint8_t payload[LINK_PROTO_RULE_LEN], reply[PING_MAX];
+
+  // Any byte in, 0x5A out: the figures are the path's, not a game's
+  link_rule_t rule = { .reply = 0x5A, .wait_us = gap_us > UINT16_MAX ? UINT16_MAX : gap_us };
+  link_proto_put_rule(payload, &rule);
+  if ( transact(fd, LINK_OP_SCRIPT_LOAD, payload, LINK_PROTO_RULE_LEN, reply, sizeof(reply),
+                1000) != 1 || reply[0] != 1 )
+    return false;
+
+  link_run_t run = { .first = 0x5A, .limit = count };
+  link_proto_put_run(payload, &run);
+  uint64_t budget_ms = 5000 + (uint64_t) count * (1000 + rule.wait_us) / 1000;
+  uint64_t start = now_us();
+  if ( transact(fd, LINK_OP_SCRIPT_RUN, payload, LINK_PROTO_RUN_LEN, reply, sizeof(reply),
+                budget_ms) < LINK_PROTO_RESULT_LEN )
+    return false;
+  uint64_t script_us = now_us() - start;
+
+  link_result_t result;
+  link_proto_get_result(reply, &result);
+  if ( result.reason != LINK_SCRIPT_LIMIT || result.exchanged != count )
+  {
+    fprintf(stderr, "script stopped after %u of %u exchanges, reason %u\n", result.exchanged, count,
+            result.reason);
+    return false;
+  }
+
+  // The same handshake through the host, which sees each byte before it
+  // sends the next
+  uint8_t record[LINK_PROTO_RECORD_LEN + 1];
+  uint32_t *rtt = malloc(count * sizeof(*rtt));
+  uint64_t host_us = 0;
+  uint8_t out = 0x5A;
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    link_proto_put_exchange(record, 1, rule.wait_us, &out);
+    start = now_us();
+    if ( transact(fd, LINK_OP_EXCHANGE, record, sizeof(record), reply, sizeof(reply), 1000) !=
+         sizeof(record) )
+    {
+      free(rtt);
+      return false;
+    }
+    rtt[i] = now_us() - start;
+    host_us += rtt[i];
+  }
+
+  qsort(rtt, count, sizeof(*rtt), compare);
+  double script_per = (double) script_us / count, host_per = (double) host_us / count;
+  printf("script: %u exchanges in %llu us, %.1f us each, one USB round trip in all\n", count,
+         (unsigned long long) script_us, script_per);
+  printf("host:   %u exchanges in %llu us, %.1f us each: p50 %u us  p99 %u us  max %u us\n", count,
+         (unsigned long long) host_us, host_per, rtt[count / 2], rtt[count * 99 / 100],
+         rtt[count - 1]);
+  printf("host-driven exchanges take %.1fx the script's time\n",
+         script_per > 0 ? host_per / script_per : 0);
+  free(rtt);
+  return true;
+}
+
+// PING round trips of len payload bytes, p50 in *median
+static bool ping(int fd, uint16_t len, uint32_t count, uint32_t *median)
+{
+  uint8_t payload[PING_MAX], reply[PING_MAX];
+  uint32_t *rtt = malloc(count * sizeof(*rtt));
+
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    for ( uint16_t j = 0; j < len; j++ )
+      payload[j] = i + j;
+    uint64_t start = now_us();
+    if ( transact(fd, LINK_OP_PING, payload, len, reply, sizeof(reply), 1000) != len ||
+         memcmp(payload, reply, len) )
+    {
+      free(rtt);
+      return false;
+    }
+    rtt[i] = now_us() - start;
+  }
+
+  qsort(rtt, count, sizeof(*rtt), compare);
+  printf("usb echo %3u bytes: p50 %u us  p99 %u us  max %u us\n", len, rtt[count / 2],
+         rtt[count * 99 / 100], rtt[count - 1]);
+  *median = rtt[count / 2];
+  free(rtt);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  link_bench_t bench = { .count = 4096, .bytes_per_transfer = 64 };
+  uint32_t pings = 500;
+  bool script = false;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "n:c:b:g:p:Ls")) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n': bench.count = strtoul(optarg, NULL, 0); break;
+      case 'c': bench.sck_hz = strtoul(optarg, NULL, 0); break;
+      case 'b': bench.bytes_per_transfer = strtoul(optarg, NULL, 0); break;
+      case 'g': bench.us_between_transfer = strtoul(optarg, NULL, 0); break;
+      case 'p': pings = strtoul(optarg, NULL, 0); break;
+      case 'L': bench.flags |= LINK_BENCH_LOOPBACK; break;
+      case 's': script = true; break;
+      default: pings = 0; break;
+    }
+  }
+  if ( optind != argc - 1 || !pings || (script && !bench.count) )
+  {
+    fprintf(stderr, "usage: %s [-n count] [-c sck_hz] [-b bytes_per_transfer] [-g gap_us] "
+                    "[-p pings] [-L] [-s] device\n", argv[0]);
+    return 2;
+  }
+
+  int fd = device_open(argv[optind]);
+  if ( fd < 0 )
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  // The single byte round trip is the one to hold a link byte against
+  uint32_t usb_us[3];
+  uint16_t const sizes[3] = { 1, 64, PING_MAX };
+  for ( size_t i = 0; i < 3; i++ )
+  {
+    if ( !ping(fd, sizes[i], pings, &usb_us[i]) )
+    {
+      fprintf(stderr, "%s: no answer to PING, is the device in framed mode?\n", argv[optind]);
+      return 1;
+    }
+  }
+
+  if ( script )
+  {
+    if ( !script_bench(fd, bench.count, bench.us_between_transfer) )
+    {
+      fprintf(stderr, "%s: the script benchmark did not finish\n", argv[optind]);
+      return 1;
+    }
+    return 0;
+  }
+
+  // Long enough for count bytes at the slowest rate the Game Boy uses
+  uint8_t payload[LINK_PROTO_BENCH_LEN], reply[LINK_PROTO_REPORT_LEN];
+  link_proto_put_bench(payload, &bench);
+  uint64_t budget_ms = 5000 + (uint64_t) bench.count * (1000 + bench.us_between_transfer) / 1000;
+  if ( transact(fd, LINK_OP_BENCH, payload, sizeof(payload), reply, sizeof(reply), budget_ms) !=
+       LINK_PROTO_REPORT_LEN )
+  {
+    fprintf(stderr, "%s: no answer to BENCH\n", argv[optind]);
+    return 1;
+  }
+
+  link_report_t report;
+  link_proto_get_report(reply, &report);
+  printf("link: %u bytes in %u us at %u Hz SCK, %u bytes per chunk, %u us gap\n", report.exchanged,
+         report.elapsed_us, report.sck_hz, bench.bytes_per_transfer, bench.us_between_transfer);
+  printf("link: %u bytes/s (%.0f%% of the SCK rate), %u stall cycles\n", report.bytes_per_s,
+         report.sck_hz ? 800.0 * report.bytes_per_s / report.sck_hz : 0, report.stall_cycles);
+  printf("pacing error: mean %u us  max %u us\n", report.pacing_mean_us, report.pacing_max_us);
+  if ( report.exchanged )
+    printf("per byte: link %.1f us, usb round trip %u us\n",
+           (double) report.elapsed_us / report.exchanged, usb_us[0]);
+
+  if ( bench.flags & LINK_BENCH_LOOPBACK )
+  {
+    printf("loopback self-test: %s, %u of %u bytes came back different\n",
+           report.mismatches ? "FAILED" : "passed", report.mismatches, report.exchanged);
+    return report.mismatches ? 1 : 0;
+  }
+  return 0;
+}
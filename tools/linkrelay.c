@@ -0,0 +1,538 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Relays a link between two devices over TCP, so two Game Boys on
+ * different machines can be linked.
+ *
+ * Each side runs its device in raw mode. Whatever its Game Boy sends goes
+ * over the network and is clocked out to the other Game Boy. Waiting a
+ * network round trip for every byte would hold the link to a few bytes per
+ * second, so each side primes the link with depth idle bytes instead. The
+ * devices then keep exchanging at the rate their pacing sets, while the
+ * bytes in flight cross the network. By default depth covers the round trip
+ * measured at startup at that rate, and the pacing gap (-g) must be the
+ * same on both sides. Every byte then reaches the other Game Boy depth
+ * exchanges later than it would over a cable.
+ *
+ *   cc -O2 -o linkrelay tools/linkrelay.c
+ *   linkrelay [-g gap_us] [-d depth] [-i idle] [-l latency_ms] device listen port
+ *   linkrelay [...] device connect host port
+ *   linkrelay bench [-g gap_us] [-t seconds]
+ *
+ * device is a tty such as /dev/ttyACM0, or "loop" for a stand-in whose SOUT
+ * is wired to its SIN, paced like the real thing. -l delays everything sent
+ * to the network, to try out a slower one. bench runs both sides in two
+ * processes over localhost, with loop devices, at a range of injected
+ * latencies. It does so once with a single byte in flight and once with
+ * the default depth, and prints the link bytes per second each run gets.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// Legacy magic config packet, see handle_input_data() in main.c
+#define MAGIC_LEN 0x20
+#define CONFIG_LEN (MAGIC_LEN + 4)
+
+// Network messages: type len payload[len]
+enum
+{
+  MSG_DATA = 'D', // link bytes
+  MSG_PING = 'P', // sender's clock, echoed back as a PONG
+  MSG_PONG = 'Q'
+};
+#define MSG_HEADER 2
+#define MSG_MAX 255
+
+#define LOOP_SIZE 65536
+#define SENDQ_LEN 4096
+#define MAX_DEPTH 512
+
+typedef struct
+{
+  int fd;                  // tty, -1 for the loopback stand-in
+  uint32_t gap_us;
+  uint8_t loop[LOOP_SIZE]; // stand-in: bytes waiting for their exchange
+  uint32_t loop_head;
+  uint32_t loop_len;
+  uint64_t loop_next;      // when the next one is exchanged
+} device_t;
+
+typedef struct
+{
+  uint32_t gap_us;
+  int depth;           // 0 for enough to cover the round trip
+  uint8_t idle;
+  uint32_t latency_us; // added to everything sent to the network
+  double seconds;      // 0 to run until the peer goes away
+} options_t;
+
+typedef struct
+{
+  uint64_t rtt_us;
+  int depth;
+  unsigned long bytes; // exchanged with the local Game Boy once primed
+  double elapsed;
+} result_t;
+
+// Messages waiting out the injected latency
+typedef struct
+{
+  uint64_t due;
+  uint16_t len;
+  uint8_t msg[MSG_HEADER + MSG_MAX];
+} segment_t;
+
+static segment_t sendq[SENDQ_LEN];
+static uint32_t sendq_head, sendq_len;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool write_all(int fd, uint8_t const *src, size_t len)
+{
+  while ( len )
+  {
+    ssize_t n = write(fd, src, len);
+    if ( n < 0 && errno == EINTR ) continue;
+    if ( n <= 0 ) return false;
+    src += n;
+    len -= n;
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Devices
+//--------------------------------------------------------------------+
+
+static bool device_open(device_t *dev, char const *path, uint32_t gap_us)
+{
+  dev->gap_us = gap_us;
+  dev->loop_head = dev->loop_len = 0;
+  dev->loop_next = 0;
+  if ( !strcmp(path, "loop") )
+  {
+    dev->fd = -1;
+    return true;
+  }
+
+  dev->fd = open(path, O_RDWR | O_NOCTTY);
+  if ( dev->fd < 0 ) return false;
+
+  struct termios tio;
+  if ( tcgetattr(dev->fd, &tio) == 0 )
+  {
+    cfmakeraw(&tio);
+    tcsetattr(dev->fd, TCSANOW, &tio);
+  }
+
+  // Whatever the last session left behind would be taken for the ack
+  usleep(100000);
+  tcflush(dev->fd, TCIOFLUSH);
+
+  // Raw mode, one byte chunks, gap_us apart
+  uint8_t config[CONFIG_LEN];
+  for ( int i = 0; i < MAGIC_LEN / 2; i++ )
+    config[i] = i & 1 ? 0xFE : 0xCA;
+  for ( int i = MAGIC_LEN / 2; i < MAGIC_LEN; i += 4 )
+    memcpy(config + i, "\xDE\xAD\xBE\xEF", 4);
+  config[MAGIC_LEN] = gap_us;
+  config[MAGIC_LEN + 1] = gap_us >> 8;
+  config[MAGIC_LEN + 2] = gap_us >> 16;
+  config[MAGIC_LEN + 3] = 1;
+  if ( !write_all(dev->fd, config, sizeof(config)) ) return false;
+
+  // The device answers a config packet with a single byte once it applies it
+  struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+  uint8_t ack;
+  if ( poll(&pfd, 1, 1000) != 1 || read(dev->fd, &ack, 1) != 1 )
+  {
+    fprintf(stderr, "%s: no answer to the config packet\n", path);
+    return false;
+  }
+  return true;
+}
+
+static bool device_write(device_t *dev, uint8_t const *src, size_t len)
+{
+  if ( dev->fd >= 0 ) return write_all(dev->fd, src, len);
+
+  if ( dev->loop_len + len > LOOP_SIZE ) return false;
+  for ( size_t i = 0; i < len; i++ )
+    dev->loop[(dev->loop_head + dev->loop_len + i) % LOOP_SIZE] = src[i];
+  dev->loop_len += len;
+  return true;
+}
+
+// When the stand-in exchanges its next byte, 0 for never
+static uint64_t device_deadline(device_t const *dev)
+{
+  return dev->fd < 0 && dev->loop_len ? dev->loop_next : 0;
+}
+
+// Returns the number of bytes the Game Boy sent back, -1 once the device
+// is gone
+static ssize_t device_read(device_t *dev, uint8_t *dst, size_t len, uint64_t now)
+{
+  if ( dev->fd >= 0 )
+  {
+    ssize_t n = read(dev->fd, dst, len);
+    if ( n < 0 && (errno == EAGAIN || errno == EINTR) ) return 0;
+    return n > 0 ? n : -1;
+  }
+
+  // Paced like raw mode: a byte every gap_us while there are any, the
+  // first one straight away after a pause
+  size_t n = 0;
+  if ( dev->loop_next < now - dev->gap_us ) dev->loop_next = now;
+  while ( n < len && dev->loop_len && dev->loop_next <= now )
+  {
+    dst[n++] = dev->loop[dev->loop_head];
+    dev->loop_head = (dev->loop_head + 1) % LOOP_SIZE;
+    dev->loop_len--;
+    dev->loop_next += dev->gap_us;
+  }
+  return n;
+}
+
+//--------------------------------------------------------------------+
+// Network
+//--------------------------------------------------------------------+
+
+static bool sendq_flush(int sock, uint64_t now, bool force)
+{
+  while ( sendq_len && (force || sendq[sendq_head].due <= now) )
+  {
+    segment_t const *seg = &sendq[sendq_head];
+    if ( !write_all(sock, seg->msg, seg->len) ) return false;
+    sendq_head = (sendq_head + 1) % SENDQ_LEN;
+    sendq_len--;
+    force = false;
+  }
+  return true;
+}
+
+static bool send_msg(int sock, options_t const *opts, uint8_t type, uint8_t const *src, size_t len)
+{
+  uint64_t now = now_us();
+  while ( len || type != MSG_DATA )
+  {
+    size_t n = len > MSG_MAX ? MSG_MAX : len;
+
+    // A full queue goes out early rather than holding up the link
+    if ( sendq_len == SENDQ_LEN && !sendq_flush(sock, now, true) ) return false;
+
+    segment_t *seg = &sendq[(sendq_head + sendq_len++) % SENDQ_LEN];
+    seg->due = now + opts->latency_us;
+    seg->len = MSG_HEADER + n;
+    seg->msg[0] = type;
+    seg->msg[1] = n;
+    memcpy(seg->msg + MSG_HEADER, src, n);
+    src += n;
+    len -= n;
+    if ( type != MSG_DATA ) break;
+  }
+  return sendq_flush(sock, now, false);
+}
+
+static int tcp_listen(char const *port)
+{
+  struct addrinfo hints = { .ai_family = AF_INET6, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+  struct addrinfo *ai;
+  if ( getaddrinfo(NULL, port, &hints, &ai) ) return -1;
+
+  int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  int on = 1, off = 0;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  if ( s < 0 || bind(s, ai->ai_addr, ai->ai_addrlen) || listen(s, 1) )
+  {
+    freeaddrinfo(ai);
+    return -1;
+  }
+  freeaddrinfo(ai);
+  return s;
+}
+
+static int tcp_connect(char const *host, char const *port)
+{
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+  struct addrinfo *ai;
+  if ( getaddrinfo(host, port, &hints, &ai) ) return -1;
+
+  int s = -1;
+  for ( struct addrinfo *p = ai; p; p = p->ai_next )
+  {
+    s = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if ( s >= 0 && connect(s, p->ai_addr, p->ai_addrlen) == 0 ) break;
+    if ( s >= 0 ) close(s);
+    s = -1;
+  }
+  freeaddrinfo(ai);
+  return s;
+}
+
+static void tcp_setup(int sock)
+{
+  // Link bytes trickle out one exchange at a time, never hold them back
+  int on = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+//--------------------------------------------------------------------+
+// Relay
+//--------------------------------------------------------------------+
+
+static bool relay(device_t *dev, int sock, options_t const *opts, result_t *result)
+{
+  uint8_t in[4096];
+  size_t in_len = 0;
+  bool primed = false;
+  uint64_t start = now_us();
+  uint64_t end = opts->seconds ? start + opts->seconds * 1e6 : 0;
+  bool ok = true;
+
+  memset(result, 0, sizeof(*result));
+  sendq_head = sendq_len = 0;
+  tcp_setup(sock);
+
+  uint8_t stamp[8];
+  for ( int i = 0; i < 8; i++ ) stamp[i] = start >> (8 * i);
+  if ( !send_msg(sock, opts, MSG_PING, stamp, sizeof(stamp)) ) return false;
+
+  for ( ;; )
+  {
+    uint64_t now = now_us();
+    if ( end && now >= end ) break;
+    if ( !sendq_flush(sock, now, false) ) return false;
+
+    // Sleep until the next thing that is due
+    uint64_t wake = end;
+    if ( sendq_len && (!wake || sendq[sendq_head].due < wake) ) wake = sendq[sendq_head].due;
+    uint64_t due = device_deadline(dev);
+    if ( due && (!wake || due < wake) ) wake = due;
+
+    struct timespec timeout = { 0 };
+    if ( wake > now )
+    {
+      timeout.tv_sec = (wake - now) / 1000000;
+      timeout.tv_nsec = (wake - now) % 1000000 * 1000;
+    }
+
+    struct pollfd pfd[2] = { { .fd = sock, .events = POLLIN }, { .fd = dev->fd, .events = POLLIN } };
+    if ( ppoll(pfd, dev->fd >= 0 ? 2 : 1, wake ? &timeout : NULL, NULL) < 0 && errno != EINTR ) return false;
+    now = now_us();
+
+    if ( pfd[0].revents )
+    {
+      ssize_t n = read(sock, in + in_len, sizeof(in) - in_len);
+      if ( n <= 0 ) break; // the other side is done
+      in_len += n;
+
+      size_t pos = 0;
+      while ( in_len - pos >= MSG_HEADER && in_len - pos >= (size_t) MSG_HEADER + in[pos + 1] )
+      {
+        uint8_t type = in[pos];
+        uint8_t len = in[pos + 1];
+        uint8_t const *payload = in + pos + MSG_HEADER;
+        pos += MSG_HEADER + len;
+
+        if ( type == MSG_DATA )
+        {
+          if ( !device_write(dev, payload, len) ) return false;
+        }
+        else if ( type == MSG_PING )
+        {
+          if ( !send_msg(sock, opts, MSG_PONG, payload, len) ) return false;
+        }
+        else if ( type == MSG_PONG && len == 8 && !primed )
+        {
+          uint64_t sent = 0;
+          for ( int i = 0; i < 8; i++ ) sent |= (uint64_t) payload[i] << (8 * i);
+          result->rtt_us = now - sent;
+
+          // Both sides prime, between them they fill the round trip
+          result->depth = opts->depth;
+          if ( !result->depth ) result->depth = result->rtt_us / (2 * opts->gap_us) + 1;
+          if ( result->depth > MAX_DEPTH ) result->depth = MAX_DEPTH;
+
+          uint8_t idle[MAX_DEPTH];
+          memset(idle, opts->idle, result->depth);
+          if ( !device_write(dev, idle, result->depth) ) return false;
+          primed = true;
+          start = now;
+        }
+      }
+      memmove(in, in + pos, in_len - pos);
+      in_len -= pos;
+    }
+
+    uint8_t got[MSG_MAX];
+    ssize_t n = device_read(dev, got, sizeof(got), now);
+    if ( n < 0 )
+    {
+      ok = false;
+      break;
+    }
+    if ( n && !send_msg(sock, opts, MSG_DATA, got, n) ) return false;
+    if ( primed ) result->bytes += n;
+  }
+
+  result->elapsed = primed ? (now_us() - start) / 1e6 : 0;
+  while ( sendq_len && sendq_flush(sock, 0, true) )
+    ;
+  return ok;
+}
+
+static double bench_run(options_t opts)
+{
+  static device_t a, b;
+  result_t result;
+
+  int lsock = tcp_listen("0");
+  struct sockaddr_in6 addr;
+  socklen_t addr_len = sizeof(addr);
+  if ( lsock < 0 || getsockname(lsock, (struct sockaddr *) &addr, &addr_len) ) return -1;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", ntohs(addr.sin6_port));
+
+  pid_t pid = fork();
+  if ( pid == 0 )
+  {
+    int s = accept(lsock, NULL, NULL);
+    device_open(&b, "loop", opts.gap_us);
+    relay(&b, s, &opts, &result);
+    _exit(0);
+  }
+  close(lsock);
+
+  int s = tcp_connect("localhost", port);
+  device_open(&a, "loop", opts.gap_us);
+  bool ok = s >= 0 && relay(&a, s, &opts, &result);
+  if ( s >= 0 ) close(s);
+  waitpid(pid, NULL, 0);
+
+  if ( !ok || !result.elapsed ) return -1;
+  printf("%10.1f %6d %10.0f\n", opts.latency_us / 1000.0, result.depth, result.bytes / result.elapsed);
+  return 0;
+}
+
+static int bench(options_t opts)
+{
+  static uint32_t const latencies_ms[] = { 0, 1, 2, 5, 10, 20, 50 };
+
+  printf("gap %u us, at most %.0f bytes/s\n", opts.gap_us, 1e6 / opts.gap_us);
+  printf("latency_ms  depth    bytes/s\n");
+  for ( size_t i = 0; i < sizeof(latencies_ms) / sizeof(latencies_ms[0]); i++ )
+  {
+    opts.latency_us = latencies_ms[i] * 1000;
+    for ( int depth = 1; depth >= 0; depth-- )
+    {
+      opts.depth = depth;
+      if ( bench_run(opts) ) return 1;
+    }
+  }
+  return 0;
+}
+
+static void usage(char const *name)
+{
+  fprintf(stderr,
+          "usage: %s [-g gap_us] [-d depth] [-i idle] [-l latency_ms] device listen port\n"
+          "       %s [...] device connect host port\n"
+          "       %s bench [-g gap_us] [-t seconds]\n",
+          name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+  options_t opts = { .gap_us = 1000, .depth = 0, .idle = 0x00, .latency_us = 0, .seconds = 0 };
+  char const *name = argv[0];
+  bool benching = argc > 1 && !strcmp(argv[1], "bench");
+  if ( benching )
+  {
+    opts.seconds = 2;
+    argv++;
+    argc--;
+  }
+
+  int c;
+  while ( (c = getopt(argc, argv, "g:d:i:l:t:")) != -1 )
+  {
+    switch ( c )
+    {
+      case 'g': opts.gap_us = strtoul(optarg, NULL, 0); break;
+      case 'd': opts.depth = strtol(optarg, NULL, 0); break;
+      case 'i': opts.idle = strtoul(optarg, NULL, 0); break;
+      case 'l': opts.latency_us = strtod(optarg, NULL) * 1000; break;
+      case 't': opts.seconds = strtod(optarg, NULL); break;
+      default: usage(name); return 2;
+    }
+  }
+  if ( !opts.gap_us || opts.gap_us > 0xFFFFFE ) opts.gap_us = 1000;
+
+  signal(SIGPIPE, SIG_IGN);
+  if ( benching ) return bench(opts);
+
+  argv += optind;
+  argc -= optind;
+  bool listening = argc == 3 && !strcmp(argv[1], "listen");
+  if ( !listening && !(argc == 4 && !strcmp(argv[1], "connect")) )
+  {
+    usage(name);
+    return 2;
+  }
+
+  static device_t dev;
+  if ( !device_open(&dev, argv[0], opts.gap_us) )
+  {
+    perror(argv[0]);
+    return 1;
+  }
+
+  int sock;
+  if ( listening )
+  {
+    int lsock = tcp_listen(argv[2]);
+    sock = lsock < 0 ? -1 : accept(lsock, NULL, NULL);
+    if ( lsock >= 0 ) close(lsock);
+  }
+  else
+  {
+    sock = tcp_connect(argv[2], argv[3]);
+  }
+  if ( sock < 0 )
+  {
+    perror("linkrelay");
+    return 1;
+  }
+
+  result_t result;
+  bool ok = relay(&dev, sock, &opts, &result);
+  close(sock);
+  fprintf(stderr, "rtt %.1f ms, depth %d, %lu bytes in %.1f s\n",
+          result.rtt_us / 1000.0, result.depth, result.bytes, result.elapsed);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,1457 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Link timing simulator. Runs the firmware's data path on the host against
+ * models of what it talks to, in simulated time, and reports what the link
+ * does with it: bytes per second, the SCK timing of every byte, and how
+ * long host data waits between arriving over USB and going out on the wire.
+ *
+ * The link core's raw and framed EXCHANGE paths (raw_task(), burst_step(),
+ * frame_begin(), frame_dispatch() and frame_record() in link_engine.c) and
+ * the USB core's (link_input_buffer() and data_transfer_task() in main.c)
+ * are followed as written, on the real link_pacer.c, spsc_ring.c and
+ * link_proto.c. Around them:
+ *
+ * - spi_cpha1 from spi.pio, cycle by cycle at the divider
+ *   pio_spi_set_rate() picks: 4 SM cycles a bit, autopull and autopush at
+ *   8 bits, stalling with SCK idle when the TX FIFO is empty. DMA fills and
+ *   drains the FIFOs as soon as they have room or data.
+ * - A full speed USB bus, one 64 byte bulk packet each way every
+ *   packet_us at best, into and out of the class drivers' FIFOs: 512
+ *   bytes as USB_PROFILE_THROUGHPUT in tusb_config.h sets them, 64 with
+ *   -U as USB_PROFILE_COMPACT does. A packet comes in once its FIFO has
+ *   room for a whole one, as the drivers only then queue the next read.
+ * - Each core running its loop every so often, with jitter.
+ * - A Game Boy that answers every byte with the last one it took, or
+ *   with 0xFF, not taking it, if it comes less than need_us after the
+ *   byte before.
+ *
+ * With -G the link core's GBA mode, gba_task(), runs instead, on the 16
+ * bit DMA and gba_multi.pio instruction by instruction, delays, stalls and
+ * the slot count in the OSR included. children GBAs fill the first child
+ * slots, each starting its frame CHILD_DELAY_PS after its SI goes low and
+ * sending the parent's data plus its slot number; the slots after them
+ * must time out and read 0xFFFF.
+ *
+ *   cc -O2 -I. -o linksim tools/linksim.c link_pacer.c spsc_ring.c link_proto.c
+ *   linksim [-f] [-i] [-U] [-G children] [-n count] [-c sck_hz] [-b bytes_per_transfer]
+ *           [-g gap_us] [-r records] [-P need_us] [-u packet_us]
+ *           [-l core0_loop_us] [-k core1_loop_ns] [-s seed]
+ *   linksim -t
+ *
+ * The host sends count bytes, in raw mode by default. -f sends them in
+ * EXCHANGE frames of records records of bytes_per_transfer bytes each; -i
+ * waits for the reply to each chunk or frame before it sends the next, as
+ * an interactive game does, rather than streaming. The defaults are the
+ * firmware's: 1 byte chunks 1000 us apart at the boot SCK rate, one
+ * packet a chunk in GBA mode.
+ *
+ * cdc_task() and webserial_task() are the same code on the firmware side,
+ * on FIFOs of the same size; what tells CDC and vendor apart is inside
+ * TinyUSB, which is not modelled. Comparing a run with -U and one without
+ * gives the buffering profiles' sustained host to host rates.
+ *
+ * Besides the figures it counts the bytes the Game Boy did not take and
+ * the zeroes handle_input_data() padded a chunk out with: a USB read that
+ * ends inside a chunk gets them, not only the host's last chunk. It also
+ * counts core 0's share of each byte, bytes stored and TinyUSB calls, next
+ * to what the copying path it replaced did for the same reads and writes.
+ * Host cycles would say little about a Cortex-M0+ running TinyUSB out of
+ * flash, so it is the work that is compared, not the time it takes.
+ *
+ * Runs are deterministic for a seed, so two builds can be compared figure
+ * by figure. The exit status is 1 if the run stalled or a reply came back
+ * other than the Game Boy model sent it, both of which point at the data
+ * path rather than at its timing.
+ *
+ * -t runs a set of checks instead: raw and framed runs must get every
+ * reply back, and back to back bursts must keep the SM from stalling
+ * inside a transfer and go out at the SCK rate, up to the fastest one.
+ * GBA runs with each number of children must read every slot right, an
+ * empty one taking the timeout where a child would have sent its frame.
+ * Prints each failed check and exits 1 if there was one.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "link_pacer.h"
+#include "link_proto.h"
+#include "spsc_ring.h"
+
+// As in link_engine.h, spi.pio and tusb_config.h
+#define RING_SIZE      1024
+#define MAX_CHUNK      0x40
+#define DEFAULT_DIV256 ((uint32_t) (4058.838 / 128 * 256))
+#define CYCLES_PER_BIT 4
+#define PIO_FIFO_DEPTH 4
+#define USB_PACKET     64
+#define USB_FIFO       (8 * USB_PACKET)
+
+#define SYS_HZ    125000000ull
+#define PS_PER_US 1000000ull
+#define PS_PER_NS 1000ull
+
+// Give up on a run that has made no progress for this long
+#define STALL_PS (10 * 1000 * 1000 * PS_PER_US)
+
+// The options, see defaults()
+static bool framed, interactive, compact, gba;
+static uint32_t children, count, div256, bytes_per_transfer, gap_us, records, need_us;
+static uint32_t packet_us, core0_loop_us, core1_loop_ns, rng;
+
+static void defaults(void)
+{
+  framed = interactive = compact = gba = false;
+  children = 0;
+  count = 4096;
+  div256 = DEFAULT_DIV256;
+  bytes_per_transfer = 1;
+  gap_us = 1000;
+  records = 1;
+  need_us = 0;
+  packet_us = 53;                     // 19 bulk packets a frame, the most full speed gives one pipe
+  core0_loop_us = 20;
+  core1_loop_ns = 1000;
+  rng = 1;
+}
+
+// pio_spi_set_rate()
+static void sck_set(uint32_t hz)
+{
+  uint64_t div = SYS_HZ * 256 / ((uint64_t) hz * CYCLES_PER_BIT);
+  div256 = div < 256 ? 256 : div > 0xFFFF00 ? 0xFFFF00 : div;
+}
+
+static double sck_hz(void)
+{
+  return (double) SYS_HZ * 256 / div256 / CYCLES_PER_BIT;
+}
+
+static uint64_t now;                  // ps
+
+static uint32_t random_below(uint32_t n)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % n;
+}
+
+static uint64_t now_us(void)
+{
+  return now / PS_PER_US;
+}
+
+//--------------------------------------------------------------------+
+// Samples
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint64_t *v;
+  uint32_t n, max;
+} samples_t;
+
+static samples_t latency, byte_time, gap_inside, gap_between, round_trip, packet_time;
+
+static void sample(samples_t *s, uint64_t ps)
+{
+  if ( s->n == s->max )
+  {
+    s->max = s->max ? s->max * 2 : 1024;
+    s->v = realloc(s->v, s->max * sizeof(*s->v));
+  }
+  s->v[s->n++] = ps;
+}
+
+static int compare(void const *a, void const *b)
+{
+  uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+  return x < y ? -1 : x > y;
+}
+
+// p in thousandths
+static double percentile_us(samples_t *s, uint32_t p)
+{
+  return s->n ? (double) s->v[(uint64_t) (s->n - 1) * p / 1000] / PS_PER_US : 0;
+}
+
+static void print_samples(char const *name, samples_t *s)
+{
+  if ( !s->n )
+  {
+    printf("%-15s none\n", name);
+    return;
+  }
+  qsort(s->v, s->n, sizeof(*s->v), compare);
+  printf("%-15s min %9.1f  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f us\n", name,
+         percentile_us(s, 0), percentile_us(s, 500), percentile_us(s, 900), percentile_us(s, 990),
+         percentile_us(s, 1000));
+}
+
+//--------------------------------------------------------------------+
+// FIFOs, PIO and USB alike, each byte with the time it came in
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint8_t data[USB_FIFO];
+  uint64_t stamp[USB_FIFO];
+  uint8_t first[USB_FIFO];  // starts a burst
+  uint32_t head, len, size;
+} fifo_t;
+
+static void fifo_put(fifo_t *f, uint8_t b, uint64_t stamp, bool first)
+{
+  uint32_t i = (f->head + f->len++) % f->size;
+  f->data[i] = b;
+  f->stamp[i] = stamp;
+  f->first[i] = first;
+}
+
+static uint8_t fifo_take(fifo_t *f, uint64_t *stamp, bool *first)
+{
+  uint8_t b = f->data[f->head];
+  if ( stamp ) *stamp = f->stamp[f->head];
+  if ( first ) *first = f->first[f->head];
+  f->head = (f->head + 1) % f->size;
+  f->len--;
+  return b;
+}
+
+static fifo_t txf = { .size = PIO_FIFO_DEPTH }, rxf = { .size = PIO_FIFO_DEPTH };
+static fifo_t usb_out = { .size = USB_FIFO }, usb_in = { .size = USB_FIFO };
+
+//--------------------------------------------------------------------+
+// Rings between the cores, with the time each byte of link_tx_ring came
+// in over USB, by its position in the stream
+//--------------------------------------------------------------------+
+
+static spsc_ring_t tx_ring, rx_ring;
+static uint8_t tx_buf[RING_SIZE], rx_buf[RING_SIZE];
+static uint64_t tx_stamp[RING_SIZE];
+static uint32_t tx_put, tx_taken;    // stream positions in and out of tx_ring
+static uint32_t padded;
+
+//--------------------------------------------------------------------+
+// DMA and spi_cpha1
+//--------------------------------------------------------------------+
+
+static struct
+{
+  uint8_t const *src;
+  uint8_t *dst;
+  uint32_t tx_left, rx_left, sent;
+  uint32_t pos;                       // stream position of src[0]
+  bool first;                         // the segment starts a burst
+} dma;
+
+static struct
+{
+  int pc;                             // out, mov, mov's delay, in
+  bool pushing;                       // in stalled on a full RX FIFO
+  uint8_t osr, isr, out;
+  int osr_bits, isr_bits;
+  uint8_t bit;                        // X
+  uint64_t stamp;
+  bool first;
+  uint64_t byte_start, first_start, last_end;
+  bool any;
+  uint64_t cycles, stall_cycles;
+} sm;
+
+static void dma_start(uint8_t const *src, uint8_t *dst, uint32_t len, uint32_t pos, bool first)
+{
+  dma.src = src;
+  dma.dst = dst;
+  dma.tx_left = dma.rx_left = len;
+  dma.sent = 0;
+  dma.pos = pos;
+  dma.first = first;
+}
+
+static void dma_service(void)
+{
+  while ( dma.tx_left && txf.len < txf.size )
+  {
+    fifo_put(&txf, dma.src[dma.sent], tx_stamp[(dma.pos + dma.sent) % RING_SIZE],
+             dma.first && !dma.sent);
+    dma.sent++;
+    dma.tx_left--;
+  }
+  while ( dma.rx_left && rxf.len )
+  {
+    *dma.dst++ = fifo_take(&rxf, NULL, NULL);
+    dma.rx_left--;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Game Boy
+//--------------------------------------------------------------------+
+
+static struct
+{
+  uint8_t last;                       // the last byte taken, sent back next
+  uint8_t sending;
+  bool ready;
+  uint64_t last_end;
+  bool any;
+  uint32_t dropped;
+} peer;
+
+// First edge of a byte: ready for it or not
+static void peer_begin(void)
+{
+  peer.ready = !peer.any || now - peer.last_end >= need_us * PS_PER_US;
+  peer.sending = peer.ready ? peer.last : 0xFF;
+}
+
+static void peer_end(uint8_t got)
+{
+  if ( peer.ready )
+    peer.last = got;
+  else
+    peer.dropped++;
+  peer.last_end = now;
+  peer.any = true;
+}
+
+// One SM cycle of spi_cpha1
+static void sm_step(void)
+{
+  sm.cycles++;
+
+  switch ( sm.pc )
+  {
+    case 0: // out x, 1 side 0, autopull
+      if ( !sm.osr_bits )
+      {
+        if ( !txf.len )
+        {
+          // Stalled with SCK idle. Only counts inside a transfer.
+          if ( dma.sent ) sm.stall_cycles += dma.rx_left != 0;
+          return;
+        }
+        sm.out = sm.osr = fifo_take(&txf, &sm.stamp, &sm.first);
+        sm.osr_bits = 8;
+      }
+      sm.bit = sm.osr >> 7;
+      sm.osr <<= 1;
+      sm.osr_bits--;
+      sm.pc = 1;
+      return;
+
+    case 1: // mov pins, x side 1: the leading edge
+      if ( sm.osr_bits == 7 )
+      {
+        sm.byte_start = now;
+        if ( !latency.n ) sm.first_start = now;
+        peer_begin();
+        sample(&latency, now - sm.stamp);
+        if ( sm.any ) sample(sm.first ? &gap_between : &gap_inside, now - sm.last_end);
+      }
+      sm.pc = 2;
+      return;
+
+    case 2: // [1]
+      sm.pc = 3;
+      return;
+
+    case 3: // in pins, 1 side 0: the trailing edge, autopush
+      if ( !sm.pushing )
+      {
+        sm.isr = sm.isr << 1 | ((peer.sending >> (7 - sm.isr_bits)) & 1);
+        sm.pushing = ++sm.isr_bits == 8;
+        if ( !sm.pushing )
+        {
+          sm.pc = 0;
+          return;
+        }
+      }
+      if ( rxf.len == rxf.size )
+      {
+        sm.stall_cycles++;
+        return;
+      }
+      fifo_put(&rxf, sm.isr, now, false);
+      sm.isr_bits = 0;
+      sm.pushing = false;
+      sample(&byte_time, now - sm.byte_start);
+      sm.last_end = now;
+      sm.any = true;
+      peer_end(sm.out);
+      sm.pc = 0;
+      return;
+  }
+}
+
+static uint64_t sm_cycle_time(uint64_t cycle)
+{
+  // div256 / 256 system clocks of 8000 ps each
+  return cycle * div256 * 125 / 4;
+}
+
+//--------------------------------------------------------------------+
+// Core 1, link_engine.c
+//--------------------------------------------------------------------+
+
+static link_pacer_t pacer;
+static uint32_t burst_left, burst_gap_us, on_wire;
+static bool burst_new;
+
+static bool burst_active(void)
+{
+  return burst_left || on_wire;
+}
+
+static void burst_begin(uint32_t len, uint32_t gap)
+{
+  burst_left = len;
+  burst_gap_us = gap;
+  burst_new = true;
+  if ( !len ) link_pacer_done(&pacer, now_us(), gap);
+}
+
+static bool burst_step(void)
+{
+  if ( on_wire )
+  {
+    if ( dma.rx_left ) return false;
+
+    spsc_ring_consume(&tx_ring, on_wire);
+    tx_taken += on_wire;
+    spsc_ring_commit(&rx_ring, on_wire);
+    on_wire = 0;
+
+    if ( !burst_left )
+    {
+      link_pacer_done(&pacer, now_us(), burst_gap_us);
+      return true;
+    }
+  }
+
+  if ( !burst_left ) return true;
+
+  uint8_t *dst;
+  uint8_t const *src;
+  uint32_t space = spsc_ring_reserve(&rx_ring, &dst);
+  uint32_t len = spsc_ring_peek(&tx_ring, &src);
+  if ( len > space ) len = space;
+  if ( len > burst_left ) len = burst_left;
+  if ( !len ) return false;
+
+  burst_left -= len;
+  on_wire = len;
+  dma_start(src, dst, len, tx_taken, burst_new);
+  burst_new = false;
+  return false;
+}
+
+static void raw_task(void)
+{
+  if ( burst_active() )
+  {
+    burst_step();
+    return;
+  }
+
+  if ( !link_pacer_due(&pacer, now_us()) ) return;
+
+  uint32_t len = spsc_ring_available(&tx_ring);
+  if ( len > bytes_per_transfer ) len = bytes_per_transfer;
+  if ( !len ) return;
+
+  burst_begin(len, gap_us);
+  burst_step();
+}
+
+typedef enum
+{
+  FRAME_HEADER,
+  FRAME_DISPATCH,
+  FRAME_RECORD,
+  FRAME_EXCHANGE
+} frame_state_t;
+
+static frame_state_t frame_state;
+static link_frame_t frame;
+static uint32_t frame_left;
+static link_exchange_t record;
+static uint32_t frame_errors;
+
+static void framed_task(void)
+{
+  uint8_t header[LINK_PROTO_HEADER_LEN];
+  uint8_t const *sync;
+
+  switch ( frame_state )
+  {
+    case FRAME_HEADER:
+      if ( spsc_ring_available(&tx_ring) < LINK_PROTO_HEADER_LEN ) return;
+      spsc_ring_peek(&tx_ring, &sync);
+      if ( *sync != LINK_PROTO_SYNC )
+      {
+        spsc_ring_consume(&tx_ring, 1);
+        tx_taken++;
+        frame_errors++;
+        return;
+      }
+      spsc_ring_pop(&tx_ring, header, sizeof(header));
+      tx_taken += sizeof(header);
+      link_proto_get_header(header, &frame);
+      frame_left = frame.len;
+      frame_state = FRAME_DISPATCH;
+      return;
+
+    case FRAME_DISPATCH:
+      // The host here only ever sends EXCHANGE
+      if ( spsc_ring_free(&rx_ring) < LINK_PROTO_HEADER_LEN + LINK_PROTO_STATS_LEN ) return;
+      if ( frame.opcode != LINK_OP_EXCHANGE ) frame_errors++;
+      link_proto_put_header(header, frame.opcode | LINK_OP_REPLY, frame.seq, frame.len);
+      spsc_ring_push(&rx_ring, header, sizeof(header));
+      frame_state = FRAME_RECORD;
+      return;
+
+    case FRAME_RECORD:
+      if ( frame_left < LINK_PROTO_RECORD_LEN )
+      {
+        // No trailing bytes from this host
+        frame_errors += frame_left != 0;
+        frame_state = FRAME_HEADER;
+        return;
+      }
+      if ( spsc_ring_available(&tx_ring) < LINK_PROTO_RECORD_LEN ) return;
+      if ( spsc_ring_free(&rx_ring) < LINK_PROTO_RECORD_LEN ) return;
+
+      spsc_ring_pop(&tx_ring, header, LINK_PROTO_RECORD_LEN);
+      tx_taken += LINK_PROTO_RECORD_LEN;
+      link_proto_get_exchange_header(header, &record);
+      frame_left -= LINK_PROTO_RECORD_LEN;
+      if ( record.len > frame_left )
+      {
+        record.len = frame_left;
+        frame_errors++;
+      }
+      frame_left -= record.len;
+      link_proto_put_exchange(header, record.len, record.gap_us, NULL);
+      spsc_ring_push(&rx_ring, header, LINK_PROTO_RECORD_LEN);
+      frame_state = FRAME_EXCHANGE;
+      return;
+
+    case FRAME_EXCHANGE:
+      if ( !burst_active() )
+      {
+        if ( !link_pacer_due(&pacer, now_us()) ) return;
+        burst_begin(record.len, record.gap_us);
+      }
+      if ( burst_step() )
+        frame_state = FRAME_RECORD;
+      return;
+  }
+}
+
+//--------------------------------------------------------------------+
+// GBA mode: gba_task(), its DMA, gba_multi.pio and the children
+//--------------------------------------------------------------------+
+
+// As in link_engine.h, pio_gba.h and gba_multi.pio
+#define GBA_BAUD           115200
+#define GBA_TIMEOUT_BITS   32
+#define GBA_SEND_LEN       2
+#define GBA_SLOTS          4
+#define GBA_REPLY_LEN      (2 * GBA_SLOTS)
+#define GBA_CYCLES_PER_BIT 8
+#define GBA_MAX_PACKETS    (MAX_CHUNK / GBA_SEND_LEN)
+
+// Start bit, 16 data bits and stop bit, at the GBA's own clock
+#define GBA_FRAME_BITS 18
+#define GBA_BIT_PS     (1000000 * PS_PER_US / GBA_BAUD)
+#define CHILD_DELAY_PS (2 * PS_PER_US)
+#define NEVER          UINT64_MAX
+
+typedef struct
+{
+  uint32_t data[PIO_FIFO_DEPTH];
+  uint32_t head, len;
+} word_fifo_t;
+
+static word_fifo_t gba_txf, gba_rxf;
+
+static void word_put(word_fifo_t *f, uint32_t w)
+{
+  f->data[(f->head + f->len++) % PIO_FIFO_DEPTH] = w;
+}
+
+static uint32_t word_take(word_fifo_t *f)
+{
+  uint32_t w = f->data[f->head];
+  f->head = (f->head + 1) % PIO_FIFO_DEPTH;
+  f->len--;
+  return w;
+}
+
+static struct
+{
+  uint16_t const *src;
+  uint16_t *dst;
+  uint32_t tx_left, rx_left;
+} gba_dma;
+
+static struct
+{
+  int pc, delay;
+  uint32_t osr, isr, x, y;
+  int osr_bits;                       // shifted out since the last pull or mov, 32 at most
+  bool sd_out, sd_dir;                // SD as the SM drives it
+  uint16_t parent;                    // the parent's data this transfer
+  uint64_t child_start[GBA_SLOTS];    // when each child starts its frame
+  uint64_t start;                     // SC went low
+  uint32_t timeouts, transfers;
+} gsm;
+
+// 16 bit DMA writes are halfword-replicated, reads take the top halfword
+static void gba_dma_service(void)
+{
+  while ( gba_dma.tx_left && gba_txf.len < PIO_FIFO_DEPTH )
+  {
+    word_put(&gba_txf, *gba_dma.src++ * 0x00010001u);
+    gba_dma.tx_left--;
+  }
+  while ( gba_dma.rx_left && gba_rxf.len )
+  {
+    *gba_dma.dst++ = word_take(&gba_rxf) >> 16;
+    gba_dma.rx_left--;
+  }
+}
+
+// SD: the SM while it drives it, else whichever child is sending, else
+// the pull-up
+static bool gba_sd(void)
+{
+  if ( gsm.sd_dir ) return gsm.sd_out;
+
+  for ( uint32_t k = 1; k <= children; k++ )
+  {
+    uint64_t start = gsm.child_start[k];
+    if ( now < start || now >= start + GBA_FRAME_BITS * GBA_BIT_PS ) continue;
+
+    uint32_t bit = (now - start) / GBA_BIT_PS;
+    uint16_t value = gsm.parent + k;
+    return bit == 0 ? false : bit == GBA_FRAME_BITS - 1 ? true : (value >> (bit - 1)) & 1;
+  }
+  return true;
+}
+
+// SO went low: each child in turn, once the one before it has sent
+static void gba_children_start(void)
+{
+  uint64_t si_low = now;
+  for ( uint32_t k = 1; k < GBA_SLOTS; k++ )
+  {
+    gsm.child_start[k] = k <= children ? si_low + CHILD_DELAY_PS : NEVER;
+    if ( k <= children ) si_low = gsm.child_start[k] + GBA_FRAME_BITS * GBA_BIT_PS;
+  }
+}
+
+// out, shifting right
+static uint32_t gba_out(uint32_t n)
+{
+  uint32_t v = n == 32 ? gsm.osr : gsm.osr & ((1u << n) - 1);
+  gsm.osr = n == 32 ? 0 : gsm.osr >> n;
+  gsm.osr_bits = gsm.osr_bits + n > 32 ? 32 : gsm.osr_bits + (int) n;
+  return v;
+}
+
+// jmp x--: taken while X was not zero, X goes down either way
+static bool gba_x_dec(void)
+{
+  return gsm.x-- != 0;
+}
+
+// One SM cycle of gba_multi, the program's instructions by their index
+static void gba_step(void)
+{
+  sm.cycles++;
+  if ( gsm.delay )
+  {
+    gsm.delay--;
+    return;
+  }
+
+  int next = gsm.pc + 1;
+  int delay = 0;
+  switch ( gsm.pc )
+  {
+    case 0: // pull, idle with SC and SO high
+      if ( !gba_txf.len ) return;
+      gsm.osr = word_take(&gba_txf);
+      gsm.osr_bits = 0;
+      gsm.parent = gsm.osr;
+      break;
+    case 1: gsm.isr = gsm.osr; break;
+    case 2: gsm.osr = ~0u; gsm.osr_bits = 0; break;
+    case 3: gsm.sd_out = gba_out(1); break;
+    case 4: gsm.sd_dir = gba_out(1); break;
+    case 5: // set pins, 0 [7]: SC low
+      gsm.start = now;
+      delay = 7;
+      break;
+    case 6: gsm.osr = gsm.isr; gsm.osr_bits = 0; break;
+    case 7: // push
+    case 24:
+      if ( gba_rxf.len == PIO_FIFO_DEPTH ) return;
+      word_put(&gba_rxf, gsm.isr);
+      gsm.isr = 0;
+      break;
+    case 8: gsm.x = 15; break;
+    case 9: gsm.sd_out = false; delay = 7; break;
+    case 10: gsm.sd_out = gba_out(1); delay = 6; break;
+    case 11: if ( gba_x_dec() ) next = 10; break;
+    case 12: gsm.sd_out = true; delay = 7; break;
+    case 13: // mov osr, null side 0: SO low
+      gsm.osr = 0;
+      gsm.osr_bits = 0;
+      gba_children_start();
+      break;
+    case 14: gsm.sd_dir = gba_out(1); break;
+    case 15: gsm.x = gsm.y; break;
+    case 16: next = gba_x_dec() ? 19 : 17; break;
+    case 17: gsm.isr = ~0u; gsm.timeouts++; break;
+    case 18: next = 24; break;
+    case 19: if ( gba_sd() ) next = 16; break;
+    case 20: gsm.x = 15; delay = 9; break;
+    case 21: gsm.isr = gsm.isr >> 1 | (uint32_t) gba_sd() << 31; break;
+    case 22: if ( gba_x_dec() ) next = 21; delay = 6; break;
+    case 23: if ( !gba_sd() ) return; break;
+    case 25: gba_out(11); break;
+    case 26: if ( gsm.osr_bits < 32 ) next = 15; break;
+    case 27: // set pins, 1 side 1: SC and SO high, done
+      for ( uint32_t k = 0; k < GBA_SLOTS; k++ )
+        gsm.child_start[k] = NEVER;
+      sample(&packet_time, now - gsm.start);
+      gsm.transfers++;
+      next = 0;
+      break;
+  }
+  gsm.pc = next;
+  gsm.delay = delay;
+}
+
+// gba_multi_program_init()'s divider
+static void gba_rate(void)
+{
+  div256 = SYS_HZ * 256 / (GBA_CYCLES_PER_BIT * GBA_BAUD);
+}
+
+static uint16_t gba_send[GBA_MAX_PACKETS];
+static uint16_t gba_slots[GBA_MAX_PACKETS * GBA_SLOTS];
+
+// gba_task(): a chunk's packets at a time, with on_wire counting the
+// packets in flight
+static void gba_task(void)
+{
+  if ( on_wire )
+  {
+    if ( gba_dma.rx_left ) return;
+
+    spsc_ring_push(&rx_ring, (uint8_t const *) gba_slots, on_wire * GBA_REPLY_LEN);
+    on_wire = 0;
+    link_pacer_done(&pacer, now_us(), gap_us);
+    return;
+  }
+
+  if ( !link_pacer_due(&pacer, now_us()) ) return;
+
+  uint32_t packets = spsc_ring_available(&tx_ring) / GBA_SEND_LEN;
+  if ( !packets ) return;
+
+  uint32_t chunk = bytes_per_transfer / GBA_SEND_LEN;
+  if ( !chunk ) chunk = 1;
+  if ( packets > chunk ) packets = chunk;
+
+  uint32_t room = spsc_ring_free(&rx_ring) / GBA_REPLY_LEN;
+  if ( packets > room ) packets = room;
+  if ( !packets ) return;
+
+  spsc_ring_pop(&tx_ring, (uint8_t *) gba_send, packets * GBA_SEND_LEN);
+  tx_taken += packets * GBA_SEND_LEN;
+  on_wire = packets;
+
+  // pio_gba_dma_start()
+  gba_dma.src = gba_send;
+  gba_dma.dst = gba_slots;
+  gba_dma.tx_left = packets;
+  gba_dma.rx_left = packets * GBA_SLOTS;
+}
+
+//--------------------------------------------------------------------+
+// Core 0, main.c
+//--------------------------------------------------------------------+
+
+// What went into link_tx_ring, in order, padding included. In raw mode
+// the reply to each byte comes back at the same position.
+static struct
+{
+  uint8_t *data;
+  bool *pad;
+  uint32_t len, max;
+} queued;
+
+static void queue_byte(uint8_t b, uint64_t stamp, bool pad)
+{
+  if ( queued.len == queued.max )
+  {
+    queued.max = queued.max ? queued.max * 2 : 4096;
+    queued.data = realloc(queued.data, queued.max);
+    queued.pad = realloc(queued.pad, queued.max * sizeof(*queued.pad));
+  }
+  queued.data[queued.len] = b;
+  queued.pad[queued.len++] = pad;
+
+  tx_stamp[tx_put++ % RING_SIZE] = stamp;
+  spsc_ring_push(&tx_ring, &b, 1);
+}
+
+//--------------------------------------------------------------------+
+// Core 0's share of each byte, and what the copying path took before
+// link_input_buffer() and the ring peek for the same data
+//--------------------------------------------------------------------+
+
+// Bytes core 0 stores and TinyUSB calls it makes, per byte each way. The
+// old path read up to 128 bytes at a time into a stack buffer, zeroed the
+// rest of it and copied the chunks, padding and all, into link_tx_ring;
+// replies were popped into another stack buffer and went into the CDC FIFO
+// a tud_cdc_write_char() each.
+static struct
+{
+  uint64_t in, in_stored, in_calls, old_in_stored, old_in_calls;
+  uint64_t out, out_stored, out_calls, old_out_stored, old_out_calls;
+} work;
+
+static void work_read(uint32_t len, bool bounced, uint32_t pad, uint32_t chunk)
+{
+  work.in += len;
+  work.in_stored += (bounced ? 2 * len : len) + pad;
+  work.in_calls += 2;    // tud_cdc_available(), tud_cdc_read()
+
+  for ( uint32_t left = len; left; )
+  {
+    uint32_t n = left < MAX_CHUNK * 2 ? left : MAX_CHUNK * 2;
+    uint32_t submit = (n + chunk - 1) / chunk * chunk;
+    work.old_in_stored += MAX_CHUNK * 2 + (submit < MAX_CHUNK * 2 ? submit : MAX_CHUNK * 2);
+    work.old_in_calls += 2;
+    left -= n;
+  }
+}
+
+static void work_write(uint32_t len)
+{
+  work.out += len;
+  work.out_stored += len;
+  work.out_calls += 3;    // tud_cdc_write_available(), tud_cdc_write(), flush
+
+  for ( uint32_t left = len; left; )
+  {
+    uint32_t n = left < MAX_CHUNK * 2 ? left : MAX_CHUNK * 2;
+    work.old_out_stored += 2 * n;
+    work.old_out_calls += n + 1;
+    left -= n;
+  }
+}
+
+static double per_byte(uint64_t v, uint64_t bytes)
+{
+  return bytes ? (double) v / bytes : 0;
+}
+
+// cdc_task() or webserial_task(), link_input_buffer() and
+// handle_input_data(): whole chunks
+// into link_tx_ring while it has room for them, the last of a read padded
+// out with zeroes
+static void cdc_task(void)
+{
+  uint32_t chunk = framed ? 1 : bytes_per_transfer;
+
+  while ( usb_out.len )
+  {
+    uint32_t space = spsc_ring_free(&tx_ring);
+    if ( space < chunk ) return;
+    space -= chunk - 1;
+
+    uint32_t len = usb_out.len;
+    if ( len > space ) len = space - space % chunk;
+
+    uint8_t *dst;
+    bool bounced = spsc_ring_reserve(&tx_ring, &dst) < len;
+    if ( bounced && len > MAX_CHUNK * 2 ) len = MAX_CHUNK * 2 - (MAX_CHUNK * 2) % chunk;
+    if ( !len ) return;
+
+    uint64_t stamp = 0;
+    for ( uint32_t i = 0; i < len; i++ )
+    {
+      uint8_t b = fifo_take(&usb_out, &stamp, NULL);
+      queue_byte(b, stamp, false);
+    }
+    uint32_t pad = len % chunk ? chunk - len % chunk : 0;
+    for ( uint32_t i = 0; i < pad; i++ )
+      queue_byte(0, stamp, true);
+    padded += pad;
+    work_read(len, bounced, pad, chunk);
+  }
+}
+
+// data_transfer_task(): as much of link_rx_ring as the IN FIFO takes
+static void data_transfer_task(void)
+{
+  for ( int pass = 0; pass < 2; pass++ )
+  {
+    uint8_t const *src;
+    uint32_t len = spsc_ring_peek(&rx_ring, &src);
+    if ( len > usb_in.size - usb_in.len ) len = usb_in.size - usb_in.len;
+    if ( !len ) break;
+
+    for ( uint32_t i = 0; i < len; i++ )
+      fifo_put(&usb_in, src[i], now, false);
+    spsc_ring_consume(&rx_ring, len);
+    work_write(len);
+  }
+}
+
+//--------------------------------------------------------------------+
+// Host
+//--------------------------------------------------------------------+
+
+static struct
+{
+  uint8_t *stream;                    // everything it sends
+  uint32_t len, sent, released;       // released: written by the application
+  uint32_t *unit_end;                 // stream end of each chunk or frame
+  uint64_t *unit_written;
+  uint32_t units, unit;               // unit: the next to be written
+
+  uint8_t *payload;                   // the data bytes in the order sent
+  uint32_t payload_len;
+
+  uint8_t *reply;                     // received, as it came in
+  uint32_t bytes_in;
+  uint32_t reply_len, reply_parsed;   // framed replies
+  uint32_t replies_in;                // data bytes of the replies, padding not counted
+  uint32_t units_in;
+  uint8_t peer_last;                  // byte the Game Boy should send back next
+  uint32_t wrong, not_ready, empty;
+  uint64_t last_in;
+} host;
+
+static void host_build(void)
+{
+  uint32_t chunk = bytes_per_transfer;
+  uint32_t per_unit = framed ? chunk * records : chunk;
+  host.units = (count + per_unit - 1) / per_unit;
+  host.unit_end = calloc(host.units, sizeof(*host.unit_end));
+  host.unit_written = calloc(host.units, sizeof(*host.unit_written));
+  uint32_t framing = host.units * (LINK_PROTO_HEADER_LEN + records * LINK_PROTO_RECORD_LEN);
+  host.stream = malloc(count + framing);
+  host.payload = malloc(count);
+  host.reply = malloc(count + framing);
+
+  // Never 0xFF, which is the Game Boy not being ready
+  for ( uint32_t i = 0; i < count; i++ )
+    host.payload[i] = i % 255;
+
+  uint32_t left = count, from = 0;
+  for ( uint32_t u = 0; u < host.units; u++ )
+  {
+    if ( !framed )
+    {
+      uint32_t n = left < chunk ? left : chunk;
+      memcpy(host.stream + host.len, host.payload + from, n);
+      host.len += n;
+      from += n;
+      left -= n;
+    }
+    else
+    {
+      uint8_t *header = host.stream + host.len;
+      uint32_t payload_len = 0;
+      host.len += LINK_PROTO_HEADER_LEN;
+      for ( uint32_t r = 0; r < records && left; r++ )
+      {
+        uint32_t n = left < chunk ? left : chunk;
+        uint8_t *dst = host.stream + host.len;
+        uint32_t put = link_proto_put_exchange(dst, n, gap_us, host.payload + from);
+        host.len += put;
+        payload_len += put;
+        from += n;
+        left -= n;
+      }
+      link_proto_put_header(header, LINK_OP_EXCHANGE, u, payload_len);
+    }
+    host.unit_end[u] = host.len;
+  }
+}
+
+// The application writes the next chunk or frame, or everything at once
+static void host_write(void)
+{
+  while ( host.unit < host.units && (!interactive || host.units_in == host.unit) )
+  {
+    host.unit_written[host.unit] = now;
+    host.released = host.unit_end[host.unit++];
+  }
+}
+
+// Each reply byte against the byte that went out with it: the Game Boy
+// sends back the last byte it took, or 0xFF when it took none
+static void host_check(uint8_t const *data, uint8_t const *sent, bool const *pad, uint32_t len)
+{
+  for ( uint32_t i = 0; i < len; i++ )
+  {
+    if ( data[i] == 0xFF )
+    {
+      host.not_ready++;
+    }
+    else
+    {
+      if ( data[i] != host.peer_last ) host.wrong++;
+      host.peer_last = sent[i];
+    }
+    if ( !pad || !pad[i] ) host.replies_in++;
+  }
+}
+
+static void host_unit_in(void)
+{
+  sample(&round_trip, now - host.unit_written[host.units_in]);
+  host.units_in++;
+}
+
+// A packet's slots against what it sent: the parent's data, the children
+// there that plus their slot number, the rest 0xFFFF
+static void host_check_gba(uint8_t const *slots, uint32_t packet)
+{
+  uint32_t pos = packet * GBA_SEND_LEN;
+  uint16_t parent = queued.data[pos] | queued.data[pos + 1] << 8;
+
+  for ( uint32_t k = 0; k < GBA_SLOTS; k++ )
+  {
+    uint16_t got = slots[2 * k] | slots[2 * k + 1] << 8;
+    uint16_t want = k <= children ? (uint16_t) (parent + k) : 0xFFFF;
+    if ( got != want ) host.wrong++;
+    host.empty += got == 0xFFFF;
+  }
+  host.replies_in += !queued.pad[pos] + !queued.pad[pos + 1];
+}
+
+static void host_receive(uint8_t b)
+{
+  uint32_t pos = host.bytes_in++;
+  host.last_in = now;
+
+  if ( !framed )
+  {
+    if ( gba )
+    {
+      static uint8_t slots[GBA_REPLY_LEN];
+      slots[pos % GBA_REPLY_LEN] = b;
+      if ( pos % GBA_REPLY_LEN == GBA_REPLY_LEN - 1 ) host_check_gba(slots, pos / GBA_REPLY_LEN);
+    }
+    else
+    {
+      host_check(&b, queued.data + pos, queued.pad + pos, 1);
+    }
+    uint32_t end = (host.units_in + 1) * bytes_per_transfer;
+    if ( end > count ) end = count;
+    if ( host.units_in < host.units && host.replies_in == end ) host_unit_in();
+    return;
+  }
+
+  // A whole reply frame, walked record by record
+  host.reply[host.reply_len++] = b;
+  uint8_t const *at = host.reply + host.reply_parsed;
+  uint32_t have = host.reply_len - host.reply_parsed;
+  link_frame_t in;
+  if ( have < LINK_PROTO_HEADER_LEN ) return;
+  if ( !link_proto_get_header(at, &in) || in.opcode != (LINK_OP_EXCHANGE | LINK_OP_REPLY) )
+  {
+    host.wrong++;
+    host.reply_parsed = host.reply_len;
+    return;
+  }
+  if ( have < (uint32_t) LINK_PROTO_HEADER_LEN + in.len ) return;
+
+  uint32_t offset = 0;
+  link_exchange_t exchange;
+  while ( link_proto_next_exchange(at + LINK_PROTO_HEADER_LEN, in.len, &offset, &exchange) )
+    host_check(exchange.data, host.payload + host.replies_in, NULL, exchange.len);
+  if ( offset != in.len || in.seq != (uint8_t) host.units_in ) host.wrong++;
+
+  host.reply_parsed += LINK_PROTO_HEADER_LEN + in.len;
+  host_unit_in();
+}
+
+//--------------------------------------------------------------------+
+// Run
+//--------------------------------------------------------------------+
+
+// Everything a run leaves behind, so the next one starts as the first did
+static void reset(void)
+{
+  samples_t *all[] = { &latency, &byte_time, &gap_inside, &gap_between, &round_trip, &packet_time };
+  for ( size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++ )
+    all[i]->n = 0;
+
+  now = 0;
+  txf.head = txf.len = rxf.head = rxf.len = 0;
+  usb_out.head = usb_out.len = usb_in.head = usb_in.len = 0;
+  usb_out.size = usb_in.size = compact ? USB_PACKET : USB_FIFO;
+  tx_put = tx_taken = padded = 0;
+  memset(&work, 0, sizeof(work));
+  memset(&dma, 0, sizeof(dma));
+  memset(&sm, 0, sizeof(sm));
+  memset(&peer, 0, sizeof(peer));
+  burst_left = burst_gap_us = on_wire = 0;
+  burst_new = false;
+  frame_state = FRAME_HEADER;
+  frame_left = frame_errors = 0;
+  memset(&gba_txf, 0, sizeof(gba_txf));
+  memset(&gba_rxf, 0, sizeof(gba_rxf));
+  memset(&gba_dma, 0, sizeof(gba_dma));
+  memset(&gsm, 0, sizeof(gsm));
+  queued.len = 0;
+
+  free(host.stream);
+  free(host.unit_end);
+  free(host.unit_written);
+  free(host.payload);
+  free(host.reply);
+  memset(&host, 0, sizeof(host));
+}
+
+static bool run(void)
+{
+  reset();
+  spsc_ring_init(&tx_ring, tx_buf, sizeof(tx_buf));
+  spsc_ring_init(&rx_ring, rx_buf, sizeof(rx_buf));
+  link_pacer_init(&pacer);
+  host_build();
+
+  // gba_multi_program_init(): the timeout parked in Y, in polls of 2 cycles
+  gsm.y = GBA_TIMEOUT_BITS * GBA_CYCLES_PER_BIT / 2;
+  for ( uint32_t k = 0; k < GBA_SLOTS; k++ )
+    gsm.child_start[k] = NEVER;
+
+  uint64_t next_sm = 0, next_core0 = 0, next_core1 = 0;
+  uint64_t next_out = 0, next_in = packet_us * PS_PER_US / 2;
+  uint64_t progress = 0;
+  uint32_t last_in = 0;
+
+  while ( host.units_in < host.units )
+  {
+    now = next_sm;
+    if ( next_core0 < now ) now = next_core0;
+    if ( next_core1 < now ) now = next_core1;
+    if ( next_out < now ) now = next_out;
+    if ( next_in < now ) now = next_in;
+
+    host_write();
+
+    if ( now == next_out )
+    {
+      // A packet goes out when the host has data and the FIFO room for it
+      uint32_t n = host.released - host.sent;
+      if ( n > USB_PACKET ) n = USB_PACKET;
+      if ( n && usb_out.size - usb_out.len >= USB_PACKET )
+      {
+        for ( uint32_t i = 0; i < n; i++ )
+          fifo_put(&usb_out, host.stream[host.sent++], now, false);
+        next_out = now + packet_us * PS_PER_US;
+      }
+      else
+      {
+        next_out = now + PS_PER_US;
+      }
+    }
+
+    if ( now == next_in )
+    {
+      uint32_t n = usb_in.len < USB_PACKET ? usb_in.len : USB_PACKET;
+      for ( uint32_t i = 0; i < n; i++ )
+        host_receive(fifo_take(&usb_in, NULL, NULL));
+      next_in = now + (n ? packet_us * PS_PER_US : PS_PER_US);
+    }
+
+    if ( now == next_core0 )
+    {
+      cdc_task();
+      data_transfer_task();
+      next_core0 = now + (core0_loop_us / 2 + random_below(core0_loop_us + 1)) * PS_PER_US;
+    }
+
+    if ( now == next_core1 )
+    {
+      if ( gba )
+      {
+        gba_dma_service();
+        gba_task();
+        gba_dma_service();
+      }
+      else
+      {
+        dma_service();
+        if ( framed )
+          framed_task();
+        else
+          raw_task();
+        dma_service();
+      }
+      next_core1 = now + (core1_loop_ns / 2 + random_below(core1_loop_ns + 1)) * PS_PER_NS;
+    }
+
+    if ( now == next_sm && gba )
+    {
+      gba_step();
+      gba_dma_service();
+      next_sm = sm_cycle_time(sm.cycles);
+    }
+    else if ( now == next_sm )
+    {
+      sm_step();
+      dma_service();
+      next_sm = sm_cycle_time(sm.cycles);
+    }
+
+    if ( host.bytes_in != last_in )
+    {
+      last_in = host.bytes_in;
+      progress = now;
+    }
+    else if ( now - progress > STALL_PS )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Self test
+//--------------------------------------------------------------------+
+
+static double max_us(samples_t const *s)
+{
+  uint64_t max = 0;
+  for ( uint32_t i = 0; i < s->n; i++ )
+    if ( s->v[i] > max ) max = s->v[i];
+  return (double) max / PS_PER_US;
+}
+
+// Raw and framed mode on the DMA and the SM's FIFOs
+static void test_link(void)
+{
+  // Single bytes at the firmware's defaults
+  defaults();
+  count = 256;
+  CHECK(run());
+  CHECK(host.replies_in == count && !host.wrong && !host.not_ready);
+
+  // 64 byte bursts back to back. The DMA keeps the TX FIFO fed, so the SM
+  // never stalls inside a transfer and a burst's bytes follow each other
+  // at the SCK rate, while core 0 keeps USB going at the same pace.
+  defaults();
+  count = 16384;
+  bytes_per_transfer = 64;
+  gap_us = 0;
+  sck_set(4000000);
+  CHECK(run());
+  CHECK(!host.wrong && !host.not_ready);
+  CHECK(!sm.stall_cycles);
+  CHECK(max_us(&gap_inside) <= 1e6 / sck_hz());
+  double wire = byte_time.n / ((double) (sm.last_end - sm.first_start) / 1e12);
+  CHECK(wire >= 0.95 * sck_hz() / 8);
+  CHECK(count / ((double) host.last_in / 1e12) >= 0.95 * wire);
+
+  // Core 0 stores each byte once each way, a read and a write to the FIFOs
+  // at a time rather than a byte
+  CHECK(work.in_stored == work.in && work.out_stored == work.out);
+  CHECK(work.in_calls < work.in / 16 && work.out_calls < work.out / 16);
+
+  // 48 byte bursts wrap around the rings, going out in two segments. Only
+  // a read that meets the end of link_tx_ring goes through the bounce buffer.
+  bytes_per_transfer = 48;
+  CHECK(run());
+  CHECK(!host.wrong && !sm.stall_cycles);
+  CHECK(work.in_stored < work.in + work.in / 8);
+
+  // The top rate, a bit every 4 system clocks
+  bytes_per_transfer = 64;
+  sck_set(SYS_HZ / CYCLES_PER_BIT);
+  CHECK(run());
+  CHECK(!host.wrong && !sm.stall_cycles);
+
+  // Framed, streaming and one frame at a time
+  defaults();
+  framed = true;
+  bytes_per_transfer = 16;
+  records = 4;
+  gap_us = 100;
+  CHECK(run());
+  CHECK(!host.wrong && !frame_errors && host.units_in == host.units);
+  interactive = true;
+  count = 1024;
+  CHECK(run());
+  CHECK(!host.wrong && !frame_errors && host.units_in == host.units);
+}
+
+// GBA mode with every number of children: each slot right, and each empty
+// one costing the timeout instead of a child's frame
+static void test_gba(void)
+{
+  double transfer_us[GBA_SLOTS];
+
+  for ( uint32_t c = 0; c < GBA_SLOTS; c++ )
+  {
+    defaults();
+    gba = true;
+    children = c;
+    count = 256;
+    bytes_per_transfer = 8;
+    gap_us = 0;
+    gba_rate();
+    CHECK(run());
+    CHECK(!host.wrong && host.replies_in == count);
+    CHECK(host.empty == (GBA_SLOTS - 1 - c) * count / GBA_SEND_LEN);
+    CHECK(gsm.timeouts == host.empty);
+    transfer_us[c] = max_us(&packet_time);
+  }
+
+  double bit_us = 1e6 / GBA_BAUD;
+  for ( uint32_t c = 0; c + 1 < GBA_SLOTS; c++ )
+  {
+    // Bit times an empty slot takes over one with a child in it
+    double extra = (transfer_us[c] - transfer_us[c + 1]) / bit_us;
+    CHECK(extra > GBA_TIMEOUT_BITS - GBA_FRAME_BITS - 1);
+    CHECK(extra < GBA_TIMEOUT_BITS - GBA_FRAME_BITS + 1);
+  }
+}
+
+static int self_test(void)
+{
+  test_link();
+  test_gba();
+
+  return check_report();
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t hz = 0;
+  bool chunk_set = false, test = false;
+
+  defaults();
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "tfiUG:n:c:b:g:r:P:u:l:k:s:")) != -1 )
+  {
+    switch ( opt )
+    {
+      case 't': test = true; break;
+      case 'f': framed = true; break;
+      case 'i': interactive = true; break;
+      case 'U': compact = true; break;
+      case 'G': gba = true; children = strtoul(optarg, NULL, 0); break;
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      case 'c': hz = strtoul(optarg, NULL, 0); break;
+      case 'b': bytes_per_transfer = strtoul(optarg, NULL, 0); chunk_set = true; break;
+      case 'g': gap_us = strtoul(optarg, NULL, 0); break;
+      case 'r': records = strtoul(optarg, NULL, 0); break;
+      case 'P': need_us = strtoul(optarg, NULL, 0); break;
+      case 'u': packet_us = strtoul(optarg, NULL, 0); break;
+      case 'l': core0_loop_us = strtoul(optarg, NULL, 0); break;
+      case 'k': core1_loop_ns = strtoul(optarg, NULL, 0); break;
+      case 's': rng = strtoul(optarg, NULL, 0); break;
+      default: count = 0; break;
+    }
+  }
+  // The magic config packet makes GBA mode chunks one packet long
+  if ( gba && !chunk_set ) bytes_per_transfer = GBA_SEND_LEN;
+
+  if ( optind != argc || !count || !bytes_per_transfer || bytes_per_transfer > MAX_CHUNK ||
+       !records || !packet_us || !core0_loop_us || !core1_loop_ns || !rng ||
+       (gba && (framed || children >= GBA_SLOTS)) ||
+       (framed && bytes_per_transfer * records + LINK_PROTO_RECORD_LEN * records > UINT16_MAX) )
+  {
+    fprintf(stderr, "usage: %s [-f | -G children, 0 to 3] [-i] [-U] [-n count] [-c sck_hz] "
+                    "[-b bytes_per_transfer, 1 to %u] "
+                    "[-g gap_us] [-r records] [-P need_us] [-u packet_us] [-l core0_loop_us] "
+                    "[-k core1_loop_ns] [-s seed, not 0]\n", argv[0], MAX_CHUNK);
+    return 2;
+  }
+
+  if ( test ) return self_test();
+
+  if ( hz ) sck_set(hz);
+  if ( gba ) gba_rate();
+  bool finished = run();
+  double sck = sck_hz();
+
+  if ( gba )
+  {
+    printf("GBA mode, %s, %u bytes in %u byte chunks, %u us gap, %u children\n",
+           interactive ? "one at a time" : "streaming", count, bytes_per_transfer, gap_us,
+           children);
+    if ( !finished )
+    {
+      printf("STALLED with %u of %u bytes back\n", host.replies_in, count);
+      return 1;
+    }
+    printf("link: %u transfers, %.0f bytes/s host to host, %u slots timed out\n", gsm.transfers,
+           count / ((double) host.last_in / 1e12), gsm.timeouts);
+    print_samples("transfer time", &packet_time);
+    print_samples("write to reply", &round_trip);
+    printf("gba: %u slots read 0xFFFF, %u wrong, %u bytes of padding\n", host.empty, host.wrong,
+           padded);
+    return host.wrong ? 1 : 0;
+  }
+
+  printf("%s mode, %s, %u bytes in %u byte chunks, %u us gap", framed ? "framed" : "raw",
+         interactive ? "one at a time" : "streaming", count, bytes_per_transfer, gap_us);
+  if ( framed ) printf(", %u records a frame", records);
+  printf("\nSCK %.0f Hz (divider %.2f), Game Boy needs %u us a byte, USB packet every %u us, "
+         "%u byte USB FIFOs\n", sck, div256 / 256.0, need_us, packet_us, usb_out.size);
+  if ( !finished )
+  {
+    printf("STALLED with %u of %u bytes back\n", host.replies_in, count);
+    return 1;
+  }
+
+  // On the wire from the first edge to the last, padding included
+  double link_s = (double) (sm.last_end - sm.first_start) / 1e12;
+  printf("link: %u bytes, %.0f bytes/s on the wire (%.1f%% of the SCK rate), %.0f bytes/s host "
+         "to host\n", byte_time.n, byte_time.n / link_s, 800.0 * byte_time.n / link_s / sck,
+         count / ((double) host.last_in / 1e12));
+  printf("sck: %.0f ns a bit, %llu SM cycles, %llu of them stalled inside a transfer\n",
+         1e9 / sck, (unsigned long long) sm.cycles, (unsigned long long) sm.stall_cycles);
+  print_samples("byte time", &byte_time);
+  print_samples("gap in chunk", &gap_inside);
+  print_samples("gap between", &gap_between);
+  print_samples("usb to link", &latency);
+  print_samples("write to reply", &round_trip);
+  printf("game boy: %u bytes not taken, %u replies wrong, %u bytes of padding\n", host.not_ready,
+         host.wrong, padded);
+  if ( framed && frame_errors ) printf("framing: %u errors\n", frame_errors);
+  printf("core 0: %.2f bytes stored and %.3f calls a byte in, %.2f and %.3f out; "
+         "the copying path %.2f and %.3f in, %.2f and %.3f out\n",
+         per_byte(work.in_stored, work.in), per_byte(work.in_calls, work.in),
+         per_byte(work.out_stored, work.out), per_byte(work.out_calls, work.out),
+         per_byte(work.old_in_stored, work.in), per_byte(work.old_in_calls, work.in),
+         per_byte(work.old_out_stored, work.out), per_byte(work.old_out_calls, work.out));
+
+  return host.wrong || frame_errors ? 1 : 0;
+}
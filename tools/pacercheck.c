@@ -0,0 +1,194 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Checks link_pacer.c on the host with a fake clock: a chunk is never due
+ * before its gap has passed since the last one finished, and is due as
+ * soon as it has, including across the wrap of the 32 bit timer.
+ *
+ * Adaptive pacing is run against a peer with a fixed latency, which
+ * answers a chunk if and only if the gap before it was at least that
+ * long. Once settled the gap must stay close above the latency with few
+ * chunks lost, follow the latency when it drops or rises mid-session, and
+ * keep to its bounds. The figures of each run are printed.
+ *
+ *   cc -O2 -I. -o pacercheck tools/pacercheck.c link_pacer.c
+ *   pacercheck
+ *
+ * Prints each failed check and exits 1 if there was one.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "check.h"
+#include "link_pacer.h"
+
+static void check_deadline(void)
+{
+  link_pacer_t pacer;
+
+  // Nothing went out yet, the first chunk may go at once
+  link_pacer_init(&pacer);
+  CHECK(link_pacer_due(&pacer, 0));
+
+  link_pacer_done(&pacer, 1000, 500);
+  CHECK(!link_pacer_due(&pacer, 1000));
+  CHECK(!link_pacer_due(&pacer, 1499));
+  CHECK(link_pacer_due(&pacer, 1500));
+  CHECK(link_pacer_due(&pacer, 1000000));
+
+  link_pacer_done(&pacer, 2000, 0);
+  CHECK(link_pacer_due(&pacer, 2000));
+
+  // The microsecond timer's low 32 bits wrap after 71 minutes, the pacer
+  // keeps all 64
+  uint64_t now = 0xFFFFFF00u;
+  link_pacer_done(&pacer, now, 0x200);
+  CHECK(!link_pacer_due(&pacer, 0xFFFFFFFFu));
+  CHECK(!link_pacer_due(&pacer, 0x1000000FFull));
+  CHECK(link_pacer_due(&pacer, 0x100000100ull));
+}
+
+// A loop like the engine's: it polls the pacer every 1 to 8 us, and a due
+// chunk takes chunk_us on the wire. The idle time between two chunks must
+// be at least the gap and at most one poll over it.
+static void check_session(uint32_t gap_us, uint32_t chunk_us)
+{
+  link_pacer_t pacer;
+  link_pacer_init(&pacer);
+
+  uint64_t now = 0x7FFFF000u, last_end = 0;
+  uint32_t chunks = 0, short_gaps = 0, late = 0;
+
+  while ( chunks < 2000 )
+  {
+    now += 1 + rand() % 8;
+    if ( !link_pacer_due(&pacer, now) ) continue;
+
+    if ( chunks )
+    {
+      uint64_t idle = now - last_end;
+      short_gaps += idle < gap_us;
+      late += idle > gap_us + 8;
+    }
+
+    now += chunk_us;
+    last_end = now;
+    link_pacer_done(&pacer, now, gap_us);
+    chunks++;
+  }
+
+  if ( short_gaps || late )
+  {
+    printf("gap %u us, chunk %u us: %u gaps short, %u a poll late\n", gap_us, chunk_us,
+           short_gaps, late);
+    failures++;
+  }
+  checks++;
+}
+
+typedef struct
+{
+  uint32_t failures;
+  uint64_t gap_sum;
+  uint32_t gap_min, gap_max;
+} adapt_run_t;
+
+// count chunks to a peer that needs need_us between them
+static uint32_t adapt_run(link_adapt_t *adapt, uint32_t need_us, uint32_t count, adapt_run_t *run)
+{
+  run->failures = 0;
+  run->gap_sum = 0;
+  run->gap_min = UINT32_MAX;
+  run->gap_max = 0;
+
+  uint32_t gap = adapt->gap_us;
+  for ( uint32_t i = 0; i < count; i++ )
+  {
+    bool ok = gap >= need_us;
+    run->failures += !ok;
+    run->gap_sum += gap;
+    if ( gap < run->gap_min ) run->gap_min = gap;
+    if ( gap > run->gap_max ) run->gap_max = gap;
+    gap = link_adapt_update(adapt, ok);
+  }
+  return gap;
+}
+
+static void check_adapt_settled(uint32_t need_us)
+{
+  link_adapt_t adapt;
+  adapt_run_t run;
+  link_adapt_init(&adapt, LINK_ADAPT_MIN_US, LINK_ADAPT_MAX_US, 1000);
+
+  // Settle, then look at the next 20000 chunks
+  adapt_run(&adapt, need_us, 5000, &run);
+  adapt_run(&adapt, need_us, 20000, &run);
+
+  double mean = (double) run.gap_sum / 20000;
+  printf("adapt, peer needs %6u us: gap mean %8.1f min %6u max %6u, %3u of 20000 lost\n", need_us,
+         mean, run.gap_min, run.gap_max, run.failures);
+
+  // A peer slower than the bound allows only gets the bound
+  if ( need_us > LINK_ADAPT_MAX_US )
+  {
+    CHECK(run.gap_min == LINK_ADAPT_MAX_US && run.gap_max == LINK_ADAPT_MAX_US);
+    return;
+  }
+
+  uint32_t need = need_us < LINK_ADAPT_MIN_US ? LINK_ADAPT_MIN_US : need_us;
+  CHECK(run.failures <= 20000 / 100);
+  CHECK(mean <= 1.5 * need + 1);
+  CHECK(run.gap_min >= LINK_ADAPT_MIN_US && run.gap_max <= LINK_ADAPT_MAX_US);
+  if ( need_us <= LINK_ADAPT_MIN_US ) CHECK(run.failures == 0);
+}
+
+static void check_adapt_follows(uint32_t from_us, uint32_t to_us)
+{
+  link_adapt_t adapt;
+  adapt_run_t run;
+  link_adapt_init(&adapt, LINK_ADAPT_MIN_US, LINK_ADAPT_MAX_US, 1000);
+  adapt_run(&adapt, from_us, 5000, &run);
+
+  // Chunks until the gap is within a quarter above the new latency
+  uint32_t chunks = 0, failures = 0;
+  while ( chunks < 20000 && (adapt.gap_us < to_us || adapt.gap_us > to_us + to_us / 4) )
+  {
+    adapt_run(&adapt, to_us, 1, &run);
+    failures += run.failures;
+    chunks++;
+  }
+
+  printf("adapt, peer goes from %6u to %6u us: %5u chunks to follow, %u lost on the way\n",
+         from_us, to_us, chunks, failures);
+  // Each chunk lost on the way up doubles the gap, a couple more go while
+  // the floor catches up
+  uint32_t doublings = 0;
+  while ( (from_us << doublings) < to_us )
+    doublings++;
+  CHECK(chunks < 20000);
+  CHECK(failures <= doublings + 2);
+}
+
+int main(void)
+{
+  check_deadline();
+
+  uint32_t const gaps[] = { 0, 1, 36, 1000, 100000 };
+  for ( size_t i = 0; i < sizeof(gaps) / sizeof(gaps[0]); i++ )
+  {
+    check_session(gaps[i], 1);
+    check_session(gaps[i], 977);
+  }
+
+  uint32_t const needs[] = { 1, 36, 250, 1000, 4000, 60000, 200000 };
+  for ( size_t i = 0; i < sizeof(needs) / sizeof(needs[0]); i++ )
+    check_adapt_settled(needs[i]);
+  check_adapt_follows(2000, 200);
+  check_adapt_follows(200, 2000);
+  check_adapt_follows(50, 30000);
+
+  return check_report();
+}
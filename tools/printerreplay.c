@@ -0,0 +1,414 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Replays a Game Boy Printer session through link_printer.c the way
+ * printer_task() feeds it, and checks what the Game Boy got back.
+ *
+ *   cc -O2 -I. -o printerreplay tools/printerreplay.c link_printer.c
+ *   printerreplay [dump.bin]
+ *
+ * Without an argument it replays a captured session, INIT, a compressed
+ * DATA band, the empty DATA that ends the image, PRINT and the INQUIRY
+ * polls until the printer is done, and checks every reply byte, the
+ * decoded tiles and the PRINT arguments. It does so on time, with core 1
+ * held up for a few bytes in the middle of the band, which must only cost
+ * the replies of that packet, and held up the same way without the
+ * re-prime at the packet sync, which must cost more. Then core 1 is held
+ * up over a packet sync and catches up in the middle of a byte: the
+ * re-prime must wait for the end of that byte and line the replies up
+ * again within the packet, where a flush there and then would throw them
+ * off the Game Boy's bytes until the next packet.
+ *
+ * With a link trace dump taken in printer mode (see link_trace.h) it
+ * replays the captured bytes instead and prints what they decoded to. It
+ * exits 1 if a check failed or a packet in the dump had a bad checksum.
+ *
+ * The slave SM is modelled bit by bit as pio/spi.pio runs it: the first
+ * falling edge of a byte pulls the reply at the head of the TX FIFO, or
+ * the idle 0x00 if there is none, into the OSR, and the SM flags the byte
+ * as under way until its last bit is in. Core 1 takes the bytes that are
+ * in once each byte has ended, unless it is held up.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link_printer.h"
+#include "link_trace.h"
+
+#define TX_FIFO_DEPTH 4
+#define SESSION_MAX 1024
+
+typedef struct
+{
+  uint8_t const *bytes;
+  size_t len;
+  uint8_t status;     // expected in reply to the last byte
+} packet_t;
+
+static uint8_t const init_packet[] = {
+  0x88, 0x33, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00
+};
+
+// A band of 0xFF, four literal bytes and three 0x00 0xAA 0x55 runs of 129
+// bytes and a 0x00 run of 121
+static uint8_t const data_packet[] = {
+  0x88, 0x33, 0x04, 0x01, 0x0F, 0x00, 0xFE, 0xFF, 0x03, 0x3C, 0x42, 0x81, 0x7E,
+  0xFF, 0x00, 0xFF, 0xAA, 0xFF, 0x55, 0xF7, 0x00, 0x84, 0x08, 0x00, 0x00
+};
+
+static uint8_t const data_end_packet[] = {
+  0x88, 0x33, 0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00
+};
+
+// One sheet, margins 1 and 3, the usual palette, middle exposure
+static uint8_t const print_packet[] = {
+  0x88, 0x33, 0x02, 0x00, 0x04, 0x00, 0x01, 0x13, 0xE4, 0x40, 0x3E, 0x01, 0x00, 0x00
+};
+
+static uint8_t const inquiry_packet[] = {
+  0x88, 0x33, 0x0F, 0x00, 0x00, 0x00, 0x0F, 0x00, 0x00, 0x00
+};
+
+#define PACKET(p, status) { p, sizeof(p), status }
+
+static packet_t const session[] = {
+  PACKET(init_packet, 0x00),
+  PACKET(data_packet, LINK_PRINTER_UNPROCESSED),
+  PACKET(data_end_packet, LINK_PRINTER_UNPROCESSED),
+  PACKET(inquiry_packet, LINK_PRINTER_UNPROCESSED),
+  PACKET(print_packet, LINK_PRINTER_UNPROCESSED),
+  // Busy for LINK_PRINTER_BUSY_POLLS polls, then done
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, LINK_PRINTER_PRINTING | LINK_PRINTER_FULL),
+  PACKET(inquiry_packet, 0x00)
+};
+
+#define SESSION_PACKETS (sizeof(session) / sizeof(session[0]))
+
+static uint8_t const print_args[LINK_PRINTER_PRINT_LEN] = { 0x01, 0x13, 0xE4, 0x40 };
+
+static link_printer_t printer;
+
+// How core 1 lines the replies up again after a packet sync
+typedef enum
+{
+  RESYNC_NONE,
+  RESYNC_BETWEEN_BYTES, // printer_task()
+  RESYNC_AT_ONCE        // flush whether or not a byte is under way
+} resync_t;
+
+static uint8_t fifo[TX_FIFO_DEPTH];
+static uint32_t fifo_head, fifo_len;
+static uint32_t underruns;
+
+// The SM: bits shifted out of the OSR since the last pull, and its flag
+static uint32_t osr, osr_bits;
+static bool busy;
+
+// Core 1: bytes taken, the last two replies and whether they are to be
+// queued again
+static size_t taken;
+static uint8_t last_replies[2];
+static bool resync;
+
+static uint8_t band[16 * LINK_PRINTER_BAND_LEN];
+static uint32_t band_len, bands, prints;
+static uint8_t print[LINK_PRINTER_PRINT_LEN];
+
+static void fifo_put(uint8_t b)
+{
+  // A write to a full FIFO is dropped, as on the PIO
+  if ( fifo_len < TX_FIFO_DEPTH )
+    fifo[(fifo_head + fifo_len++) % TX_FIFO_DEPTH] = b;
+}
+
+static uint8_t fifo_take(void)
+{
+  if ( !fifo_len )
+  {
+    underruns++;
+    return 0x00;
+  }
+  uint8_t b = fifo[fifo_head];
+  fifo_head = (fifo_head + 1) % TX_FIFO_DEPTH;
+  fifo_len--;
+  return b;
+}
+
+// pio_spi_slave_flush(), which leaves a byte under way alone unless forced
+static bool slave_flush(bool force)
+{
+  if ( busy && !force ) return false;
+
+  // Each pull starts the OSR over, however far into a byte the SM is
+  while ( fifo_len )
+  {
+    osr = (uint32_t) fifo_take() << 24;
+    osr_bits = 0;
+  }
+  osr_bits = 32;
+  return true;
+}
+
+// Core 1 taking one captured byte, as printer_task() does
+static void take_byte(uint8_t in, resync_t how)
+{
+  link_printer_event_t event;
+  uint8_t reply = link_printer_byte(&printer, in, &event);
+  fifo_put(reply);
+  last_replies[0] = last_replies[1];
+  last_replies[1] = reply;
+  if ( event == LINK_PRINTER_SYNC && how != RESYNC_NONE ) resync = true;
+
+  if ( event == LINK_PRINTER_BAND_READY )
+  {
+    if ( band_len + printer.band_len <= sizeof(band) )
+    {
+      memcpy(band + band_len, printer.band, printer.band_len);
+      band_len += printer.band_len;
+    }
+    bands++;
+  }
+  else if ( event == LINK_PRINTER_PRINT_READY )
+  {
+    memcpy(print, printer.print, sizeof(print));
+    prints++;
+  }
+}
+
+// printer_task() with count bytes in
+static void printer_task(uint8_t const *wire, size_t count, resync_t how)
+{
+  while ( taken < count )
+    take_byte(wire[taken++], how);
+
+  if ( resync && taken == count && slave_flush(how == RESYNC_AT_ONCE) )
+  {
+    fifo_put(last_replies[0]);
+    fifo_put(last_replies[1]);
+    resync = false;
+  }
+}
+
+// The Game Boy clocks out wire, replies gets what it clocked in. Core 1
+// runs after each byte, but not while the Game Boy clocks [stall_at,
+// stall_at + stall_len). It catches up after the late_bit'th falling edge
+// of the byte after those, or after it if late_bit is 0.
+static void replay(uint8_t const *wire, size_t len, uint8_t *replies, size_t stall_at,
+                   size_t stall_len, uint32_t late_bit, resync_t how)
+{
+  link_printer_init(&printer);
+  fifo_head = fifo_len = underruns = 0;
+  band_len = bands = prints = 0;
+  osr_bits = 32;
+  busy = false;
+  taken = 0;
+  last_replies[0] = last_replies[1] = 0x00;
+  resync = false;
+
+  // printer_enter(): the replies to the first two bytes
+  fifo_put(0x00);
+  fifo_put(0x00);
+
+  for ( size_t i = 0; i < len; i++ )
+  {
+    uint8_t out = 0;
+    for ( uint32_t bit = 1; bit <= 8; bit++ )
+    {
+      // Falling edge
+      if ( osr_bits >= 8 )
+      {
+        osr = (uint32_t) fifo_take() << 24;
+        osr_bits = 0;
+        busy = true;
+      }
+      out = (out << 1) | (osr >> 31);
+      osr <<= 1;
+      osr_bits++;
+      if ( i == stall_at + stall_len && bit == late_bit ) printer_task(wire, i, how);
+
+      // Rising edge, the ISR pushes every 8 bits whatever the OSR does
+      if ( osr_bits >= 8 ) busy = false;
+    }
+    replies[i] = out;
+
+    if ( i >= stall_at && i < stall_at + stall_len ) continue;
+    printer_task(wire, i + 1, how);
+  }
+}
+
+// Where packet p starts in the session
+static size_t packet_offset(size_t p)
+{
+  size_t offset = 0;
+  while ( p-- )
+    offset += session[p].len;
+  return offset;
+}
+
+// Replies to the bytes from on of the session, false and a message for the
+// first that is not what a printer answers, unless pass is NULL. After a
+// hold up between packet syncs the replies only line up from the command
+// byte of the next packet on, the re-prime comes with its 0x33; the Game
+// Boy does not look at the two before.
+static bool check_replies(uint8_t const *replies, size_t from, char const *pass)
+{
+  size_t offset = 0;
+  for ( size_t p = 0; p < SESSION_PACKETS; p++ )
+  {
+    size_t len = session[p].len;
+    for ( size_t j = offset < from ? from - offset : 0; j < len; j++ )
+    {
+      uint8_t want = j == len - 2 ? LINK_PRINTER_ID : j == len - 1 ? session[p].status : 0x00;
+      if ( replies[offset + j] != want )
+      {
+        if ( pass )
+          printf("%s: packet %zu byte %zu got 0x%02x, want 0x%02x\n", pass, p, j,
+                 replies[offset + j], want);
+        return false;
+      }
+    }
+    offset += len;
+  }
+  return true;
+}
+
+static bool check_decoded(char const *pass)
+{
+  uint8_t want[LINK_PRINTER_BAND_LEN];
+  memset(want, 0xFF, 128);
+  memcpy(want + 128, "\x3C\x42\x81\x7E", 4);
+  memset(want + 132, 0x00, 129);
+  memset(want + 261, 0xAA, 129);
+  memset(want + 390, 0x55, 129);
+  memset(want + 519, 0x00, 121);
+
+  if ( bands != 1 || band_len != LINK_PRINTER_BAND_LEN || memcmp(band, want, sizeof(want)) )
+  {
+    printf("%s: %u bands, %u bytes of tiles, not the one band the DATA packet holds\n", pass,
+           bands, band_len);
+    return false;
+  }
+  if ( prints != 1 || memcmp(print, print_args, sizeof(print)) )
+  {
+    printf("%s: %u prints, not the one PRINT packet with its arguments\n", pass, prints);
+    return false;
+  }
+  if ( printer.errors )
+  {
+    printf("%s: %u packets came in bad\n", pass, printer.errors);
+    return false;
+  }
+  return true;
+}
+
+static int replay_session(void)
+{
+  static uint8_t wire[SESSION_MAX], replies[SESSION_MAX];
+  size_t len = 0;
+  for ( size_t p = 0; p < SESSION_PACKETS; p++ )
+  {
+    memcpy(wire + len, session[p].bytes, session[p].len);
+    len += session[p].len;
+  }
+
+  // Well into the band's data, three bytes is more than the FIFO holds
+  size_t stall_at = packet_offset(1) + 10;
+  bool ok = true;
+
+  replay(wire, len, replies, len, 0, 0, RESYNC_BETWEEN_BYTES);
+  bool pass = check_replies(replies, 0, "on time") && check_decoded("on time") && !underruns;
+  printf("on time: %u packets, %u underruns, %s\n", printer.packets, underruns,
+         pass ? "passed" : "FAILED");
+  ok &= pass;
+
+  replay(wire, len, replies, stall_at, 3, 0, RESYNC_BETWEEN_BYTES);
+  pass = underruns && check_replies(replies, packet_offset(2) + 2, "held up") &&
+         check_decoded("held up");
+  printf("held up: %u packets, %u underruns, replies in line from the next packet, %s\n",
+         printer.packets, underruns, pass ? "passed" : "FAILED");
+  ok &= pass;
+
+  // The check above only means something if the hold up does throw the
+  // replies off
+  replay(wire, len, replies, stall_at, 3, 0, RESYNC_NONE);
+  pass = underruns && !check_replies(replies, packet_offset(2) + 2, NULL);
+  printf("no re-prime: replies stay out of line, %s\n", pass ? "passed" : "FAILED");
+  ok &= pass;
+
+  // Held up over the sync of the empty DATA packet, core 1 takes its 0x88
+  // 0x33 and command byte three bits into the compression byte. The
+  // re-prime waits for that byte to end, so every reply from the one after
+  // it on is in line, the packet's own ID and status included.
+  size_t late_at = packet_offset(2);
+  replay(wire, len, replies, late_at, 3, 3, RESYNC_BETWEEN_BYTES);
+  pass = check_replies(replies, late_at + 4, "late sync") && check_decoded("late sync");
+  printf("late sync: %u packets, %u underruns, replies in line after the byte, %s\n",
+         printer.packets, underruns, pass ? "passed" : "FAILED");
+  ok &= pass;
+
+  // A flush in the middle of that byte leaves the SM pulling three bits
+  // into each of the Game Boy's bytes, until the next packet's sync
+  replay(wire, len, replies, late_at, 3, 3, RESYNC_AT_ONCE);
+  pass = !check_replies(replies, late_at + 4, NULL) &&
+         check_replies(replies, packet_offset(3) + 2, "flush mid byte");
+  printf("flush mid byte: replies off until the next packet, %s\n", pass ? "passed" : "FAILED");
+  ok &= pass;
+
+  return ok ? 0 : 1;
+}
+
+static int replay_dump(char const *path)
+{
+  FILE *f = fopen(path, "rb");
+  if ( !f )
+  {
+    perror(path);
+    return 1;
+  }
+
+  // The bytes the Game Boy sent, the replies were not traced
+  size_t len = 0, max = 4096;
+  uint8_t *wire = malloc(max);
+  uint8_t record[LINK_TRACE_RECORD_LEN];
+  while ( fread(record, 1, sizeof(record), f) == sizeof(record) )
+  {
+    if ( (record[6] & (LINK_TRACE_SLAVE | LINK_TRACE_IN)) != (LINK_TRACE_SLAVE | LINK_TRACE_IN) )
+      continue;
+    if ( len == max ) wire = realloc(wire, max *= 2);
+    wire[len++] = record[5];
+  }
+  fclose(f);
+
+  uint8_t *replies = malloc(len ? len : 1);
+  replay(wire, len, replies, len, 0, 0, RESYNC_BETWEEN_BYTES);
+  printf("%s: %zu bytes, %u packets, %u bad\n", path, len, printer.packets, printer.errors);
+  printf("%u bands, %u bytes of tiles, %u prints\n", bands, band_len, prints);
+  if ( prints )
+    printf("last print: %u sheets, margins 0x%02x, palette 0x%02x, exposure 0x%02x\n", print[0],
+           print[1], print[2], print[3]);
+
+  free(wire);
+  free(replies);
+  return printer.errors ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  if ( argc > 2 )
+  {
+    fprintf(stderr, "usage: %s [dump.bin]\n", argv[0]);
+    return 2;
+  }
+  return argc == 2 ? replay_dump(argv[1]) : replay_session();
+}
@@ -0,0 +1,304 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Checks the link_proto.c helpers against the layouts in link_proto.h:
+ * every put writes exactly the documented bytes and nothing past them, its
+ * get reads back what went in, and link_proto_next_exchange() never hands
+ * out a record that runs past the payload, however it is cut short.
+ *
+ *   cc -O2 -I. -o protocheck tools/protocheck.c link_proto.c
+ *   protocheck
+ *
+ * Prints each failed check and exits 1 if there was one.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "link_proto.h"
+
+#define GUARD 0xEE
+
+static uint8_t buf[1024];
+
+// a is put into buf, which must then hold wire and nothing past it, and
+// read back into b. Both were zeroed before their fields were set, so any
+// padding compares equal.
+#define ROUND_TRIP(kind, len, ...)                                     \
+  do                                                                   \
+  {                                                                    \
+    static uint8_t const wire[] = { __VA_ARGS__ };                     \
+    CHECK(sizeof(wire) == (len));                                      \
+    memset(buf, GUARD, sizeof(buf));                                   \
+    CHECK(link_proto_put_##kind(buf, &a) == (len));                    \
+    CHECK(!memcmp(buf, wire, sizeof(wire)));                           \
+    CHECK(buf[len] == GUARD);                                          \
+    link_proto_get_##kind(buf, &b);                                    \
+    CHECK(!memcmp(&a, &b, sizeof(a)));                                 \
+  } while ( 0 )
+
+static void check_header(void)
+{
+  link_frame_t frame;
+
+  memset(buf, GUARD, sizeof(buf));
+  CHECK(link_proto_put_header(buf, LINK_OP_EXCHANGE, 0xC3, 0xBEEF) == LINK_PROTO_HEADER_LEN);
+  CHECK(!memcmp(buf, "\xA7\x01\x04\xC3\xEF\xBE", LINK_PROTO_HEADER_LEN));
+  CHECK(buf[LINK_PROTO_HEADER_LEN] == GUARD);
+
+  CHECK(link_proto_get_header(buf, &frame));
+  CHECK(frame.version == LINK_PROTO_VERSION);
+  CHECK(frame.opcode == LINK_OP_EXCHANGE);
+  CHECK(frame.seq == 0xC3);
+  CHECK(frame.len == 0xBEEF);
+
+  // Anything but the sync byte is not a frame
+  buf[0] = LINK_PROTO_SYNC ^ 0x01;
+  CHECK(!link_proto_get_header(buf, &frame));
+}
+
+static void check_exchange(void)
+{
+  uint8_t const data[3] = { 0x11, 0x22, 0x33 };
+  link_exchange_t exchange;
+
+  memset(buf, GUARD, sizeof(buf));
+  CHECK(link_proto_put_exchange(buf, sizeof(data), 0x89ABCDEF, data) == LINK_PROTO_RECORD_LEN + 3);
+  CHECK(!memcmp(buf, "\x03\x00\xEF\xCD\xAB\x89\x11\x22\x33", LINK_PROTO_RECORD_LEN + 3));
+  CHECK(buf[LINK_PROTO_RECORD_LEN + 3] == GUARD);
+
+  link_proto_get_exchange_header(buf, &exchange);
+  CHECK(exchange.len == sizeof(data));
+  CHECK(exchange.gap_us == 0x89ABCDEF);
+  CHECK(exchange.data == buf + LINK_PROTO_RECORD_LEN);
+
+  // Without data only the record header is written, the length still
+  // counts the data that is to follow
+  memset(buf, GUARD, sizeof(buf));
+  CHECK(link_proto_put_exchange(buf, 0x1234, 7, NULL) == LINK_PROTO_RECORD_LEN + 0x1234);
+  CHECK(!memcmp(buf, "\x34\x12\x07\x00\x00\x00", LINK_PROTO_RECORD_LEN));
+  CHECK(buf[LINK_PROTO_RECORD_LEN] == GUARD);
+}
+
+static void check_structs(void)
+{
+  memset(buf, GUARD, sizeof(buf));
+  CHECK(link_proto_put_u32(buf, 0x89ABCDEF) == 4);
+  CHECK(!memcmp(buf, "\xEF\xCD\xAB\x89", 4) && buf[4] == GUARD);
+  CHECK(link_proto_get_u32(buf) == 0x89ABCDEF);
+
+  {
+    link_config_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.us_between_transfer = 0x89ABCDEF;
+    a.bytes_per_transfer = 0xFE;
+    a.mode = LINK_MODE_PRINTER;
+    ROUND_TRIP(config, LINK_PROTO_CONFIG_LEN, 0xEF, 0xCD, 0xAB, 0x89, 0xFE, 0x04);
+
+    // The ready flag comes off the chunk size, a mode past the last is
+    // turned down
+    bool ready;
+    CHECK(link_proto_parse_config(buf, &b, &ready));
+    CHECK(ready && b.bytes_per_transfer == 0x7E && b.mode == LINK_MODE_PRINTER);
+    buf[4] = 0x10;
+    CHECK(link_proto_parse_config(buf, &b, &ready));
+    CHECK(!ready && b.bytes_per_transfer == 0x10);
+    buf[5] = LINK_MODE_COUNT;
+    CHECK(!link_proto_parse_config(buf, &b, &ready));
+  }
+
+  {
+    link_rule_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.state = 0x81;
+    a.mask = 0xF0;
+    a.match = 0x90;
+    a.reply = 0xA5;
+    a.next_state = 0xFF;
+    a.flags = 0x03;
+    a.wait_us = 0xBEEF;
+    ROUND_TRIP(rule, LINK_PROTO_RULE_LEN, 0x81, 0xF0, 0x90, 0xA5, 0xFF, 0x03, 0xEF, 0xBE);
+  }
+
+  {
+    link_run_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.first = 0xC1;
+    a.state = 0x82;
+    a.limit = 0xFEDCBA98;
+    ROUND_TRIP(run, LINK_PROTO_RUN_LEN, 0xC1, 0x82, 0x98, 0xBA, 0xDC, 0xFE);
+  }
+
+  {
+    link_result_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.reason = 3;
+    a.last = 0xFD;
+    a.exchanged = 0x80000001;
+    ROUND_TRIP(result, LINK_PROTO_RESULT_LEN, 0x03, 0xFD, 0x01, 0x00, 0x00, 0x80);
+  }
+
+  {
+    link_adapt_config_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.enable = 1;
+    a.idle = 0xFF;
+    a.min_us = 0x01020304;
+    a.max_us = 0xF1F2F3F4;
+    ROUND_TRIP(adapt, LINK_PROTO_ADAPT_LEN, 0x01, 0xFF, 0x04, 0x03, 0x02, 0x01, 0xF4, 0xF3, 0xF2,
+               0xF1);
+  }
+
+  {
+    link_port_config_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.port = 2;
+    a.bytes_per_transfer = 0x80;
+    a.us_between_transfer = 0xA0B0C0D0;
+    ROUND_TRIP(port_config, LINK_PROTO_PORT_CONFIG_LEN, 0x02, 0x80, 0xD0, 0xC0, 0xB0, 0xA0);
+  }
+
+  {
+    link_profile_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    // A full name, no NUL
+    memcpy(a.name, "pokemon-trad", LINK_PROFILE_NAME_LEN);
+    a.mode = LINK_MODE_SLAVE;
+    a.bytes_per_transfer = 0xFF;
+    a.us_between_transfer = LINK_PROTO_ADAPTIVE_GAP;
+    a.sck_hz = LINK_CLOCK_CGB_FAST_DOUBLE;
+    a.flags = LINK_PROFILE_READY_LINE | LINK_PROFILE_ACTIVE_LOW | LINK_PROFILE_LSB_FIRST;
+    a.pin_sout = 0x1C;
+    a.pin_si = LINK_PROFILE_PIN_STRAP;
+    a.frame_bits = 32;
+    ROUND_TRIP(profile, LINK_PROTO_PROFILE_LEN, 'p', 'o', 'k', 'e', 'm', 'o', 'n', '-', 't', 'r',
+               'a', 'd', 0x02, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x08, 0x00, 0x07, 0x1C,
+               0xFF, 0x20);
+  }
+
+  {
+    link_bench_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.count = 0x00100000;
+    a.sck_hz = LINK_CLOCK_CGB_FAST;
+    a.bytes_per_transfer = 64;
+    a.us_between_transfer = 0x87654321;
+    a.flags = LINK_BENCH_LOOPBACK;
+    ROUND_TRIP(bench, LINK_PROTO_BENCH_LEN, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x04, 0x00, 0x40,
+               0x21, 0x43, 0x65, 0x87, 0x01);
+  }
+
+  {
+    link_report_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.exchanged = 0x11111111;
+    a.elapsed_us = 0x22222222;
+    a.bytes_per_s = 0x33333333;
+    a.mismatches = 0x44444444;
+    a.stall_cycles = 0x55555555;
+    a.pacing_mean_us = 0x66666666;
+    a.pacing_max_us = 0x77777777;
+    a.sck_hz = 0x88888888;
+    ROUND_TRIP(report, LINK_PROTO_REPORT_LEN, 0x11, 0x11, 0x11, 0x11, 0x22, 0x22, 0x22, 0x22, 0x33,
+               0x33, 0x33, 0x33, 0x44, 0x44, 0x44, 0x44, 0x55, 0x55, 0x55, 0x55, 0x66, 0x66, 0x66,
+               0x66, 0x77, 0x77, 0x77, 0x77, 0x88, 0x88, 0x88, 0x88);
+  }
+
+  {
+    link_stats_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.bytes_exchanged = 0xDEADBEEF;
+    a.frames = 0x00C0FFEE;
+    a.errors = 0xFFFFFFFF;
+    ROUND_TRIP(stats, LINK_PROTO_STATS_LEN, 0xEF, 0xBE, 0xAD, 0xDE, 0xEE, 0xFF, 0xC0, 0x00, 0xFF,
+               0xFF, 0xFF, 0xFF);
+  }
+}
+
+static void check_next_exchange(void)
+{
+  // Records of 0, 5 and 300 bytes, then the end of each of them
+  uint16_t const lens[] = { 0, 5, 300 };
+  uint32_t ends[3];
+  uint8_t payload[3 * LINK_PROTO_RECORD_LEN + 305];
+  uint32_t total = 0;
+  for ( int i = 0; i < 3; i++ )
+  {
+    uint8_t data[300];
+    memset(data, 0x40 + i, sizeof(data));
+    total += link_proto_put_exchange(payload + total, lens[i], 1000 * i, data);
+    ends[i] = total;
+  }
+  CHECK(total == sizeof(payload));
+
+  // Every way of cutting the payload short: the records that are whole
+  // come out in order, nothing reaches past the cut, and the one cut
+  // through stops the walk with offset left at its start
+  for ( uint32_t cut = 0; cut <= total; cut++ )
+  {
+    uint32_t offset = 0, count = 0;
+    link_exchange_t exchange;
+
+    while ( link_proto_next_exchange(payload, cut, &offset, &exchange) )
+    {
+      bool inside = exchange.data >= payload && exchange.data + exchange.len <= payload + cut;
+      if ( count >= 3 || exchange.len != lens[count] || offset != ends[count] || !inside ||
+           exchange.gap_us != 1000 * count )
+      {
+        printf("cut at %u: record %u is not the one put there\n", cut, count);
+        failures++;
+        break;
+      }
+      if ( exchange.len && exchange.data[exchange.len - 1] != 0x40 + count )
+      {
+        printf("cut at %u: record %u does not point at its data\n", cut, count);
+        failures++;
+      }
+      count++;
+    }
+
+    uint32_t whole = (cut >= ends[0]) + (cut >= ends[1]) + (cut >= ends[2]);
+    CHECK(count == whole);
+    CHECK(offset == (whole ? ends[whole - 1] : 0));
+    CHECK(offset <= cut);
+  }
+
+  // A length that claims more than the payload holds, all the way up
+  uint8_t small[LINK_PROTO_RECORD_LEN + 4];
+  link_exchange_t exchange;
+  link_proto_put_exchange(small, 0xFFFF, 0, NULL);
+  uint32_t offset = 0;
+  CHECK(!link_proto_next_exchange(small, sizeof(small), &offset, &exchange));
+  CHECK(offset == 0);
+
+  // Right at the end, and with no payload at all
+  offset = total;
+  CHECK(!link_proto_next_exchange(payload, total, &offset, &exchange));
+  CHECK(offset == total);
+  offset = 0;
+  CHECK(!link_proto_next_exchange(NULL, 0, &offset, &exchange));
+  CHECK(offset == 0);
+}
+
+int main(void)
+{
+  check_header();
+  check_exchange();
+  check_structs();
+  check_next_exchange();
+
+  return check_report();
+}
@@ -0,0 +1,322 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Host benchmark of spsc_ring.c against the ring it replaced, which kept
+ * both indices on one cache line and loaded the other side's index on
+ * every call. A producer and a consumer thread, on CPUs of their own where
+ * there are two, move count bytes through a ring in chunks of each size
+ * and the time per byte is printed for:
+ *
+ *   old   the old ring's push/pop, the only interface it had
+ *   copy  spsc_ring_push/spsc_ring_pop
+ *   zero  spsc_ring_reserve/commit and spsc_ring_peek/consume, the bytes
+ *         written and read in place as the USB and DMA paths do
+ *
+ *   cc -O2 -I. -pthread -o ringbench tools/ringbench.c spsc_ring.c
+ *   ringbench [-n count] [-r ring_size] [-c chunk]
+ *
+ * The ring defaults to LINK_RING_SIZE, 1024 bytes; every chunk size from 1
+ * to 512 is run unless -c picks one. The consumer checks every byte, a run
+ * that loses or reorders one fails. The figures are the host's: they show
+ * what the cache line layout saves where there are caches to share, not
+ * what the RP2040 does.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+#define CHUNK_MAX 512
+
+//--------------------------------------------------------------------+
+// The ring before the cached indices, as it was in spsc_ring.c
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint8_t *buf;
+  uint32_t mask;          // capacity - 1, capacity is a power of two
+  _Atomic uint32_t head;  // free running read count, written by the consumer
+  _Atomic uint32_t tail;  // free running write count, written by the producer
+} old_ring_t;
+
+static void old_ring_init(old_ring_t *ring, uint8_t *buf, uint32_t size)
+{
+  ring->buf = buf;
+  ring->mask = size - 1;
+  atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+}
+
+static inline uint32_t old_ring_available(old_ring_t *ring)
+{
+  return atomic_load_explicit(&ring->tail, memory_order_acquire) -
+         atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
+
+static inline uint32_t old_ring_free(old_ring_t *ring)
+{
+  return ring->mask + 1 - (atomic_load_explicit(&ring->tail, memory_order_relaxed) -
+                           atomic_load_explicit(&ring->head, memory_order_acquire));
+}
+
+static uint32_t old_ring_push(old_ring_t *ring, uint8_t const *src, uint32_t len)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t space = old_ring_free(ring);
+  if ( len > space ) len = space;
+
+  uint32_t idx = tail & ring->mask;
+  uint32_t first = ring->mask + 1 - idx;
+  if ( first > len ) first = len;
+  memcpy(ring->buf + idx, src, first);
+  memcpy(ring->buf, src + first, len - first);
+
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+  return len;
+}
+
+static uint32_t old_ring_pop(old_ring_t *ring, uint8_t *dst, uint32_t len)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t count = old_ring_available(ring);
+  if ( len > count ) len = count;
+
+  uint32_t idx = head & ring->mask;
+  uint32_t first = ring->mask + 1 - idx;
+  if ( first > len ) first = len;
+  memcpy(dst, ring->buf + idx, first);
+  memcpy(dst + first, ring->buf, len - first);
+
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  return len;
+}
+
+//--------------------------------------------------------------------+
+// Benchmark
+//--------------------------------------------------------------------+
+
+typedef enum
+{
+  VARIANT_OLD,
+  VARIANT_COPY,
+  VARIANT_ZERO,
+  VARIANT_COUNT
+} variant_t;
+
+static char const *const variant_names[VARIANT_COUNT] = { "old", "copy", "zero" };
+
+typedef struct
+{
+  variant_t variant;
+  uint64_t count;
+  uint32_t chunk;
+  old_ring_t old;
+  spsc_ring_t ring;
+  pthread_barrier_t start;
+  bool corrupt;
+} bench_t;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( cpus < 2 ) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// The byte at position i of the stream
+static inline uint8_t stream_byte(uint64_t i)
+{
+  return (uint8_t) (i ^ (i >> 8));
+}
+
+static void *producer(void *arg)
+{
+  bench_t *b = arg;
+  uint8_t chunk[CHUNK_MAX];
+  uint64_t sent = 0;
+
+  pin(0);
+  pthread_barrier_wait(&b->start);
+
+  while ( sent < b->count )
+  {
+    uint32_t want = b->count - sent < b->chunk ? b->count - sent : b->chunk;
+    uint32_t n;
+
+    if ( b->variant == VARIANT_ZERO )
+    {
+      uint8_t *ptr;
+      n = spsc_ring_reserve(&b->ring, &ptr);
+      if ( n > want ) n = want;
+      for ( uint32_t i = 0; i < n; i++ )
+        ptr[i] = stream_byte(sent + i);
+      spsc_ring_commit(&b->ring, n);
+    }
+    else
+    {
+      for ( uint32_t i = 0; i < want; i++ )
+        chunk[i] = stream_byte(sent + i);
+      n = b->variant == VARIANT_OLD ? old_ring_push(&b->old, chunk, want)
+                                    : spsc_ring_push(&b->ring, chunk, want);
+    }
+
+    // Full: let the consumer have the CPU if it shares this one
+    if ( !n ) sched_yield();
+    sent += n;
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg)
+{
+  bench_t *b = arg;
+  uint8_t chunk[CHUNK_MAX];
+  uint64_t received = 0;
+
+  pin(1);
+  pthread_barrier_wait(&b->start);
+
+  while ( received < b->count )
+  {
+    uint8_t const *data = chunk;
+    uint32_t n;
+
+    if ( b->variant == VARIANT_ZERO )
+    {
+      n = spsc_ring_peek(&b->ring, &data);
+      if ( n > b->chunk ) n = b->chunk;
+    }
+    else
+    {
+      n = b->variant == VARIANT_OLD ? old_ring_pop(&b->old, chunk, b->chunk)
+                                    : spsc_ring_pop(&b->ring, chunk, b->chunk);
+    }
+
+    if ( !n )
+    {
+      sched_yield();
+      continue;
+    }
+
+    for ( uint32_t i = 0; i < n; i++ )
+      b->corrupt |= data[i] != stream_byte(received + i);
+    if ( b->variant == VARIANT_ZERO ) spsc_ring_consume(&b->ring, n);
+    received += n;
+  }
+  return NULL;
+}
+
+// ns per byte, or a negative value if the stream came out wrong
+static double run(variant_t variant, uint64_t count, uint32_t chunk, uint8_t *storage,
+                  uint32_t ring_size)
+{
+  static bench_t b;
+  b.variant = variant;
+  b.count = count;
+  b.chunk = chunk;
+  b.corrupt = false;
+  old_ring_init(&b.old, storage, ring_size);
+  spsc_ring_init(&b.ring, storage, ring_size);
+  pthread_barrier_init(&b.start, NULL, 3);
+
+  pthread_t p, c;
+  pthread_create(&c, NULL, consumer, &b);
+  pthread_create(&p, NULL, producer, &b);
+  pthread_barrier_wait(&b.start);
+  uint64_t start = now_ns();
+  pthread_join(p, NULL);
+  pthread_join(c, NULL);
+  uint64_t elapsed = now_ns() - start;
+  pthread_barrier_destroy(&b.start);
+
+  return b.corrupt ? -1 : (double) elapsed / count;
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t count = 64 << 20;
+  uint32_t ring_size = 1024;
+  uint32_t only_chunk = 0;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "n:r:c:")) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n': count = strtoull(optarg, NULL, 0); break;
+      case 'r': ring_size = strtoul(optarg, NULL, 0); break;
+      case 'c': only_chunk = strtoul(optarg, NULL, 0); break;
+      default: count = 0; break;
+    }
+  }
+  if ( optind != argc || !count || !ring_size || (ring_size & (ring_size - 1)) ||
+       only_chunk > CHUNK_MAX )
+  {
+    fprintf(stderr, "usage: %s [-n count] [-r ring_size, a power of two] [-c chunk, up to %u]\n",
+            argv[0], CHUNK_MAX);
+    return 2;
+  }
+
+  if ( sysconf(_SC_NPROCESSORS_ONLN) < 2 )
+    fprintf(stderr, "only one CPU: the threads take turns, the figures are the scheduler's\n");
+
+  uint8_t *storage = aligned_alloc(SPSC_RING_CACHE_LINE, ring_size);
+  uint32_t const chunks[] = { 1, 8, 64, 512 };
+  bool ok = true;
+
+  printf("%llu bytes through a %u byte ring, ns per byte\n", (unsigned long long) count, ring_size);
+  printf("chunk      old     copy     zero\n");
+  for ( size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++ )
+  {
+    uint32_t chunk = only_chunk ? only_chunk : chunks[i];
+
+    // Single bytes are slow enough that a sixteenth of the stream will do
+    uint64_t n = chunk == 1 ? (count + 15) / 16 : count;
+
+    printf("%5u", chunk);
+    for ( variant_t v = 0; v < VARIANT_COUNT; v++ )
+    {
+      double ns = run(v, n, chunk, storage, ring_size);
+      if ( ns < 0 )
+      {
+        printf("  %7s", "BAD");
+        fprintf(stderr, "%s, chunk %u: the stream came out wrong\n", variant_names[v], chunk);
+        ok = false;
+      }
+      else
+      {
+        printf("  %7.3f", ns);
+      }
+      fflush(stdout);
+    }
+    printf("\n");
+
+    if ( only_chunk ) break;
+  }
+
+  free(storage);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Checks link_script.c on the host: rules match in order under their
+ * mask, move the script between states and leave it alone when nothing
+ * matches, and a table holds LINK_SCRIPT_MAX_RULES rules and no more.
+ *
+ * Scripts are then run against a simulated Game Boy the way frame_script()
+ * in link_engine.c runs them, one byte exchanged at a time: the peer
+ * answers each byte with the next of its own and checks the byte it got.
+ * The handshake is a trade in miniature, idle bytes until the peer is
+ * ready, a block of data the host wants to see, and an end marker; then
+ * the ways a run can stop early: a byte no rule covers, the exchange limit
+ * and a full forward buffer.
+ *
+ *   cc -O2 -I. -o scriptcheck tools/scriptcheck.c link_script.c
+ *   scriptcheck
+ *
+ * Prints each failed check and exits 1 if there was one.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "link_script.h"
+
+//--------------------------------------------------------------------+
+// Simulated Game Boy
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint8_t const *sends;    // what it answers each exchange with, in order
+  uint8_t const *expects;  // what it wants to get, NULL for anything
+  uint32_t len;
+  uint32_t pos;
+  uint32_t wrong;          // bytes got that were not the expected ones
+} peer_t;
+
+// One byte each way, as on the wire
+static uint8_t peer_exchange(peer_t *peer, uint8_t got)
+{
+  uint32_t i = peer->pos < peer->len ? peer->pos : peer->len - 1;
+  if ( peer->expects && peer->pos < peer->len && got != peer->expects[i] ) peer->wrong++;
+  peer->pos++;
+  return peer->sends[i];
+}
+
+//--------------------------------------------------------------------+
+// frame_script(), with the peer in place of the wire
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  link_result_t result;
+  uint8_t forward[LINK_SCRIPT_MAX_FORWARD];
+  uint32_t forwarded;
+  uint64_t wait_us;   // idle time the rules asked for
+} run_t;
+
+static void run_script(link_script_t *script, peer_t *peer, link_run_t const *args, run_t *run)
+{
+  memset(run, 0, sizeof(*run));
+  script->state = args->state;
+  uint8_t tx = args->first;
+
+  for ( ;; )
+  {
+    uint8_t rx = peer_exchange(peer, tx);
+    run->result.exchanged++;
+    run->result.last = rx;
+
+    link_rule_t const *rule = link_script_match(script, rx);
+    if ( !rule )
+    {
+      run->result.reason = LINK_SCRIPT_NO_MATCH;
+      return;
+    }
+
+    if ( rule->flags & LINK_SCRIPT_FORWARD )
+    {
+      if ( run->forwarded == LINK_SCRIPT_MAX_FORWARD )
+      {
+        run->result.reason = LINK_SCRIPT_FORWARD_FULL;
+        return;
+      }
+      run->forward[run->forwarded++] = rx;
+    }
+
+    if ( rule->flags & LINK_SCRIPT_STOP )
+    {
+      run->result.reason = LINK_SCRIPT_DONE;
+      return;
+    }
+    if ( args->limit && run->result.exchanged == args->limit )
+    {
+      run->result.reason = LINK_SCRIPT_LIMIT;
+      return;
+    }
+
+    tx = rule->reply;
+    run->wait_us += rule->wait_us;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Checks
+//--------------------------------------------------------------------+
+
+static void add(link_script_t *script, uint8_t state, uint8_t mask, uint8_t match, uint8_t reply,
+                uint8_t next_state, uint8_t flags, uint16_t wait_us)
+{
+  link_rule_t rule = { state, mask, match, reply, next_state, flags, wait_us };
+  CHECK(link_script_add(script, &rule));
+}
+
+static void check_match(void)
+{
+  static link_script_t script;
+  link_script_clear(&script);
+
+  // The specific rule comes first and wins over the catch-all
+  add(&script, 0, 0xFF, 0x60, 0xA0, 1, 0, 0);
+  add(&script, 0, 0xF0, 0x60, 0xA1, 2, 0, 0);
+  add(&script, 0, 0x00, 0x00, 0xA2, 0, 0, 0);
+  add(&script, 1, 0x0F, 0x05, 0xB0, 0, 0, 0);
+
+  link_rule_t const *rule = link_script_match(&script, 0x60);
+  CHECK(rule && rule->reply == 0xA0 && script.state == 1);
+
+  // Only the low nibble counts in state 1
+  rule = link_script_match(&script, 0xF5);
+  CHECK(rule && rule->reply == 0xB0 && script.state == 0);
+
+  rule = link_script_match(&script, 0x6F);
+  CHECK(rule && rule->reply == 0xA1 && script.state == 2);
+
+  // Nothing for state 2: no rule, and the state stays
+  CHECK(!link_script_match(&script, 0x00));
+  CHECK(script.state == 2);
+
+  script.state = 0;
+  rule = link_script_match(&script, 0x12);
+  CHECK(rule && rule->reply == 0xA2 && script.state == 0);
+
+  // Full at LINK_SCRIPT_MAX_RULES
+  link_script_clear(&script);
+  CHECK(script.count == 0 && script.state == 0);
+  link_rule_t any = { 0 };
+  for ( int i = 0; i < LINK_SCRIPT_MAX_RULES; i++ )
+    CHECK(link_script_add(&script, &any));
+  CHECK(!link_script_add(&script, &any));
+  CHECK(script.count == LINK_SCRIPT_MAX_RULES);
+}
+
+// Idle 0xFF until the peer sends 0x60, then eight bytes for the host
+// answered with 0x00, then 0xFD to end. States 1 to 8 count the data.
+static void trade_script(link_script_t *script)
+{
+  link_script_clear(script);
+  add(script, 0, 0xFF, 0x60, 0x60, 1, 0, 0);
+  add(script, 0, 0xFF, 0xFF, 0x01, 0, 0, 100);
+  for ( uint8_t state = 1; state <= 8; state++ )
+    add(script, state, 0x00, 0x00, 0x00, state + 1, LINK_SCRIPT_FORWARD, 36);
+  add(script, 9, 0xFF, 0xFD, 0x00, 0, LINK_SCRIPT_STOP, 0);
+}
+
+static void check_trade(void)
+{
+  static link_script_t script;
+  trade_script(&script);
+
+  // The device opens with 0x01. The peer's reply to each byte comes back
+  // with that byte, so what it expects is the script's answer to the byte
+  // before.
+  static uint8_t const sends[] = {
+    0xFF, 0xFF, 0x60, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0xFD
+  };
+  static uint8_t const expects[] = {
+    0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+  };
+  peer_t peer = { sends, expects, sizeof(sends), 0, 0 };
+  link_run_t args = { .first = 0x01, .state = 0, .limit = 0 };
+  run_t run;
+
+  run_script(&script, &peer, &args, &run);
+  CHECK(run.result.reason == LINK_SCRIPT_DONE);
+  CHECK(run.result.exchanged == sizeof(sends));
+  CHECK(run.result.last == 0xFD);
+  CHECK(peer.wrong == 0);
+  CHECK(run.forwarded == 8 && !memcmp(run.forward, sends + 3, 8));
+  CHECK(run.wait_us == 2 * 100 + 8 * 36);
+
+  // Something else where the end marker should be
+  static uint8_t const bad[] = {
+    0x60, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99
+  };
+  peer = (peer_t) { bad, NULL, sizeof(bad), 0, 0 };
+  run_script(&script, &peer, &args, &run);
+  CHECK(run.result.reason == LINK_SCRIPT_NO_MATCH);
+  CHECK(run.result.exchanged == sizeof(bad));
+  CHECK(run.result.last == 0x99);
+  CHECK(script.state == 9);
+  CHECK(run.forwarded == 8);
+
+  // A peer that never gets ready, cut off by the limit
+  static uint8_t const idle[] = { 0xFF };
+  peer = (peer_t) { idle, NULL, sizeof(idle), 0, 0 };
+  args.limit = 50;
+  run_script(&script, &peer, &args, &run);
+  CHECK(run.result.reason == LINK_SCRIPT_LIMIT);
+  CHECK(run.result.exchanged == 50);
+  CHECK(run.forwarded == 0);
+}
+
+static void check_forward_full(void)
+{
+  static link_script_t script;
+  link_script_clear(&script);
+  add(&script, 0, 0x00, 0x00, 0x00, 0, LINK_SCRIPT_FORWARD, 0);
+
+  static uint8_t const stream[] = { 0x42 };
+  peer_t peer = { stream, NULL, sizeof(stream), 0, 0 };
+  link_run_t args = { 0 };
+  run_t run;
+
+  // The byte that finds the buffer full is exchanged but not kept
+  run_script(&script, &peer, &args, &run);
+  CHECK(run.result.reason == LINK_SCRIPT_FORWARD_FULL);
+  CHECK(run.forwarded == LINK_SCRIPT_MAX_FORWARD);
+  CHECK(run.result.exchanged == LINK_SCRIPT_MAX_FORWARD + 1);
+}
+
+int main(void)
+{
+  check_match();
+  check_trade();
+  check_forward_full();
+
+  return check_report();
+}
@@ -0,0 +1,81 @@
+/*
+ * SPDX-License-Identifier: GPL-3.0
+ *
+ * Turns a link trace dump, the raw bytes read from the trace interface,
+ * into a pcap file with one packet per link byte: out, in, flags. Use
+ * LINKTYPE_USER0 in Wireshark to look at it.
+ *
+ *   cc -I. -o trace2pcap tools/trace2pcap.c
+ *   trace2pcap dump.bin dump.pcap
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "link_trace.h"
+
+#define LINKTYPE_USER0 147
+
+static void put_u32(FILE *f, uint32_t v)
+{
+  uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+  fwrite(b, 1, sizeof(b), f);
+}
+
+static void put_u16(FILE *f, uint16_t v)
+{
+  uint8_t b[2] = { v, v >> 8 };
+  fwrite(b, 1, sizeof(b), f);
+}
+
+int main(int argc, char **argv)
+{
+  if ( argc != 3 )
+  {
+    fprintf(stderr, "usage: %s dump.bin out.pcap\n", argv[0]);
+    return 2;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  FILE *out = fopen(argv[2], "wb");
+  if ( !in || !out )
+  {
+    perror("trace2pcap");
+    return 1;
+  }
+
+  // pcap global header, microsecond timestamps
+  put_u32(out, 0xa1b2c3d4);
+  put_u16(out, 2);
+  put_u16(out, 4);
+  put_u32(out, 0);
+  put_u32(out, 0);
+  put_u32(out, 65535);
+  put_u32(out, LINKTYPE_USER0);
+
+  // The device only keeps the low 32 bits of the timer, unwrap them
+  uint8_t record[LINK_TRACE_RECORD_LEN];
+  uint64_t high = 0;
+  uint32_t last = 0;
+  unsigned long count = 0;
+
+  while ( fread(record, 1, sizeof(record), in) == sizeof(record) )
+  {
+    uint32_t time_us = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t) record[3] << 24);
+    if ( count && time_us < last ) high += 1ull << 32;
+    last = time_us;
+
+    uint64_t t = high | time_us;
+    put_u32(out, t / 1000000);
+    put_u32(out, t % 1000000);
+    put_u32(out, 3);
+    put_u32(out, 3);
+    fwrite(record + 4, 1, 3, out);
+    count++;
+  }
+
+  fclose(in);
+  fclose(out);
+  fprintf(stderr, "%lu records\n", count);
+  return 0;
+}
@@ -94,21 +94,50 @@
 #define CFG_TUD_ENDPOINT0_SIZE    64
 #endif
 
+// Buffering profile, pick one with -DUSB_PROFILE=... (see CMakeLists.txt)
+// - USB_PROFILE_COMPACT: one packet per FIFO
+// - USB_PROFILE_THROUGHPUT: several packets per FIFO, so the class drivers
+//   can queue the next endpoint transfer while the application is still
+//   draining the previous packets
+#define USB_PROFILE_COMPACT       0
+#define USB_PROFILE_THROUGHPUT    1
+
+#ifndef USB_PROFILE
+#define USB_PROFILE               USB_PROFILE_THROUGHPUT
+#endif
+
+#define USB_PACKET_SIZE           (TUD_OPT_HIGH_SPEED ? 512 : 64)
+
+#if USB_PROFILE == USB_PROFILE_THROUGHPUT
+  #define USB_FIFO_SIZE           (8 * USB_PACKET_SIZE)
+#else
+  #define USB_FIFO_SIZE           USB_PACKET_SIZE
+#endif
+
+// Interrupt endpoint pair for interactive exchanges, -DUSB_INTERRUPT=1 adds
+// it as a HID interface (see CMakeLists.txt and link_proto.h)
+#ifndef USB_INTERRUPT
+#define USB_INTERRUPT             0
+#endif
+
 //------------- CLASS -------------//
 #define CFG_TUD_CDC               1
 #define CFG_TUD_MSC               0
-#define CFG_TUD_HID               0
+#define CFG_TUD_HID               USB_INTERRUPT
 #define CFG_TUD_MIDI              0
-#define CFG_TUD_VENDOR            1
+#define CFG_TUD_VENDOR            2 // WebUSB, link trace
 
 // CDC FIFO size of TX and RX
-#define CFG_TUD_CDC_RX_BUFSIZE    (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_CDC_TX_BUFSIZE    (TUD_OPT_HIGH_SPEED ? 512 : 64)
+#define CFG_TUD_CDC_RX_BUFSIZE    USB_FIFO_SIZE
+#define CFG_TUD_CDC_TX_BUFSIZE    USB_FIFO_SIZE
 
 // Vendor FIFO size of TX and RX
 // If not configured vendor endpoints will not be buffered
-#define CFG_TUD_VENDOR_RX_BUFSIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_VENDOR_TX_BUFSIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
+#define CFG_TUD_VENDOR_RX_BUFSIZE USB_FIFO_SIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE USB_FIFO_SIZE
+
+// HID endpoint size, one report: LINK_PROTO_HID_REPORT_LEN
+#define CFG_TUD_HID_EP_BUFSIZE    8
 
 
 #ifdef __cplusplus
@@ -28,7 +28,19 @@
 enum
 {
   VENDOR_REQUEST_WEBUSB = 1,
-  VENDOR_REQUEST_MICROSOFT = 2
+  VENDOR_REQUEST_MICROSOFT = 2,
+  // Link control, see tud_vendor_control_xfer_cb()
+  VENDOR_REQUEST_STATS = 3,
+  VENDOR_REQUEST_PROFILE = 4,
+  VENDOR_REQUEST_CONFIGURE = 5,
+  VENDOR_REQUEST_RESET = 6
+};
+
+// Vendor class instances, in interface order
+enum
+{
+  VENDOR_INSTANCE_WEBUSB = 0,
+  VENDOR_INSTANCE_TRACE
 };
 
 extern uint8_t const desc_ms_os_20[];